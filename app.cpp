@@ -7,13 +7,28 @@
 #include <QDir>
 #include <QFile>
 #include <QDateTime>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QResource>
 
 #include <string>
 #include <iostream>
 #include <fstream>
+#include <functional>
+#include <unordered_map>
 
+#include "archive.h"
+#include "digest.h"
+#include "downloads.h"
+#include "filestreams.h"
+#include "filetasks.h"
+#include "filetree.h"
+#include "filewatchers.h"
 #include "handler.h"
 #include "print_handler.h"
+#include "responsecache.h"
+#include "server.h"
+#include "startup.h"
 #include "debug.h"
 
 #include "include/cef_browser.h"
@@ -23,6 +38,9 @@
 
 PhantomJSApp::PhantomJSApp()
   : m_printHandler(new PrintHandler)
+  , m_fileStreams(new FileStreams)
+  , m_fileTasks(new FileTasks)
+  , m_fileWatchers(new FileWatchers)
   , m_messageRouter(CefMessageRouterRendererSide::Create(PhantomJSHandler::messageRouterConfig()))
 {
 }
@@ -39,20 +57,106 @@ void PhantomJSApp::OnRegisterCustomSchemes(CefRefPtr<CefSchemeRegistrar> registr
   registrar->AddCustomScheme("file", false, true, true);
 }
 
+void PhantomJSApp::OnBeforeCommandLineProcessing(const CefString& process_type,
+                                                 CefRefPtr<CefCommandLine> command_line)
+{
+  // only the browser process knows about the config, sub processes inherit the relevant switches
+  if (!process_type.empty() || !m_commandLine) {
+    return;
+  }
+  CefCommandLine::SwitchMap switches;
+  m_commandLine->GetSwitches(switches);
+  for (const auto& entry : switches) {
+    if (command_line->HasSwitch(entry.first)) {
+      continue;
+    } else if (entry.second.empty()) {
+      command_line->AppendSwitch(entry.first);
+    } else {
+      command_line->AppendSwitchWithValue(entry.first, entry.second);
+    }
+  }
+}
+
+void PhantomJSApp::setCommandLine(CefRefPtr<CefCommandLine> commandLine)
+{
+  m_commandLine = commandLine;
+}
+
+namespace {
+// encode the string as a JavaScript string literal
+QByteArray toJsString(const QString& string)
+{
+  const auto json = QJsonDocument(QJsonArray{string}).toJson(QJsonDocument::Compact);
+  // strip the surrounding brackets of the array
+  return json.mid(1, json.size() - 2);
+}
+}
+
 void PhantomJSApp::OnContextInitialized()
 {
   CEF_REQUIRE_UI_THREAD();
 
-  // PhantomJSHandler implements browser-level callbacks.
-  CefRefPtr<PhantomJSHandler> handler(new PhantomJSHandler());
+  recordStartupTiming("contextInitialized");
 
-  // Create the first browser window with empty content to get our hands on a frame
-  auto browser = handler->createBrowser("about:blank", true);
-  auto frame = browser->GetMainFrame();
+  // PhantomJSHandler implements browser-level callbacks.
+  m_handler = new PhantomJSHandler();
 
   auto command_line = CefCommandLine::GetGlobalCommandLine();
+  if (command_line->HasSwitch("shared-cache")) {
+    auto responseCache = ResponseCache::create(command_line);
+    if (!responseCache) {
+      m_handler->setExitCode(1);
+      m_handler->quit();
+      return;
+    }
+    m_handler->setResponseCache(responseCache);
+  }
+
+  bool archiveOk = true;
+  auto networkArchive = NetworkArchive::create(command_line, &archiveOk);
+  if (!archiveOk) {
+    m_handler->setExitCode(1);
+    m_handler->quit();
+    return;
+  }
+  m_handler->setNetworkArchive(networkArchive);
+  m_handler->setDownloadManager(DownloadManager::create(command_line));
+
+  if (command_line->HasSwitch("job-server")) {
+    m_jobServer.reset(new JobServer(this, m_handler));
+    m_handler->setJobServer(m_jobServer.get());
+    if (!m_jobServer->start(command_line->GetSwitchValue("job-server"))) {
+      m_handler->setExitCode(1);
+      m_handler->quit();
+    }
+    return;
+  }
+
   CefCommandLine::ArgumentList arguments;
   command_line->GetArguments(arguments);
+  if (arguments.empty()) {
+    std::cerr << "Missing script parameter.\n";
+    m_handler->setExitCode(1);
+    m_handler->quit();
+    return;
+  }
+  runScript(arguments);
+}
+
+CefRefPtr<CefBrowser> PhantomJSApp::runScript(const CefCommandLine::ArgumentList& arguments,
+                                              CefRefPtr<CefRequestContext> requestContext)
+{
+  CEF_REQUIRE_UI_THREAD();
+
+  // Create the phantom main browser with empty content to get our hands on a frame
+  recordStartupTiming("browserCreateStart");
+  auto browser = m_handler->createBrowser("about:blank", true, {}, requestContext);
+  if (!browser) {
+    return nullptr;
+  }
+  recordStartupTiming("browserCreated");
+  auto frame = browser->GetMainFrame();
+
   auto scriptFileInfo = QFileInfo(QString::fromStdString(arguments.front()));
   const auto scriptPath = scriptFileInfo.absoluteFilePath().toStdString();
 
@@ -64,19 +168,70 @@ void PhantomJSApp::OnContextInitialized()
   // forward extension code into global namespace
   content << "window.onerror = phantom.internal.propagateOnError;\n";
   content << "window.require = phantom.require;\n";
-  // send arguments to script
-  content << "phantom.args = [";
+  // forward the timings of the startup phases in the browser process
+  recordStartupTiming("bootstrapLoadStart");
+  content << "phantom.internal.initStartupTimings(" << QJsonDocument(startupTimings()).toJson(QJsonDocument::Compact).constData() << ");\n";
+  // send arguments to script, JSON encoding takes care of escaping
+  QJsonArray jsonArguments;
   for (const auto& arg : arguments) {
-    content << '\"' << arg << "\",";
+    jsonArguments.append(QString::fromStdString(arg));
   }
-  content << "];\n";
+  content << "phantom.args = " << QJsonDocument(jsonArguments).toJson(QJsonDocument::Compact).constData() << ";\n";
   // default initialize the library path to the folder of the script that will be executed
-  content << "phantom.libraryPath = \"" << scriptFileInfo.absolutePath().toStdString() << "\";\n";
-  content <<"</script>\n";
-  // then load the actual script
-  content << "<script type=\"text/javascript\" src=\"file://" << scriptPath << "\" onerror=\"phantom.internal.onScriptLoadError();\"></script>\n";
+  content << "phantom.libraryPath = " << toJsString(scriptFileInfo.absolutePath()).constData() << ";\n";
+  // then run the actual script directly in the renderer, which is faster than loading it via a file:// url
+  content << "phantom.internal.runScript(" << toJsString(scriptFileInfo.absoluteFilePath()).constData() << ");\n";
+  content << "</script>\n";
   content << "</head><body></body></html>";
   frame->LoadString(content.str(), "phantomjs://" + scriptPath);
+  return browser;
+}
+
+int PhantomJSApp::exitCode() const
+{
+  return m_handler ? m_handler->exitCode() : 0;
+}
+
+bool PhantomJSApp::isPhantomMain(int browserId) const
+{
+  return m_phantomMainBrowsers.contains(browserId);
+}
+
+int PhantomJSApp::phantomMainBrowserId(const CefRefPtr<CefV8Context>& context) const
+{
+  for (const auto& trusted : m_trustedContexts) {
+    if (trusted.first->IsSame(context)) {
+      return trusted.second;
+    }
+  }
+  // a context is bound to a single document, so its URL and browser never change
+  static const std::string phantomjsScheme = "phantomjs://";
+  const auto browserId = context->GetBrowser()->GetIdentifier();
+  if (!isPhantomMain(browserId) || context->GetFrame()->GetURL().ToString().compare(0, phantomjsScheme.size(), phantomjsScheme)) {
+    return 0;
+  }
+  m_trustedContexts.append(qMakePair(context, browserId));
+  return browserId;
+}
+
+bool PhantomJSApp::isJob(int browserId) const
+{
+  return m_phantomMainBrowsers.value(browserId, false);
+}
+
+FileStreams* PhantomJSApp::fileStreams() const
+{
+  return m_fileStreams.get();
+}
+
+FileTasks* PhantomJSApp::fileTasks() const
+{
+  return m_fileTasks.get();
+}
+
+FileWatchers* PhantomJSApp::fileWatchers() const
+{
+  return m_fileWatchers.get();
 }
 
 CefRefPtr<CefPrintHandler> PhantomJSApp::GetPrintHandler()
@@ -98,19 +253,32 @@ std::string findLibrary(const QString& filePath, const QString& libraryPath)
   return {};
 }
 
-std::string readFile(const std::string& filePath)
+// converts UTF-8 to the UTF-16 used by CefString and V8 without an intermediate std::string
+CefString fromUtf8(const char* data, size_t size)
 {
-  std::ifstream in(filePath);
-  if (!in) {
+  CefString string;
+  cef_string_utf8_to_utf16(data, size, string.GetWritableStruct());
+  return string;
+}
+
+CefString readFile(const std::string& filePath)
+{
+  QFile file(QString::fromStdString(filePath));
+  if (!file.open(QIODevice::ReadOnly)) {
     return {};
   }
-  std::string contents;
-  in.seekg(0, std::ios::end);
-  contents.resize(in.tellg());
-  in.seekg(0, std::ios::beg);
-  contents.assign(std::istreambuf_iterator<char>(in),
-                  std::istreambuf_iterator<char>());
-  return contents;
+  // regular files are mapped and converted directly from the page cache
+  const auto size = file.size();
+  if (size > 0) {
+    if (auto data = file.map(0, size)) {
+      const auto contents = fromUtf8(reinterpret_cast<const char*>(data), size);
+      file.unmap(data);
+      return contents;
+    }
+  }
+  // pipes and other special files report a size of zero
+  const auto contents = file.readAll();
+  return fromUtf8(contents.constData(), contents.size());
 }
 
 bool writeFile(const std::string& filePath, const std::string& contents, const std::string& m)
@@ -132,167 +300,652 @@ bool writeFile(const std::string& filePath, const std::string& contents, const s
   return false;
 }
 
-bool remove(const QString& path)
+// streams the file through the digest, regular files are mapped instead of read
+QString hashFile(const QString& path, const QString& algorithm, QString* error)
 {
-  QFileInfo info(path);
-  if (info.isDir()){
-    QDir dir(path);
-    return dir.removeRecursively();
+  if (!StreamDigest::isSupported(algorithm)) {
+    *error = QStringLiteral("Unknown hash algorithm \"%1\".").arg(algorithm);
+    return {};
   }
-  QFile f(path);
-  return f.remove();
+  QFile file(path);
+  if (!file.open(QIODevice::ReadOnly)) {
+    *error = QStringLiteral("Failed to open %1: %2").arg(path, file.errorString());
+    return {};
+  }
+  StreamDigest digest({algorithm});
+  const auto size = file.size();
+  if (auto data = size > 0 ? file.map(0, size) : nullptr) {
+    digest.addData(reinterpret_cast<const char*>(data), size);
+    file.unmap(data);
+  } else {
+    QByteArray buffer(1024 * 1024, Qt::Uninitialized);
+    qint64 read;
+    while ((read = file.read(buffer.data(), buffer.size())) > 0) {
+      digest.addData(buffer.constData(), read);
+    }
+    if (read < 0) {
+      *error = QStringLiteral("Failed to read %1: %2").arg(path, file.errorString());
+      return {};
+    }
+  }
+  return digest.result().value(algorithm).toString();
 }
 
-bool copyRecursively(const QString &srcFilePath, const QString &tgtFilePath)
+TreeOptions treeOptions(const QString& json)
 {
-  QFileInfo srcFileInfo(srcFilePath);
-  if (srcFileInfo.isDir()) {
-    if (!QDir().mkpath(tgtFilePath)) {
-      return false;
-    }
+  const auto object = QJsonDocument::fromJson(json.toUtf8()).object();
+  TreeOptions options;
+  options.preserveSymlinks = object.value(QStringLiteral("preserveSymlinks")).toBool();
+  options.overwrite = object.value(QStringLiteral("overwrite")).toBool();
+  options.threads = object.value(QStringLiteral("threads")).toInt(options.threads);
+  return options;
+}
+
+ListOptions listOptions(const QString& json)
+{
+  const auto object = QJsonDocument::fromJson(json.toUtf8()).object();
+  ListOptions options;
+  options.recursive = object.value(QStringLiteral("recursive")).toBool();
+  options.glob = object.value(QStringLiteral("glob")).toString();
+  options.threads = object.value(QStringLiteral("threads")).toInt(options.threads);
+  return options;
+}
+
+// copy and remove of fs.promises, which report their progress
+FileTasks::ProgressWork treeOperation(const std::string& operation, const QStringList& args)
+{
+  const auto path = args.value(0);
+  if (operation == "copy") {
+    const auto target = args.value(1);
+    const auto options = treeOptions(args.value(2));
+    return [path, target, options] (const FileTasks::Progress& progress, QString* error) -> QJsonValue {
+      auto reportingOptions = options;
+      reportingOptions.progress = progress;
+      return copyTree(path, target, reportingOptions, error);
+    };
+  } else if (operation == "remove") {
+    const auto options = treeOptions(args.value(1));
+    return [path, options] (const FileTasks::Progress& progress, QString* error) -> QJsonValue {
+      auto reportingOptions = options;
+      reportingOptions.progress = progress;
+      return removeTree(path, reportingOptions, error);
+    };
+  }
+  return nullptr;
+}
 
-    QDir sourceDir(srcFilePath);
-    QDir::Filters sourceDirFilter = QDir::NoDotAndDotDot | QDir::AllEntries | QDir::NoSymLinks | QDir::Hidden;
-    foreach (const QFileInfo& entry, sourceDir.entryInfoList(sourceDirFilter, QDir::DirsFirst)) {
-      const QString destination = tgtFilePath + '/' + entry.fileName();
-      if (!copyRecursively(entry.absoluteFilePath(), destination)) {
-        return false;
+// the other operations of fs.promises, run by FileTasks on a worker thread
+FileTasks::Work asyncOperation(const std::string& operation, const QStringList& args)
+{
+  const auto path = args.value(0);
+  if (operation == "read") {
+    return [path] (QString* error) -> QJsonValue {
+      QFile file(path);
+      if (!file.open(QIODevice::ReadOnly)) {
+        *error = QStringLiteral("Failed to open %1: %2").arg(path, file.errorString());
+        return {};
       }
+      return QString::fromUtf8(file.readAll());
+    };
+  } else if (operation == "write") {
+    const auto contents = args.value(1).toStdString();
+    const auto mode = args.value(2).toStdString();
+    return [path, contents, mode] (QString* error) -> QJsonValue {
+      if (!writeFile(path.toStdString(), contents, mode)) {
+        *error = QStringLiteral("Failed to write %1").arg(path);
+        return {};
+      }
+      return true;
+    };
+  } else if (operation == "list") {
+    return [path] (QString*) -> QJsonValue {
+      return QJsonArray::fromStringList(QDir(path).entryList());
+    };
+  } else if (operation == "listDetailed") {
+    const auto options = listOptions(args.value(1));
+    return [path, options] (QString* error) -> QJsonValue {
+      return listTree(path, options, error);
+    };
+  } else if (operation == "hash") {
+    const auto algorithm = args.value(1);
+    return [path, algorithm] (QString* error) -> QJsonValue {
+      return hashFile(path, algorithm, error);
+    };
+  } else if (operation == "size") {
+    return [path] (QString*) -> QJsonValue {
+      return QFileInfo(path).size();
+    };
+  } else if (operation == "exists") {
+    return [path] (QString*) -> QJsonValue {
+      return QFile::exists(path);
+    };
+  } else if (operation == "isFile") {
+    return [path] (QString*) -> QJsonValue {
+      return QFileInfo(path).isFile();
+    };
+  } else if (operation == "isDirectory") {
+    return [path] (QString*) -> QJsonValue {
+      return QFileInfo(path).isDir();
+    };
+  } else if (operation == "lastModified") {
+    return [path] (QString*) -> QJsonValue {
+      return QFileInfo(path).lastModified().toUTC().toString(Qt::ISODate);
+    };
+  } else if (operation == "makeTree") {
+    return [path] (QString*) -> QJsonValue {
+      return QDir().mkpath(path);
+    };
+  }
+  return nullptr;
+}
+
+// strings with one character per byte, as sent by fromBytes in the fs module
+QByteArray latin1Data(const CefString& string)
+{
+  return QString(reinterpret_cast<const QChar*>(string.c_str()), static_cast<int>(string.length())).toLatin1();
+}
+
+// text streams are UTF-8 encoded, binary ones map every byte to a single character
+CefRefPtr<CefV8Value> streamData(const QByteArray& data, bool binary)
+{
+  if (binary) {
+    const auto latin1 = QString::fromLatin1(data);
+    CefString string;
+    cef_string_utf16_set(reinterpret_cast<const char16*>(latin1.utf16()), latin1.size(), string.GetWritableStruct(), true);
+    return CefV8Value::CreateString(string);
+  }
+  return CefV8Value::CreateString(fromUtf8(data.constData(), data.size()));
+}
+
+// the number of bytes missing to complete the UTF-8 sequence @p data ends with
+int missingUtf8Bytes(const QByteArray& data)
+{
+  // the lead byte of a sequence is at most three bytes before the end
+  for (int i = 1; i <= 3 && i <= data.size(); ++i) {
+    const auto byte = static_cast<uchar>(data.at(data.size() - i));
+    if ((byte & 0xC0) == 0x80) {
+      continue;
     }
-    return true;
-  } else {
-    QFileInfo tgtFileInfo(tgtFilePath);
-    QFileInfo srcFileInfo(srcFilePath);
-    if (tgtFileInfo.isDir()){
-      return copyRecursively(srcFilePath, tgtFilePath + '/' + srcFileInfo.fileName());
-    }
-    return QFile::copy(srcFilePath, tgtFilePath);
+    const int length = (byte & 0xE0) == 0xC0 ? 2 : (byte & 0xF0) == 0xE0 ? 3 : (byte & 0xF8) == 0xF0 ? 4 : 1;
+    return length > i ? length - i : 0;
+  }
+  return 0;
+}
+
+QByteArray streamData(const CefRefPtr<CefV8Value>& value, bool binary)
+{
+  if (binary) {
+    return latin1Data(value->GetStringValue());
   }
+  const auto data = value->GetStringValue().ToString();
+  return QByteArray(data.data(), data.size());
+}
+
+#if CHROME_VERSION_BUILD >= 3202
+// keeps the data of an ArrayBuffer alive until V8 collects it
+class ByteArrayReleaser : public CefV8ArrayBufferReleaseCallback
+{
+public:
+  ByteArrayReleaser(QByteArray data)
+    : m_data(std::move(data))
+  {}
+
+  void* data()
+  {
+    // detaches from raw data, e.g. of mapped files
+    return m_data.data();
+  }
+
+  void ReleaseBuffer(void* /*buffer*/) override
+  {
+    m_data.clear();
+  }
+
+private:
+  QByteArray m_data;
+  IMPLEMENT_REFCOUNTING(ByteArrayReleaser);
+};
+#endif
+
+// binary data for the script, see toBytes in the fs module
+CefRefPtr<CefV8Value> binaryData(QByteArray data)
+{
+#if CHROME_VERSION_BUILD >= 3202
+  // hand the buffer over to V8 instead of inflating it to a string
+  const auto size = data.size();
+  CefRefPtr<ByteArrayReleaser> releaser = new ByteArrayReleaser(std::move(data));
+  return CefV8Value::CreateArrayBuffer(releaser->data(), size, releaser);
+#else
+  // older branches have no ArrayBuffer API, one character per byte is the most compact alternative
+  return streamData(data, true);
+#endif
 }
 
 class V8Handler : public CefV8Handler
 {
 public:
-  bool Execute(const CefString& name, CefRefPtr<CefV8Value> object,
-               const CefV8ValueList& arguments, CefRefPtr<CefV8Value>& retval,
-               CefString& exception) override
+  // a call of one of our native functions from a phantom script
+  struct Call
   {
-    auto context = CefV8Context::GetCurrentContext();
-    static const std::string phantomjs_scheme = "phantomjs://";
-    const auto frameURL = context->GetFrame()->GetURL().ToString();
-    if (context->GetBrowser()->GetIdentifier() != 1 || frameURL.compare(0, phantomjs_scheme.size(), phantomjs_scheme)) {
-      exception = "Access to PhantomJS function \"" + name.ToString() + "\" not allowed from URL \"" + frameURL + "\".";
-      return true;
-    }
-    if (name == "exit") {
-      context->GetBrowser()->SendProcessMessage(PID_BROWSER, CefProcessMessage::Create("exit"));
-      return true;
-    } else if (name == "printError" && !arguments.empty()) {
-      std::cerr << arguments.at(0)->GetStringValue() << '\n';
-      return true;
-    } else if (name == "findLibrary") {
-      const auto filePath = QString::fromStdString(arguments.at(0)->GetStringValue());
-      const auto libraryPath = QString::fromStdString(arguments.at(1)->GetStringValue());
-      retval = CefV8Value::CreateString(findLibrary(filePath, libraryPath));
-      return true;
-    } else if (name == "executeJavaScript") {
-      const auto code = arguments.at(0)->GetStringValue();
-      const auto file = arguments.at(1)->GetStringValue();
-      context->GetFrame()->ExecuteJavaScript(code, "file://" + file.ToString(), 1);
-      return true;
-    } else if (name == "write") {
-      const auto filename = arguments.at(0)->GetStringValue();
-      const auto contents = arguments.at(1)->GetStringValue();
-      const auto mode = arguments.at(2)->GetStringValue();
-      retval = CefV8Value::CreateBool(writeFile(filename, contents, mode));
-      return true;
-    } else if (name == "read" || name == "readFile") {
-      const auto file = arguments.at(0)->GetStringValue();
-      retval = CefV8Value::CreateString(readFile(file));
-      return true;
-    } else if (name == "touch"){
-      const auto filename = arguments.at(0)->GetStringValue();
+    CefRefPtr<CefV8Context> context;
+    int browserId;
+    const CefV8ValueList& arguments;
+    CefRefPtr<CefV8Value>& retval;
+    CefString& exception;
+  };
+  using Native = std::function<void(const Call& call)>;
+
+  V8Handler(const PhantomJSApp* app)
+    : m_app(app)
+  {
+    // the natives declared in the modules, see OnWebKitInitialized
+    add("exit", [](const Call& call) {
+      auto message = CefProcessMessage::Create("exit");
+      if (!call.arguments.empty() && call.arguments.at(0)->IsInt()) {
+        message->GetArgumentList()->SetInt(0, call.arguments.at(0)->GetIntValue());
+      }
+      call.context->GetBrowser()->SendProcessMessage(PID_BROWSER, message);
+    });
+    add("printError", [this](const Call& call) {
+      if (call.arguments.empty()) {
+        return;
+      }
+      if (m_app->isJob(call.browserId)) {
+        // job output is streamed back by the job server in the browser process
+        auto message = CefProcessMessage::Create("printError");
+        message->GetArgumentList()->SetString(0, call.arguments.at(0)->GetStringValue());
+        call.context->GetBrowser()->SendProcessMessage(PID_BROWSER, message);
+      } else {
+        std::cerr << call.arguments.at(0)->GetStringValue() << '\n';
+      }
+    });
+    add("findLibrary", [](const Call& call) {
+      const auto filePath = QString::fromStdString(call.arguments.at(0)->GetStringValue());
+      const auto libraryPath = QString::fromStdString(call.arguments.at(1)->GetStringValue());
+      call.retval = CefV8Value::CreateString(findLibrary(filePath, libraryPath));
+    });
+    add("runScript", [](const Call& call) {
+      const auto file = call.arguments.at(0)->GetStringValue().ToString();
+      if (!QFileInfo(QString::fromStdString(file)).isFile()) {
+        call.retval = CefV8Value::CreateBool(false);
+        return;
+      }
+      call.context->GetFrame()->ExecuteJavaScript(readFile(file), "file://" + file, 1);
+      call.retval = CefV8Value::CreateBool(true);
+    });
+    add("executeJavaScript", [](const Call& call) {
+      const auto code = call.arguments.at(0)->GetStringValue();
+      const auto file = call.arguments.at(1)->GetStringValue();
+      call.context->GetFrame()->ExecuteJavaScript(code, "file://" + file.ToString(), 1);
+    });
+    add("write", [](const Call& call) {
+      const auto filename = call.arguments.at(0)->GetStringValue();
+      const auto contents = call.arguments.at(1)->GetStringValue();
+      const auto mode = call.arguments.at(2)->GetStringValue();
+      call.retval = CefV8Value::CreateBool(writeFile(filename, contents, mode));
+    });
+    add("writeBinary", [](const Call& call) {
+      const auto path = QString::fromStdString(call.arguments.at(0)->GetStringValue());
+      const auto mode = QString::fromStdString(call.arguments.at(2)->GetStringValue());
+      QFile file(path);
+      const bool append = mode.contains(QLatin1Char('a'));
+      const auto data = latin1Data(call.arguments.at(1)->GetStringValue());
+      call.retval = CefV8Value::CreateBool(file.open(QIODevice::WriteOnly | (append ? QIODevice::Append : QIODevice::Truncate))
+                                           && file.write(data) == data.size());
+    });
+    add("readBinary", [](const Call& call) {
+      QFile file(QString::fromStdString(call.arguments.at(0)->GetStringValue()));
+      if (!file.open(QIODevice::ReadOnly)) {
+        call.exception = "Failed to open " + file.fileName().toStdString() + ": " + file.errorString().toStdString();
+        return;
+      }
+      call.retval = binaryData(file.readAll());
+    });
+    add("read", [](const Call& call) {
+      const auto file = call.arguments.at(0)->GetStringValue();
+      call.retval = CefV8Value::CreateString(readFile(file));
+    });
+    add("readFile", m_natives.at("read"));
+    add("touch", [](const Call& call) {
+      const auto filename = call.arguments.at(0)->GetStringValue();
       QFile f(QString::fromStdString(filename.ToString()));
-      retval = CefV8Value::CreateBool(!f.open(QFile::WriteOnly));
-      return true;
-    } else if (name == "makeDirectory"){
-      const auto path = arguments.at(0)->GetStringValue();
-      retval = CefV8Value::CreateBool(QDir().mkdir(QString::fromStdString(path.ToString())));
-      return true;
-    } else if (name == "makeTree"){
-      const auto path = arguments.at(0)->GetStringValue();
-      retval = CefV8Value::CreateBool(QDir().mkpath(QString::fromStdString(path.ToString())));
-      return true;
-    } else if (name == "tempPath"){
-      retval = CefV8Value::CreateString(QDir::tempPath().toStdString());
-      return true;
-    } else if (name == "lastModified") {
-      const auto filename = arguments.at(0)->GetStringValue();
+      call.retval = CefV8Value::CreateBool(!f.open(QFile::WriteOnly));
+    });
+    add("makeDirectory", [](const Call& call) {
+      const auto path = call.arguments.at(0)->GetStringValue();
+      call.retval = CefV8Value::CreateBool(QDir().mkdir(QString::fromStdString(path.ToString())));
+    });
+    add("makeTree", [](const Call& call) {
+      const auto path = call.arguments.at(0)->GetStringValue();
+      call.retval = CefV8Value::CreateBool(QDir().mkpath(QString::fromStdString(path.ToString())));
+    });
+    add("startupTimings", [](const Call& call) {
+      const auto timings = startupTimings();
+      call.retval = CefV8Value::CreateObject(nullptr);
+      for (auto it = timings.begin(); it != timings.end(); ++it) {
+        call.retval->SetValue(it.key().toStdString(), CefV8Value::CreateDouble(it.value().toDouble()), V8_PROPERTY_ATTRIBUTE_NONE);
+      }
+    });
+    add("tempPath", [](const Call& call) {
+      call.retval = CefV8Value::CreateString(QDir::tempPath().toStdString());
+    });
+    add("lastModified", [](const Call& call) {
+      const auto filename = call.arguments.at(0)->GetStringValue();
       auto lastModified = QFileInfo(QString::fromStdString(filename.ToString())).lastModified();
-      retval = CefV8Value::CreateString(lastModified.toUTC().toString(Qt::ISODate).toStdString());
-      return true;
-    } else if (name == "exists") {
-      const auto filename = arguments.at(0)->GetStringValue();
-      retval = CefV8Value::CreateBool(QFile::exists(QString::fromStdString(filename.ToString())));
-      return true;
-    } else if (name == "isFile") {
-      const auto filename = arguments.at(0)->GetStringValue();
-      retval = CefV8Value::CreateBool(QFileInfo(QString::fromStdString(filename.ToString())).isFile());
-      return true;
-    } else if (name == "isDirectory") {
-      const auto filename = arguments.at(0)->GetStringValue();
-      retval = CefV8Value::CreateBool(QFileInfo(QString::fromStdString(filename.ToString())).isDir());
-      return true;
-    } else if (name == "copy") {
-      const auto src = arguments.at(0)->GetStringValue();
-      const auto dest = arguments.at(1)->GetStringValue();
-      bool r = copyRecursively(QString::fromStdString(src), QString::fromStdString(dest));
-      retval = CefV8Value::CreateBool(r);
-      return true;
-    } else if (name == "remove") {
-      const auto src = arguments.at(0)->GetStringValue();
-      bool r = remove(QString::fromStdString(src));
-      retval = CefV8Value::CreateBool(r);
-      return true;
-    } else if (name == "size") {
-      const auto filename = arguments.at(0)->GetStringValue();
-      retval = CefV8Value::CreateInt(QFileInfo(QString::fromStdString(filename.ToString())).size());
-      return true;
-    } else if (name == "list") {
-      const auto path = arguments.at(0)->GetStringValue();
+      call.retval = CefV8Value::CreateString(lastModified.toUTC().toString(Qt::ISODate).toStdString());
+    });
+    add("exists", [](const Call& call) {
+      const auto filename = call.arguments.at(0)->GetStringValue();
+      call.retval = CefV8Value::CreateBool(QFile::exists(QString::fromStdString(filename.ToString())));
+    });
+    add("isFile", [](const Call& call) {
+      const auto filename = call.arguments.at(0)->GetStringValue();
+      call.retval = CefV8Value::CreateBool(QFileInfo(QString::fromStdString(filename.ToString())).isFile());
+    });
+    add("isDirectory", [](const Call& call) {
+      const auto filename = call.arguments.at(0)->GetStringValue();
+      call.retval = CefV8Value::CreateBool(QFileInfo(QString::fromStdString(filename.ToString())).isDir());
+    });
+    add("copy", [](const Call& call) {
+      const auto src = call.arguments.at(0)->GetStringValue();
+      const auto dest = call.arguments.at(1)->GetStringValue();
+      QString error;
+      copyTree(QString::fromStdString(src), QString::fromStdString(dest), TreeOptions(), &error);
+      call.retval = CefV8Value::CreateBool(error.isEmpty());
+    });
+    add("remove", [](const Call& call) {
+      const auto src = call.arguments.at(0)->GetStringValue();
+      QString error;
+      removeTree(QString::fromStdString(src), TreeOptions(), &error);
+      call.retval = CefV8Value::CreateBool(error.isEmpty());
+    });
+    add("listDetailed", [](const Call& call) {
+      const auto path = QString::fromStdString(call.arguments.at(0)->GetStringValue());
+      const auto options = listOptions(QString::fromStdString(call.arguments.at(1)->GetStringValue()));
+      QString error;
+      const auto entries = listTree(path, options, &error);
+      if (!error.isEmpty()) {
+        call.exception = error.toStdString();
+        return;
+      }
+      call.retval = toV8(entries);
+    });
+    add("hashFile", [](const Call& call) {
+      const auto path = QString::fromStdString(call.arguments.at(0)->GetStringValue());
+      const auto algorithm = QString::fromStdString(call.arguments.at(1)->GetStringValue());
+      QString error;
+      const auto hash = hashFile(path, algorithm, &error);
+      if (!error.isEmpty()) {
+        call.exception = error.toStdString();
+        return;
+      }
+      call.retval = CefV8Value::CreateString(hash.toStdString());
+    });
+    add("hashData", [](const Call& call) {
+      const auto algorithm = QString::fromStdString(call.arguments.at(1)->GetStringValue());
+      if (!StreamDigest::isSupported(algorithm)) {
+        call.exception = "Unknown hash algorithm \"" + algorithm.toStdString() + "\".";
+        return;
+      }
+      const auto data = streamData(call.arguments.at(0), call.arguments.at(2)->GetBoolValue());
+      StreamDigest digest({algorithm});
+      digest.addData(data.constData(), data.size());
+      call.retval = CefV8Value::CreateString(digest.result().value(algorithm).toString().toStdString());
+    });
+    add("size", [](const Call& call) {
+      const auto filename = call.arguments.at(0)->GetStringValue();
+      call.retval = CefV8Value::CreateInt(QFileInfo(QString::fromStdString(filename.ToString())).size());
+    });
+    add("fileOpen", [this](const Call& call) {
+      const auto path = QString::fromStdString(call.arguments.at(0)->GetStringValue());
+      const auto mode = QString::fromStdString(call.arguments.at(1)->GetStringValue());
+      QString error;
+      const int id = m_app->fileStreams()->open(call.browserId, path, mode, &error);
+      if (!id) {
+        call.exception = error.toStdString();
+        return;
+      }
+      call.retval = CefV8Value::CreateInt(id);
+    });
+    add("fileOpenCompressed", [this](const Call& call) {
+      const auto path = QString::fromStdString(call.arguments.at(0)->GetStringValue());
+      const auto mode = QString::fromStdString(call.arguments.at(1)->GetStringValue());
+      const auto codec = QString::fromStdString(call.arguments.at(2)->GetStringValue());
+      QString error;
+      const int id = m_app->fileStreams()->openCompressed(call.browserId, path, mode, codec, call.arguments.at(3)->GetIntValue(), &error);
+      if (!id) {
+        call.exception = error.toStdString();
+        return;
+      }
+      call.retval = CefV8Value::CreateInt(id);
+    });
+    add("fsAsync", [this](const Call& call) {
+      const auto operation = call.arguments.at(0)->GetStringValue().ToString();
+      const auto args = call.arguments.at(1);
+      QStringList list;
+      for (int i = 0, c = args->GetArrayLength(); i < c; ++i) {
+        list << QString::fromStdString(args->GetValue(i)->GetStringValue());
+      }
+      if (auto treeWork = treeOperation(operation, list)) {
+        m_app->fileTasks()->run(call.context, call.arguments.at(2), call.arguments.size() > 3 ? call.arguments.at(3) : nullptr, treeWork);
+      } else if (auto work = asyncOperation(operation, list)) {
+        m_app->fileTasks()->run(call.context, call.arguments.at(2), work);
+      } else {
+        call.exception = "Unknown asynchronous file operation: " + operation;
+      }
+    });
+    add("watch", [this](const Call& call) {
+      const auto path = QString::fromStdString(call.arguments.at(0)->GetStringValue());
+      const bool recursive = call.arguments.at(1)->GetBoolValue();
+      const int debounce = call.arguments.at(2)->GetIntValue();
+      QString error;
+      const int id = m_app->fileWatchers()->watch(call.browserId, call.context, call.arguments.at(3), path, recursive, debounce, &error);
+      if (!id) {
+        call.exception = error.toStdString();
+        return;
+      }
+      call.retval = CefV8Value::CreateInt(id);
+    });
+    add("unwatch", [this](const Call& call) {
+      m_app->fileWatchers()->unwatch(call.arguments.at(0)->GetIntValue());
+    });
+    add("fileMap", [this](const Call& call) {
+      const auto path = QString::fromStdString(call.arguments.at(0)->GetStringValue());
+      const bool binary = call.arguments.size() > 1 && call.arguments.at(1)->GetBoolValue();
+      QString error;
+      const int id = m_app->fileStreams()->map(call.browserId, path, binary, &error);
+      if (!id) {
+        call.exception = error.toStdString();
+        return;
+      }
+      call.retval = CefV8Value::CreateInt(id);
+    });
+    add("list", [](const Call& call) {
+      const auto path = call.arguments.at(0)->GetStringValue();
       const auto entries = QDir(QString::fromStdString(path)).entryList();
       CefRefPtr<CefV8Value> arr = CefV8Value::CreateArray(entries.size());
       for (int n = 0; n < entries.size(); n++) {
         arr->SetValue(n, CefV8Value::CreateString(entries.at(n).toStdString()));
       }
-      retval = arr;
+      call.retval = arr;
+    });
+
+    // the natives operating on streams opened via fileOpen, the first argument is the stream id
+    addStream("fileRead", [](FileStreams* streams, int id, const Call& call) {
+      const bool binary = streams->isBinary(id);
+      const auto size = call.arguments.size() > 1 ? static_cast<qint64>(call.arguments.at(1)->GetDoubleValue()) : -1;
+      auto data = streams->read(id, size);
+      if (!binary && size > 0) {
+        // the size is in bytes, don't split a character between two reads
+        for (int missing = missingUtf8Bytes(data); missing > 0; missing = missingUtf8Bytes(data)) {
+          const auto rest = streams->read(id, missing);
+          if (rest.isEmpty()) {
+            break;
+          }
+          data += rest;
+        }
+      }
+      if (!data.isEmpty() || !size || !readFailed(streams, id, call)) {
+        call.retval = streamData(data, binary);
+      }
+    });
+    addStream("fileReadBinary", [](FileStreams* streams, int id, const Call& call) {
+      const auto size = call.arguments.size() > 1 ? static_cast<qint64>(call.arguments.at(1)->GetDoubleValue()) : -1;
+      const auto data = streams->read(id, size);
+      if (!data.isEmpty() || !size || !readFailed(streams, id, call)) {
+        call.retval = binaryData(data);
+      }
+    });
+    addStream("fileWriteBinary", [](FileStreams* streams, int id, const Call& call) {
+      call.retval = CefV8Value::CreateBool(streams->write(id, latin1Data(call.arguments.at(1)->GetStringValue())));
+    });
+    addStream("fileReadLine", [](FileStreams* streams, int id, const Call& call) {
+      const bool binary = streams->isBinary(id);
+      const auto line = streams->readLine(id);
+      if (!line.isEmpty() || !streams->atEnd(id) || !readFailed(streams, id, call)) {
+        call.retval = streamData(line, binary);
+      }
+    });
+    addStream("fileWrite", [](FileStreams* streams, int id, const Call& call) {
+      const bool binary = streams->isBinary(id);
+      call.retval = CefV8Value::CreateBool(streams->write(id, streamData(call.arguments.at(1), binary)));
+    });
+    addStream("fileSeek", [](FileStreams* streams, int id, const Call& call) {
+      call.retval = CefV8Value::CreateBool(streams->seek(id, static_cast<qint64>(call.arguments.at(1)->GetDoubleValue())));
+    });
+    addStream("fileSlice", [](FileStreams* streams, int id, const Call& call) {
+      const bool binary = streams->isBinary(id);
+      const auto start = static_cast<qint64>(call.arguments.at(1)->GetDoubleValue());
+      const auto end = call.arguments.size() > 2 ? static_cast<qint64>(call.arguments.at(2)->GetDoubleValue()) : -1;
+      call.retval = streamData(streams->slice(id, start, end), binary);
+    });
+    addStream("fileSize", [](FileStreams* streams, int id, const Call& call) {
+      call.retval = CefV8Value::CreateDouble(streams->size(id));
+    });
+    addStream("filePos", [](FileStreams* streams, int id, const Call& call) {
+      call.retval = CefV8Value::CreateDouble(streams->pos(id));
+    });
+    addStream("fileAtEnd", [](FileStreams* streams, int id, const Call& call) {
+      const bool atEnd = streams->atEnd(id);
+      if (!atEnd || !readFailed(streams, id, call)) {
+        call.retval = CefV8Value::CreateBool(atEnd);
+      }
+    });
+    addStream("fileFlush", [](FileStreams* streams, int id, const Call& call) {
+      call.retval = CefV8Value::CreateBool(streams->flush(id));
+    });
+    addStream("fileClose", [](FileStreams* streams, int id, const Call& call) {
+      call.retval = CefV8Value::CreateBool(streams->close(id));
+    });
+  }
+
+  // the native functions declared in @p extensionCode that have no implementation
+  QStringList missingNatives(const std::string& extensionCode) const
+  {
+    static const std::string declaration = "native function ";
+    QStringList missing;
+    for (auto pos = extensionCode.find(declaration); pos != std::string::npos;
+         pos = extensionCode.find(declaration, pos)) {
+      pos += declaration.size();
+      const auto name = extensionCode.substr(pos, extensionCode.find('(', pos) - pos);
+      if (!m_natives.count(name)) {
+        missing << QString::fromStdString(name);
+      }
+    }
+    missing.removeDuplicates();
+    return missing;
+  }
+
+  bool Execute(const CefString& name, CefRefPtr<CefV8Value> object,
+               const CefV8ValueList& arguments, CefRefPtr<CefV8Value>& retval,
+               CefString& exception) override
+  {
+    auto context = CefV8Context::GetCurrentContext();
+    const auto browserId = m_app->phantomMainBrowserId(context);
+    if (!browserId) {
+      exception = "Access to PhantomJS function \"" + name.ToString() + "\" not allowed from URL \""
+        + context->GetFrame()->GetURL().ToString() + "\".";
       return true;
     }
-    exception = std::string("Unknown PhantomJS function: ") + name.ToString();
+    const auto native = m_natives.find(name.ToString());
+    if (native == m_natives.end()) {
+      exception = std::string("Unknown PhantomJS function: ") + name.ToString();
+      return true;
+    }
+    native->second({context, browserId, arguments, retval, exception});
     return true;
   }
+
 private:
+  void add(const std::string& name, Native native)
+  {
+    m_natives[name] = std::move(native);
+  }
+
+  // rejects calls with the id of a stream that was closed already
+  void addStream(const std::string& name, std::function<void(FileStreams* streams, int id, const Call& call)> native)
+  {
+    add(name, [this, native](const Call& call) {
+      auto streams = m_app->fileStreams();
+      const int id = call.arguments.empty() ? 0 : call.arguments.at(0)->GetIntValue();
+      if (!streams->contains(id)) {
+        call.exception = "The stream is closed.";
+        return;
+      }
+      native(streams, id, call);
+    });
+  }
+
+  // corrupt compressed data is reported as an exception instead of the end of the stream,
+  // once everything decompressed before it got read
+  static bool readFailed(FileStreams* streams, int id, const Call& call)
+  {
+    const auto error = streams->readError(id);
+    if (error.isEmpty()) {
+      return false;
+    }
+    call.exception = error.toStdString();
+    return true;
+  }
+
+  const PhantomJSApp* m_app;
+  // the implementations of the native functions by name, bound once when the handler is created
+  std::unordered_map<std::string, Native> m_natives;
   IMPLEMENT_REFCOUNTING(V8Handler);
 };
 }
 
+void PhantomJSApp::OnRenderThreadCreated(CefRefPtr<CefListValue> extra_info)
+{
+  recordStartupTiming("renderThreadCreated");
+}
+
 void PhantomJSApp::OnWebKitInitialized()
 {
-  CefRefPtr<CefV8Handler> handler = new V8Handler();
+  recordStartupTiming("webKitInitialized");
 
-  const auto modules = QDir(":/phantomjs/modules").entryInfoList(QDir::NoFilter, QDir::Name);
-  if (modules.isEmpty()) {
+  CefRefPtr<V8Handler> handler = new V8Handler(this);
+
+  // all modules are bundled into a single uncompressed resource at build time, see CMakeLists.txt
+  QResource modules(QStringLiteral(":/phantomjs/modules.js"));
+  if (!modules.isValid() || !modules.size()) {
     qFatal("No modules found. This is a setup issue with the resource system - try to run CMake again.");
   }
-  foreach (const auto& module, modules) {
-    QFile file(module.absoluteFilePath());
-    file.open(QIODevice::ReadOnly | QIODevice::Text);
-    const auto extensionCode = file.readAll();
-    if (extensionCode.isEmpty()) {
-      qFatal("Module \"%s\" is empty. This is a setup issue with the resource system - try to run CMake again.", qPrintable(module.absoluteFilePath()));
-    }
-    CefRegisterExtension(file.fileName().toStdString(), std::string(extensionCode.constData(), extensionCode.size()), handler);
+  std::string extensionCode;
+  if (modules.isCompressed()) {
+    const auto uncompressed = qUncompress(modules.data(), modules.size());
+    extensionCode.assign(uncompressed.constData(), uncompressed.size());
+  } else {
+    extensionCode.assign(reinterpret_cast<const char*>(modules.data()), modules.size());
   }
+  // the natives are looked up by name on every call, make sure all of them are bound up front
+  const auto missing = handler->missingNatives(extensionCode);
+  if (!missing.isEmpty()) {
+    qFatal("No implementation of the native functions %s.", qPrintable(missing.join(QStringLiteral(", "))));
+  }
+  CefRegisterExtension("phantomjs/modules.js", extensionCode, handler);
+
+  recordStartupTiming("modulesRegistered");
 }
 
 void PhantomJSApp::OnContextCreated(CefRefPtr<CefBrowser> browser, CefRefPtr<CefFrame> frame,
@@ -305,10 +958,29 @@ void PhantomJSApp::OnContextReleased(CefRefPtr<CefBrowser> browser, CefRefPtr<Ce
                                      CefRefPtr<CefV8Context> context)
 {
   m_messageRouter->OnContextReleased(browser, frame, context);
+  for (auto it = m_trustedContexts.begin(); it != m_trustedContexts.end();) {
+    if (it->first->IsSame(context)) {
+      it = m_trustedContexts.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+void PhantomJSApp::OnBrowserDestroyed(CefRefPtr<CefBrowser> browser)
+{
+  m_phantomMainBrowsers.remove(browser->GetIdentifier());
+  m_fileStreams->closeAll(browser->GetIdentifier());
+  m_fileWatchers->unwatchAll(browser->GetIdentifier());
 }
 
 bool PhantomJSApp::OnProcessMessageReceived(CefRefPtr<CefBrowser> browser, CefProcessId source_process,
                                             CefRefPtr<CefProcessMessage> message)
 {
+  if (message->GetName() == "phantomMain") {
+    // sent by PhantomJSHandler::createBrowser before the phantom main browser loads any script
+    m_phantomMainBrowsers[browser->GetIdentifier()] = message->GetArgumentList()->GetBool(0);
+    return true;
+  }
   return m_messageRouter->OnProcessMessageReceived(browser, source_process, message);
 }
@@ -6,9 +6,21 @@
 #define CEF_TESTS_PHANTOMJS_APP_H_
 
 #include "include/cef_app.h"
+#include "include/cef_command_line.h"
 #include "include/wrapper/cef_message_router.h"
 
+#include <QHash>
+#include <QPair>
+#include <QVector>
+
+#include <memory>
+
+class FileStreams;
+class FileTasks;
+class FileWatchers;
 class PrintHandler;
+class PhantomJSHandler;
+class JobServer;
 
 class PhantomJSApp : public CefApp,
                      public CefBrowserProcessHandler,
@@ -29,22 +41,59 @@ class PhantomJSApp : public CefApp,
     return this;
   }
   void OnRegisterCustomSchemes(CefRefPtr<CefSchemeRegistrar> registrar) override;
+  void OnBeforeCommandLineProcessing(const CefString& process_type,
+                                     CefRefPtr<CefCommandLine> command_line) override;
 
   // CefBrowserProcessHandler methods:
   virtual void OnContextInitialized() override;
   virtual CefRefPtr<CefPrintHandler> GetPrintHandler() override;
 
   // CefRenderProcessHandler methods:
+  void OnRenderThreadCreated(CefRefPtr<CefListValue> extra_info) override;
   void OnWebKitInitialized() override;
   void OnContextCreated(CefRefPtr<CefBrowser> browser, CefRefPtr<CefFrame> frame,
                         CefRefPtr<CefV8Context> context) override;
   void OnContextReleased(CefRefPtr<CefBrowser> browser, CefRefPtr<CefFrame> frame,
                          CefRefPtr<CefV8Context> context) override;
+  void OnBrowserDestroyed(CefRefPtr<CefBrowser> browser) override;
   bool OnProcessMessageReceived(CefRefPtr<CefBrowser> browser, CefProcessId source_process,
                                 CefRefPtr<CefProcessMessage> message) override;
 
+  // The command line including the switches of the config file and preset, see applyConfig.
+  void setCommandLine(CefRefPtr<CefCommandLine> commandLine);
+
+  // Create a new phantom main browser which runs the script given as first argument.
+  CefRefPtr<CefBrowser> runScript(const CefCommandLine::ArgumentList& arguments,
+                                  CefRefPtr<CefRequestContext> requestContext = nullptr);
+  // The exit code passed to phantom.exit(), only valid in the browser process.
+  int exitCode() const;
+
+  // Renderer side: whether the browser runs a phantom script and thus may access our native functions.
+  bool isPhantomMain(int browserId) const;
+  // Renderer side: the id of the phantom main browser running the script of @p context, or 0 if the
+  // context may not access our native functions. Cached per context until it is released.
+  int phantomMainBrowserId(const CefRefPtr<CefV8Context>& context) const;
+  // Renderer side: whether the browser runs a job of the job server.
+  bool isJob(int browserId) const;
+  // Renderer side: the files opened via fs.open.
+  FileStreams* fileStreams() const;
+  // Renderer side: the thread pool running fs.promises.
+  FileTasks* fileTasks() const;
+  // Renderer side: the watches created via fs.watch.
+  FileWatchers* fileWatchers() const;
+
  private:
   CefRefPtr<PrintHandler> m_printHandler;
+  std::unique_ptr<FileStreams> m_fileStreams;
+  std::unique_ptr<FileTasks> m_fileTasks;
+  std::unique_ptr<FileWatchers> m_fileWatchers;
+  CefRefPtr<PhantomJSHandler> m_handler;
+  CefRefPtr<CefCommandLine> m_commandLine;
+  std::unique_ptr<JobServer> m_jobServer;
+  // maps phantom main browser ids to whether they run a job server job
+  QHash<int, bool> m_phantomMainBrowsers;
+  // the contexts that passed the check of phantomMainBrowserId, with their browser id
+  mutable QVector<QPair<CefRefPtr<CefV8Context>, int>> m_trustedContexts;
   CefRefPtr<CefMessageRouterRendererSide> m_messageRouter;
   // Include the default reference counting implementation.
   IMPLEMENT_REFCOUNTING(PhantomJSApp);
@@ -0,0 +1,520 @@
+// Copyright (c) 2015 Klaralvdalens Datakonsult AB (KDAB).
+// All rights reserved. Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include "archive.h"
+
+#include <QJsonDocument>
+#include <QRegularExpression>
+#include <QSet>
+#include <QUrl>
+#include <QUrlQuery>
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+#include "include/cef_task.h"
+
+#include "task.h"
+#include "debug.h"
+
+namespace {
+
+const QByteArray MAGIC = QByteArrayLiteral("PHANTOMJS-ARCHIVE 1\n");
+// the archive ends with the offset of the index line, padded to a fixed width
+const int TRAILER_SIZE = 21;
+
+bool isHttp(const QString& url)
+{
+  return url.startsWith(QLatin1String("http://")) || url.startsWith(QLatin1String("https://"));
+}
+
+QString exactKey(const QString& method, const QString& url)
+{
+  return method + QLatin1Char(' ') + url;
+}
+
+// query parameters that differ between runs without affecting the response
+bool isVolatileParameter(const QString& name, const QString& value)
+{
+  static const QSet<QString> names = {
+    QStringLiteral("_"), QStringLiteral("t"), QStringLiteral("ts"), QStringLiteral("time"),
+    QStringLiteral("timestamp"), QStringLiteral("cb"), QStringLiteral("cachebuster"),
+    QStringLiteral("cache_buster"), QStringLiteral("nocache"), QStringLiteral("rand"),
+    QStringLiteral("random"), QStringLiteral("nonce"), QStringLiteral("r")
+  };
+  // unix timestamps in seconds or milliseconds and Math.random() values
+  static const QRegularExpression volatileValue(QStringLiteral("^(\\d{10}|\\d{13}|0\\.\\d{6,})$"));
+  return names.contains(name.toLower()) || volatileValue.match(value).hasMatch();
+}
+
+QSet<QString> toSet(const QStringList& list)
+{
+#if QT_VERSION >= QT_VERSION_CHECK(5, 14, 0)
+  return QSet<QString>(list.begin(), list.end());
+#else
+  return list.toSet();
+#endif
+}
+
+QStringList stableQueryItems(const QUrl& url)
+{
+  QStringList items;
+  const auto queryItems = QUrlQuery(url).queryItems(QUrl::FullyDecoded);
+  for (const auto& item : queryItems) {
+    if (!isVolatileParameter(item.first, item.second)) {
+      items << item.first + QLatin1Char('=') + item.second;
+    }
+  }
+  items.sort();
+  return items;
+}
+
+QString pathKey(const QString& method, const QUrl& url)
+{
+  return method + QLatin1Char(' ') + url.toString(QUrl::RemoveQuery | QUrl::RemoveFragment);
+}
+
+QString normalizedKey(const QString& method, const QUrl& url)
+{
+  return pathKey(method, url) + QLatin1Char('?') + stableQueryItems(url).join(QLatin1Char('&'));
+}
+
+/**
+ * Serves a recorded response straight from the memory mapped archive.
+ */
+class ArchiveResourceHandler : public CefResourceHandler
+{
+public:
+  ArchiveResourceHandler(int status, const QString& statusText, const QString& mimeType,
+                         const CefResponse::HeaderMap& headers, const uchar* data, qint64 size)
+    : m_status(status)
+    , m_statusText(statusText.toStdString())
+    , m_mimeType(mimeType.toStdString())
+    , m_headers(headers)
+    , m_data(data)
+    , m_size(size)
+  {}
+
+  bool ProcessRequest(CefRefPtr<CefRequest> /*request*/, CefRefPtr<CefCallback> callback) override
+  {
+    callback->Continue();
+    return true;
+  }
+
+  void GetResponseHeaders(CefRefPtr<CefResponse> response, int64& response_length,
+                          CefString& redirectUrl) override
+  {
+    response->SetStatus(m_status);
+    response->SetStatusText(m_statusText);
+    response->SetMimeType(m_mimeType);
+    response->SetHeaderMap(m_headers);
+    response_length = m_size;
+    if (m_status >= 300 && m_status < 400) {
+      for (const auto& header : m_headers) {
+        if (!QString::fromStdString(header.first).compare(QLatin1String("location"), Qt::CaseInsensitive)) {
+          redirectUrl = header.second;
+          break;
+        }
+      }
+    }
+  }
+
+  bool ReadResponse(void* data_out, int bytes_to_read, int& bytes_read,
+                    CefRefPtr<CefCallback> /*callback*/) override
+  {
+    const auto available = m_size - m_offset;
+    if (available <= 0) {
+      bytes_read = 0;
+      return false;
+    }
+    bytes_read = static_cast<int>(std::min<qint64>(available, bytes_to_read));
+    memcpy(data_out, m_data + m_offset, bytes_read);
+    m_offset += bytes_read;
+    return true;
+  }
+
+  void Cancel() override
+  {
+  }
+
+private:
+  int m_status;
+  std::string m_statusText;
+  std::string m_mimeType;
+  CefResponse::HeaderMap m_headers;
+  const uchar* m_data;
+  qint64 m_size;
+  qint64 m_offset = 0;
+  IMPLEMENT_REFCOUNTING(ArchiveResourceHandler);
+};
+}
+
+std::shared_ptr<NetworkArchive> NetworkArchive::create(CefRefPtr<CefCommandLine> commandLine, bool* ok)
+{
+  *ok = true;
+  const bool record = commandLine->HasSwitch("record");
+  const bool replay = commandLine->HasSwitch("replay");
+  if (!record && !replay) {
+    return nullptr;
+  } else if (record && replay) {
+    std::cerr << "Cannot record and replay a network archive at the same time.\n";
+    *ok = false;
+    return nullptr;
+  }
+
+  const auto mode = record ? Record : Replay;
+  const auto path = QString::fromStdString(commandLine->GetSwitchValue(record ? "record" : "replay"));
+  if (path.isEmpty()) {
+    std::cerr << "Missing network archive path, use --" << (record ? "record" : "replay") << "=<archive>.\n";
+    *ok = false;
+    return nullptr;
+  }
+
+  auto archive = std::make_shared<NetworkArchive>(mode, path);
+  if (!(mode == Record ? archive->openForRecording() : archive->openForReplay())) {
+    *ok = false;
+    return nullptr;
+  }
+  return archive;
+}
+
+NetworkArchive::NetworkArchive(Mode mode, const QString& path)
+  : m_mode(mode)
+  , m_file(path)
+  , m_indexFile(path + QLatin1String(".index"))
+{
+}
+
+NetworkArchive::~NetworkArchive()
+{
+  close();
+}
+
+void NetworkArchive::close()
+{
+  QMutexLocker lock(&m_mutex);
+
+  if (m_mode != Record || !m_file.isOpen()) {
+    return;
+  }
+  // finish the recording with the index, which speeds up loading the archive for replay
+  const auto indexOffset = m_file.pos();
+  m_file.write(QJsonDocument(QJsonObject{{QStringLiteral("index"), m_index}}).toJson(QJsonDocument::Compact));
+  m_file.write("\n");
+  m_file.write(QByteArray::number(indexOffset).rightJustified(TRAILER_SIZE - 1, '0'));
+  m_file.write("\n");
+  m_file.close();
+  // the archive is complete, the side index is only needed after crashes
+  m_indexFile.remove();
+  qCDebug(network) << "closed network archive" << m_file.fileName() << m_index.size();
+}
+
+NetworkArchive::Mode NetworkArchive::mode() const
+{
+  return m_mode;
+}
+
+bool NetworkArchive::openForRecording()
+{
+  if (!m_file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+    std::cerr << "Failed to open network archive " << qPrintable(m_file.fileName()) << " for recording: "
+              << qPrintable(m_file.errorString()) << '\n';
+    return false;
+  }
+  m_file.write(MAGIC);
+  if (!m_indexFile.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+    std::cerr << "Failed to open network archive index " << qPrintable(m_indexFile.fileName()) << ": "
+              << qPrintable(m_indexFile.errorString()) << '\n';
+    return false;
+  }
+  return true;
+}
+
+bool NetworkArchive::openForReplay()
+{
+  if (!m_file.open(QIODevice::ReadOnly)) {
+    std::cerr << "Failed to open network archive " << qPrintable(m_file.fileName()) << ": "
+              << qPrintable(m_file.errorString()) << '\n';
+    return false;
+  }
+  m_size = m_file.size();
+  m_data = m_size ? m_file.map(0, m_size) : nullptr;
+  if (!m_data || m_size < MAGIC.size() || memcmp(m_data, MAGIC.constData(), MAGIC.size())) {
+    std::cerr << "Invalid network archive " << qPrintable(m_file.fileName()) << '\n';
+    return false;
+  }
+
+  if (!readIndex() && !readIndexFile() && !scanRecords()) {
+    std::cerr << "Corrupt network archive " << qPrintable(m_file.fileName()) << '\n';
+    return false;
+  }
+
+  for (int i = 0; i < m_records.size(); ++i) {
+    const auto& record = m_records.at(i);
+    const QUrl url(record.url);
+    m_exact[exactKey(record.method, record.url)] << i;
+    m_normalized[normalizedKey(record.method, url)] << i;
+    m_paths[pathKey(record.method, url)] << i;
+  }
+  qCDebug(network) << "replaying" << m_records.size() << "records from" << m_file.fileName();
+  return true;
+}
+
+bool NetworkArchive::readIndex()
+{
+  if (m_size < MAGIC.size() + TRAILER_SIZE) {
+    return false;
+  }
+  const auto trailer = QByteArray::fromRawData(reinterpret_cast<const char*>(m_data + m_size - TRAILER_SIZE), TRAILER_SIZE);
+  bool ok = false;
+  const auto indexOffset = trailer.trimmed().toLongLong(&ok);
+  if (!ok || indexOffset < MAGIC.size() || indexOffset >= m_size - TRAILER_SIZE) {
+    return false;
+  }
+  const auto indexData = QByteArray::fromRawData(reinterpret_cast<const char*>(m_data + indexOffset),
+                                                 static_cast<int>(m_size - TRAILER_SIZE - indexOffset));
+  const auto index = QJsonDocument::fromJson(indexData).object().value(QStringLiteral("index")).toArray();
+  if (index.isEmpty()) {
+    return false;
+  }
+  foreach (const auto& value, index) {
+    const auto entry = value.toArray();
+    m_records.append({entry.at(1).toString(), entry.at(2).toString(), static_cast<qint64>(entry.at(0).toDouble())});
+  }
+  return true;
+}
+
+bool NetworkArchive::readIndexFile()
+{
+  // the recording crashed, but the records up to the last flush are indexed next to the archive
+  if (!m_indexFile.open(QIODevice::ReadOnly)) {
+    return false;
+  }
+  m_records.clear();
+  while (!m_indexFile.atEnd()) {
+    const auto entry = QJsonDocument::fromJson(m_indexFile.readLine()).array();
+    const auto offset = static_cast<qint64>(entry.at(0).toDouble(-1));
+    if (entry.size() < 3 || !isCompleteRecord(offset)) {
+      break;
+    }
+    m_records.append({entry.at(1).toString(), entry.at(2).toString(), offset});
+  }
+  m_indexFile.close();
+  return !m_records.isEmpty();
+}
+
+bool NetworkArchive::isCompleteRecord(qint64 offset) const
+{
+  if (offset < MAGIC.size() || offset >= m_size) {
+    return false;
+  }
+  const auto lineEnd = static_cast<const uchar*>(memchr(m_data + offset, '\n', m_size - offset));
+  if (!lineEnd) {
+    return false;
+  }
+  const auto headerLine = QByteArray::fromRawData(reinterpret_cast<const char*>(m_data + offset),
+                                                  static_cast<int>(lineEnd - m_data - offset));
+  const auto size = static_cast<qint64>(QJsonDocument::fromJson(headerLine).object().value(QStringLiteral("size")).toDouble(-1));
+  return size >= 0 && (lineEnd - m_data) + 1 + size + 1 <= m_size;
+}
+
+bool NetworkArchive::scanRecords()
+{
+  // the recording was not finished properly, collect the records one by one
+  m_records.clear();
+  qint64 offset = MAGIC.size();
+  while (offset < m_size) {
+    const auto lineEnd = static_cast<const uchar*>(memchr(m_data + offset, '\n', m_size - offset));
+    if (!lineEnd) {
+      break;
+    }
+    const auto headerLine = QByteArray::fromRawData(reinterpret_cast<const char*>(m_data + offset),
+                                                    static_cast<int>(lineEnd - m_data - offset));
+    const auto header = QJsonDocument::fromJson(headerLine).object();
+    const auto size = static_cast<qint64>(header.value(QStringLiteral("size")).toDouble(-1));
+    const auto next = (lineEnd - m_data) + 1 + size + 1;
+    if (header.isEmpty() || size < 0 || next > m_size) {
+      // index line or truncated record
+      break;
+    }
+    m_records.append({header.value(QStringLiteral("method")).toString(),
+                      header.value(QStringLiteral("url")).toString(), offset});
+    offset = next;
+  }
+  return !m_records.isEmpty();
+}
+
+int NetworkArchive::findRecord(const QString& method, const QString& url)
+{
+  QMutexLocker lock(&m_mutex);
+
+  const auto key = exactKey(method, url);
+  auto it = m_exact.constFind(key);
+  if (it != m_exact.constEnd()) {
+    // replay repeated requests in the recorded order, then stick to the last response
+    auto& count = m_replayCount[key];
+    return it->at(std::min(count++, it->size() - 1));
+  }
+
+  const QUrl parsedUrl(url);
+  it = m_normalized.constFind(normalizedKey(method, parsedUrl));
+  if (it != m_normalized.constEnd()) {
+    return it->first();
+  }
+
+  it = m_paths.constFind(pathKey(method, parsedUrl));
+  if (it == m_paths.constEnd()) {
+    return -1;
+  }
+  const auto wanted = toSet(stableQueryItems(parsedUrl));
+  int best = it->first();
+  int bestCommon = -1;
+  for (int index : *it) {
+    const auto common = toSet(stableQueryItems(QUrl(m_records.at(index).url))).intersect(wanted).size();
+    if (common > bestCommon) {
+      best = index;
+      bestCommon = common;
+    }
+  }
+  return best;
+}
+
+CefRefPtr<CefResourceHandler> NetworkArchive::lookup(CefRefPtr<CefRequest> request)
+{
+  const auto url = QString::fromStdString(request->GetURL());
+  if (m_mode != Replay || !isHttp(url)) {
+    return nullptr;
+  }
+
+  const auto method = QString::fromStdString(request->GetMethod());
+  const auto index = findRecord(method, url);
+  const auto offset = index >= 0 ? m_records.at(index).offset : m_size;
+  const auto lineEnd = static_cast<const uchar*>(memchr(m_data + offset, '\n', m_size - offset));
+  if (!lineEnd) {
+    // never fall back to the network while replaying
+    qCWarning(network) << "not found in network archive:" << method << url;
+    CefResponse::HeaderMap headers;
+    return new ArchiveResourceHandler(404, QStringLiteral("Not Found in Archive"), QStringLiteral("text/plain"),
+                                      headers, nullptr, 0);
+  }
+  const auto header = QJsonDocument::fromJson(QByteArray::fromRawData(reinterpret_cast<const char*>(m_data + offset),
+                                                                      static_cast<int>(lineEnd - m_data - offset))).object();
+  CefResponse::HeaderMap headers;
+  foreach (const auto& value, header.value(QStringLiteral("headers")).toArray()) {
+    const auto pair = value.toArray();
+    headers.insert(std::make_pair(pair.at(0).toString().toStdString(), pair.at(1).toString().toStdString()));
+  }
+  qCDebug(network) << "replaying" << method << url << "from" << m_records.at(index).url;
+  return new ArchiveResourceHandler(header.value(QStringLiteral("status")).toInt(200),
+                                    header.value(QStringLiteral("statusText")).toString(),
+                                    header.value(QStringLiteral("mimeType")).toString(),
+                                    headers, lineEnd + 1,
+                                    static_cast<qint64>(header.value(QStringLiteral("size")).toDouble()));
+}
+
+#if CHROME_VERSION_BUILD >= 2526
+bool NetworkArchive::startRecording(CefRefPtr<CefRequest> request, CefRefPtr<CefResponse> response)
+{
+  const auto url = QString::fromStdString(request->GetURL());
+  if (m_mode != Record || !isHttp(url)) {
+    return false;
+  }
+
+  CefResponse::HeaderMap headers;
+  response->GetHeaderMap(headers);
+  QJsonArray jsonHeaders;
+  for (const auto& header : headers) {
+    const auto name = QString::fromStdString(header.first);
+    // the recorder sees the decoded body
+    if (!name.compare(QLatin1String("content-encoding"), Qt::CaseInsensitive)
+        || !name.compare(QLatin1String("content-length"), Qt::CaseInsensitive)
+        || !name.compare(QLatin1String("transfer-encoding"), Qt::CaseInsensitive))
+    {
+      continue;
+    }
+    jsonHeaders.append(QJsonArray{name, QString::fromStdString(header.second)});
+  }
+
+  QMutexLocker lock(&m_mutex);
+  m_pending[request->GetIdentifier()] = {
+    {QStringLiteral("method"), QString::fromStdString(request->GetMethod())},
+    {QStringLiteral("url"), url},
+    {QStringLiteral("status"), response->GetStatus()},
+    {QStringLiteral("statusText"), QString::fromStdString(response->GetStatusText())},
+    {QStringLiteral("mimeType"), QString::fromStdString(response->GetMimeType())},
+    {QStringLiteral("headers"), jsonHeaders}
+  };
+  return true;
+}
+
+void NetworkArchive::finishRecording(CefRefPtr<CefRequest> request, CefRefPtr<BodyRecorder> recorder, bool success)
+{
+  QJsonObject header;
+  {
+    QMutexLocker lock(&m_mutex);
+    header = m_pending.take(request->GetIdentifier());
+  }
+  if (header.isEmpty() || !success) {
+    return;
+  }
+  if (!recorder->isComplete()) {
+    qCWarning(network) << "response body too large for the network archive:" << header.value(QStringLiteral("url")).toString();
+    return;
+  }
+
+  auto self = shared_from_this();
+  const auto body = recorder->body();
+  CefPostTask(TID_FILE, makeTask([self, header, body] () {
+    self->append(header, body);
+  }));
+}
+#endif
+
+void NetworkArchive::recordRedirect(CefRefPtr<CefRequest> request, const CefString& newUrl, int status,
+                                    const QString& statusText)
+{
+  const auto url = QString::fromStdString(request->GetURL());
+  if (m_mode != Record || !isHttp(url)) {
+    return;
+  }
+  const QJsonObject header = {
+    {QStringLiteral("method"), QString::fromStdString(request->GetMethod())},
+    {QStringLiteral("url"), url},
+    {QStringLiteral("status"), status},
+    {QStringLiteral("statusText"), statusText},
+    {QStringLiteral("mimeType"), QStringLiteral("text/plain")},
+    {QStringLiteral("headers"), QJsonArray{QJsonArray{QStringLiteral("Location"), QString::fromStdString(newUrl)}}}
+  };
+  auto self = shared_from_this();
+  CefPostTask(TID_FILE, makeTask([self, header] () {
+    self->append(header, {});
+  }));
+}
+
+void NetworkArchive::append(const QJsonObject& header, const QByteArray& body)
+{
+  QMutexLocker lock(&m_mutex);
+
+  if (!m_file.isOpen()) {
+    qCWarning(network) << "network archive already closed, dropping" << header.value(QStringLiteral("url")).toString();
+    return;
+  }
+  auto record = header;
+  record[QStringLiteral("size")] = static_cast<double>(body.size());
+  const auto offset = m_file.pos();
+  m_file.write(QJsonDocument(record).toJson(QJsonDocument::Compact));
+  m_file.write("\n");
+  m_file.write(body);
+  m_file.write("\n");
+  const QJsonArray indexEntry{static_cast<double>(offset), header.value(QStringLiteral("method")),
+                              header.value(QStringLiteral("url"))};
+  m_index.append(indexEntry);
+  // a crash should only lose the records that are still being received
+  m_file.flush();
+  m_indexFile.write(QJsonDocument(indexEntry).toJson(QJsonDocument::Compact));
+  m_indexFile.write("\n");
+  m_indexFile.flush();
+  qCDebug(network) << "recorded" << header.value(QStringLiteral("url")).toString() << body.size();
+}
@@ -0,0 +1,119 @@
+// Copyright (c) 2015 Klaralvdalens Datakonsult AB (KDAB).
+// All rights reserved. Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#ifndef PHANTOMJS_ARCHIVE_H
+#define PHANTOMJS_ARCHIVE_H
+
+#include <QFile>
+#include <QHash>
+#include <QJsonArray>
+#include <QJsonObject>
+#include <QMutex>
+#include <QVector>
+
+#include <memory>
+
+#include "include/cef_command_line.h"
+#include "include/cef_request.h"
+#include "include/cef_resource_handler.h"
+#include "include/cef_response.h"
+#include "include/cef_version.h"
+
+#if CHROME_VERSION_BUILD >= 2526
+#include "bodyrecorder.h"
+#endif
+
+/**
+ * Records network traffic into an archive file and replays it without network access.
+ *
+ *  --record=<archive>   append every response, including its body, to the archive
+ *  --replay=<archive>   serve all http(s) requests from the archive, unknown URLs get a 404
+ *
+ * The archive starts with a magic line, followed by one record per response:
+ * a JSON header line with the request method and URL as well as the response
+ * status, headers and body size, followed by the raw body. When the recording
+ * finishes, an index of all records and the offset of that index are appended.
+ * While recording, every record is flushed and also added to a side index file
+ * next to the archive, <archive>.index, which is removed once the recording
+ * finished. Archives of crashed recordings get loaded via that file, or are
+ * scanned record by record when it is missing as well.
+ *
+ * Replayed requests are matched exactly first. Otherwise, query parameters that
+ * look like timestamps or cache busters are ignored and the remaining ones are
+ * compared regardless of their order. Finally the record for the same path with
+ * the most query parameters in common is used. When a URL was recorded multiple
+ * times, the recorded responses are replayed in order.
+ */
+class NetworkArchive : public std::enable_shared_from_this<NetworkArchive>
+{
+public:
+  enum Mode
+  {
+    Record,
+    Replay
+  };
+
+  // returns nullptr when neither recording nor replaying, sets @p ok to false on errors
+  static std::shared_ptr<NetworkArchive> create(CefRefPtr<CefCommandLine> commandLine, bool* ok);
+
+  NetworkArchive(Mode mode, const QString& path);
+  ~NetworkArchive();
+
+  Mode mode() const;
+
+  // record mode: appends the index and closes the archive, later records are dropped
+  // call this on the CEF FILE thread, so that all pending records are written first
+  void close();
+
+  // replay mode: returns a handler serving the recorded response, or a 404 for unknown URLs
+  CefRefPtr<CefResourceHandler> lookup(CefRefPtr<CefRequest> request);
+
+#if CHROME_VERSION_BUILD >= 2526
+  // record mode: returns true when the response should be recorded
+  bool startRecording(CefRefPtr<CefRequest> request, CefRefPtr<CefResponse> response);
+  void finishRecording(CefRefPtr<CefRequest> request, CefRefPtr<BodyRecorder> recorder, bool success);
+#endif
+  // record mode: redirects don't have a body and are recorded directly
+  void recordRedirect(CefRefPtr<CefRequest> request, const CefString& newUrl, int status, const QString& statusText);
+
+private:
+  bool openForRecording();
+  bool openForReplay();
+  bool readIndex();
+  bool readIndexFile();
+  // whether a complete record starts at @p offset
+  bool isCompleteRecord(qint64 offset) const;
+  bool scanRecords();
+  void append(const QJsonObject& header, const QByteArray& body);
+  int findRecord(const QString& method, const QString& url);
+
+  Mode m_mode;
+  QFile m_file;
+  QMutex m_mutex;
+
+  // record mode
+  QHash<uint64, QJsonObject> m_pending;
+  QJsonArray m_index;
+  // one JSON line per record, keeps the index of recordings that don't finish properly
+  QFile m_indexFile;
+
+  // replay mode, all offsets point into the memory mapped archive
+  struct Record
+  {
+    QString method;
+    QString url;
+    qint64 offset;
+  };
+  QVector<Record> m_records;
+  const uchar* m_data = nullptr;
+  qint64 m_size = 0;
+  // record indices by exact "METHOD url", normalized url and path
+  QHash<QString, QVector<int>> m_exact;
+  QHash<QString, QVector<int>> m_normalized;
+  QHash<QString, QVector<int>> m_paths;
+  // how often an exact key was replayed already
+  QHash<QString, int> m_replayCount;
+};
+
+#endif // PHANTOMJS_ARCHIVE_H
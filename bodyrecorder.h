@@ -0,0 +1,82 @@
+// Copyright (c) 2015 Klaralvdalens Datakonsult AB (KDAB).
+// All rights reserved. Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#ifndef PHANTOMJS_BODYRECORDER_H
+#define PHANTOMJS_BODYRECORDER_H
+
+#include <QByteArray>
+
+#include <algorithm>
+#include <cstring>
+
+#include "include/cef_response_filter.h"
+
+/**
+ * Pass-through response filter that keeps a copy of the decoded response body.
+ *
+ * Only one filter can be installed per request, so the shared response cache
+ * and the network archive use the same recorder, see
+ * PhantomJSHandler::GetResourceResponseFilter. Bodies larger than the given
+ * maximum size are passed on but not kept.
+ */
+class BodyRecorder : public CefResponseFilter
+{
+public:
+  explicit BodyRecorder(qint64 maxSize)
+    : m_maxSize(maxSize)
+  {}
+
+  bool InitFilter() override
+  {
+    return true;
+  }
+
+  FilterStatus Filter(void* data_in, size_t data_in_size, size_t& data_in_read,
+                      void* data_out, size_t data_out_size, size_t& data_out_written) override
+  {
+    const auto size = std::min(data_in_size, data_out_size);
+    if (size) {
+      memcpy(data_out, data_in, size);
+    }
+    data_in_read = size;
+    data_out_written = size;
+    m_totalSize += size;
+
+    if (!m_overflow) {
+      if (m_body.size() + static_cast<qint64>(size) > m_maxSize) {
+        // too large to keep, stop buffering
+        m_overflow = true;
+        m_body.clear();
+      } else {
+        m_body.append(static_cast<const char*>(data_in), static_cast<int>(size));
+      }
+    }
+    return RESPONSE_FILTER_DONE;
+  }
+
+  // the complete body, or an empty buffer when it exceeded the maximum size
+  const QByteArray& body() const
+  {
+    return m_body;
+  }
+
+  bool isComplete() const
+  {
+    return !m_overflow;
+  }
+
+  qint64 totalSize() const
+  {
+    return m_totalSize;
+  }
+
+private:
+  QByteArray m_body;
+  qint64 m_maxSize;
+  qint64 m_totalSize = 0;
+  bool m_overflow = false;
+  IMPLEMENT_REFCOUNTING(BodyRecorder);
+};
+
+#endif // PHANTOMJS_BODYRECORDER_H
@@ -0,0 +1,137 @@
+// Copyright (c) 2015 Klaralvdalens Datakonsult AB (KDAB).
+// All rights reserved. Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include "cache.h"
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QStandardPaths>
+#include <QTemporaryDir>
+
+#include <iostream>
+
+#if OS_LINUX
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include <linux/fs.h>
+#ifndef FICLONE
+#define FICLONE _IOW(0x94, 9, int)
+#endif
+#endif
+
+#include "debug.h"
+
+namespace {
+
+/**
+ * NOTE: we cannot hardlink the template files, Chromium updates its cache
+ *       index and the cookie database in place and would thus corrupt the
+ *       template. Reflinks on the other hand are copy-on-write.
+ */
+bool cloneFile(const QString& source, const QString& target)
+{
+#if OS_LINUX
+  const int sourceFd = open(QFile::encodeName(source).constData(), O_RDONLY | O_CLOEXEC);
+  if (sourceFd >= 0) {
+    const int targetFd = open(QFile::encodeName(target).constData(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    bool cloned = false;
+    if (targetFd >= 0) {
+      cloned = !ioctl(targetFd, FICLONE, sourceFd);
+      close(targetFd);
+      if (!cloned) {
+        // not supported by the file system, fall back to a regular copy below
+        unlink(QFile::encodeName(target).constData());
+      }
+    }
+    close(sourceFd);
+    if (cloned) {
+      return true;
+    }
+  }
+#endif
+  return QFile::copy(source, target);
+}
+
+}
+
+bool seedDirectory(const QString& templatePath, const QString& targetPath)
+{
+  if (!QDir().mkpath(targetPath)) {
+    return false;
+  }
+
+  const QDir::Filters filter = QDir::NoDotAndDotDot | QDir::AllEntries | QDir::NoSymLinks | QDir::Hidden;
+  foreach (const QFileInfo& entry, QDir(templatePath).entryInfoList(filter)) {
+    const QString target = targetPath + '/' + entry.fileName();
+    if (entry.isDir() ? !seedDirectory(entry.absoluteFilePath(), target)
+                      : !cloneFile(entry.absoluteFilePath(), target))
+    {
+      qCWarning(app) << "failed to seed cache entry" << target << "from template" << templatePath;
+      return false;
+    }
+  }
+  return true;
+}
+
+CacheDirectory::CacheDirectory(CefRefPtr<CefCommandLine> commandLine)
+{
+  if (commandLine->HasSwitch("in-memory-cache")) {
+    // an empty cache path makes CEF keep everything in memory
+    return;
+  }
+
+  const auto templatePath = QString::fromStdString(commandLine->GetSwitchValue("cache-template"));
+  if (!templatePath.isEmpty() && !QFileInfo(templatePath).isDir()) {
+    std::cerr << "Cache template \"" << qPrintable(templatePath) << "\" is not a directory.\n";
+    m_valid = false;
+    return;
+  }
+
+  if (commandLine->HasSwitch("cache-path")) {
+    m_path = QDir(QString::fromStdString(commandLine->GetSwitchValue("cache-path"))).absolutePath();
+    const bool isEmpty = QDir(m_path).entryList(QDir::NoDotAndDotDot | QDir::AllEntries | QDir::Hidden).isEmpty();
+    if (!templatePath.isEmpty() && isEmpty && !seedDirectory(templatePath, m_path)) {
+      std::cerr << "Failed to seed cache \"" << qPrintable(m_path) << "\" from template.\n";
+      m_valid = false;
+    }
+    return;
+  }
+
+  const auto sharedPath = QStandardPaths::writableLocation(QStandardPaths::CacheLocation);
+  if (!commandLine->HasSwitch("instance-cache") && templatePath.isEmpty()) {
+    m_path = sharedPath;
+    return;
+  }
+
+  // per instance cache next to the shared one, removed again on exit
+  QDir().mkpath(sharedPath);
+  m_instanceDir.reset(new QTemporaryDir(sharedPath + QStringLiteral("/instance-XXXXXX")));
+  if (!m_instanceDir->isValid()) {
+    std::cerr << "Failed to create instance cache directory in \"" << qPrintable(sharedPath) << "\".\n";
+    m_valid = false;
+    return;
+  }
+  m_path = m_instanceDir->path();
+  if (!templatePath.isEmpty() && !seedDirectory(templatePath, m_path)) {
+    std::cerr << "Failed to seed cache \"" << qPrintable(m_path) << "\" from template.\n";
+    m_valid = false;
+  }
+  qCDebug(app) << "using instance cache" << m_path << "seeded from" << templatePath;
+}
+
+CacheDirectory::~CacheDirectory()
+{
+}
+
+bool CacheDirectory::isValid() const
+{
+  return m_valid;
+}
+
+QString CacheDirectory::path() const
+{
+  return m_path;
+}
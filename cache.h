@@ -0,0 +1,46 @@
+// Copyright (c) 2015 Klaralvdalens Datakonsult AB (KDAB).
+// All rights reserved. Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#ifndef PHANTOMJS_CACHE_H
+#define PHANTOMJS_CACHE_H
+
+#include <QString>
+#include <QScopedPointer>
+
+#include "include/cef_command_line.h"
+
+class QTemporaryDir;
+
+/**
+ * Prepares the CEF cache directory of this phantomjs instance.
+ *
+ * By default, all instances share the cache in QStandardPaths::CacheLocation.
+ * This can be changed with the following command line switches:
+ *
+ *  --cache-path=<dir>       use the given cache directory
+ *  --in-memory-cache        don't persist anything on disk
+ *  --instance-cache         use a fresh cache directory per instance, removed on exit
+ *  --cache-template=<dir>   seed the per instance cache, or an empty --cache-path,
+ *                           from a read-only template profile (implies --instance-cache)
+ */
+class CacheDirectory
+{
+public:
+  explicit CacheDirectory(CefRefPtr<CefCommandLine> commandLine);
+  ~CacheDirectory();
+
+  bool isValid() const;
+  // empty for an in-memory cache
+  QString path() const;
+
+private:
+  QString m_path;
+  bool m_valid = true;
+  QScopedPointer<QTemporaryDir> m_instanceDir;
+};
+
+// recursively copy the template directory, using copy-on-write reflinks where the file system supports it
+bool seedDirectory(const QString& templatePath, const QString& targetPath);
+
+#endif // PHANTOMJS_CACHE_H
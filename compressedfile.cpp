@@ -0,0 +1,508 @@
+// Copyright (c) 2015 Klaralvdalens Datakonsult AB (KDAB).
+// All rights reserved. Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include "compressedfile.h"
+
+#include "debug.h"
+
+#ifdef PHANTOMJS_HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef PHANTOMJS_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+namespace {
+// compressed bytes read from disk at once
+const int InputChunkSize = 64 * 1024;
+// size of the output buffer handed to the codecs
+const int OutputChunkSize = 128 * 1024;
+// small writes are appended to the last queued chunk up to this size
+const int CoalesceSize = 64 * 1024;
+// writers block while more uncompressed data is waiting for the background thread
+const qint64 MaxQueuedBytes = 32 * 1024 * 1024;
+}
+
+enum CompressionMode
+{
+  Process,
+  Flush,
+  Finish
+};
+
+/**
+ * The streaming interface to zlib and zstd, used either for compression or decompression.
+ */
+class CompressionCoder
+{
+public:
+  virtual ~CompressionCoder() = default;
+
+  // appends the compressed @p data to @p out, flushing or finishing the stream depending on @p mode
+  virtual bool compress(const char* data, size_t size, CompressionMode mode, QByteArray* out, QString* error) = 0;
+  // appends the decompressed @p data to @p out
+  virtual bool decompress(const char* data, size_t size, QByteArray* out, QString* error) = 0;
+  // whether the decompressed input ended with a complete stream
+  virtual bool isFinished() const = 0;
+};
+
+namespace {
+#ifdef PHANTOMJS_HAVE_ZLIB
+class GzipCoder : public CompressionCoder
+{
+public:
+  ~GzipCoder()
+  {
+    if (!m_initialized) {
+      return;
+    }
+    if (m_compress) {
+      deflateEnd(&m_stream);
+    } else {
+      inflateEnd(&m_stream);
+    }
+  }
+
+  bool init(bool compress, int level, QString* error)
+  {
+    m_compress = compress;
+    int ret;
+    if (compress) {
+      if (level < 0) {
+        level = Z_DEFAULT_COMPRESSION;
+      } else if (level > 9) {
+        *error = QStringLiteral("Invalid gzip compression level %1, expected 0 to 9.").arg(level);
+        return false;
+      }
+      // 16 + the maximum window size makes zlib write a gzip header and trailer
+      ret = deflateInit2(&m_stream, level, Z_DEFLATED, 16 + MAX_WBITS, 8, Z_DEFAULT_STRATEGY);
+    } else {
+      // 32 + the maximum window size detects gzip and zlib headers automatically
+      ret = inflateInit2(&m_stream, 32 + MAX_WBITS);
+    }
+    if (ret != Z_OK) {
+      *error = QStringLiteral("Failed to initialize zlib: %1").arg(QString::fromLatin1(zError(ret)));
+      return false;
+    }
+    m_initialized = true;
+    return true;
+  }
+
+  bool compress(const char* data, size_t size, CompressionMode mode, QByteArray* out, QString* error) override
+  {
+    const int flush = mode == Finish ? Z_FINISH : mode == Flush ? Z_SYNC_FLUSH : Z_NO_FLUSH;
+    m_stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+    m_stream.avail_in = static_cast<uInt>(size);
+    do {
+      m_stream.next_out = m_output;
+      m_stream.avail_out = sizeof(m_output);
+      const int ret = deflate(&m_stream, flush);
+      if (ret == Z_STREAM_ERROR) {
+        *error = QStringLiteral("Failed to compress: %1").arg(QString::fromLatin1(zError(ret)));
+        return false;
+      }
+      out->append(reinterpret_cast<const char*>(m_output), sizeof(m_output) - m_stream.avail_out);
+    } while (m_stream.avail_out == 0);
+    return true;
+  }
+
+  bool decompress(const char* data, size_t size, QByteArray* out, QString* error) override
+  {
+    m_stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+    m_stream.avail_in = static_cast<uInt>(size);
+    do {
+      if (m_finished) {
+        // concatenated gzip members, e.g. written by appending to the file
+        if (!m_stream.avail_in) {
+          break;
+        }
+        inflateReset(&m_stream);
+        m_finished = false;
+      }
+      m_stream.next_out = m_output;
+      m_stream.avail_out = sizeof(m_output);
+      const int ret = inflate(&m_stream, Z_NO_FLUSH);
+      if (ret == Z_STREAM_END) {
+        m_finished = true;
+      } else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+        *error = QStringLiteral("Failed to decompress: %1")
+          .arg(QString::fromLatin1(m_stream.msg ? m_stream.msg : zError(ret)));
+        return false;
+      }
+      out->append(reinterpret_cast<const char*>(m_output), sizeof(m_output) - m_stream.avail_out);
+      if (ret == Z_BUF_ERROR) {
+        // no progress possible without further input
+        break;
+      }
+    } while (m_stream.avail_in > 0 || m_stream.avail_out == 0);
+    return true;
+  }
+
+  bool isFinished() const override
+  {
+    return m_finished;
+  }
+
+private:
+  z_stream m_stream = {};
+  Bytef m_output[OutputChunkSize];
+  bool m_compress = false;
+  bool m_initialized = false;
+  bool m_finished = false;
+};
+#endif
+
+#ifdef PHANTOMJS_HAVE_ZSTD
+class ZstdCoder : public CompressionCoder
+{
+public:
+  ~ZstdCoder()
+  {
+    ZSTD_freeCCtx(m_compressContext);
+    ZSTD_freeDCtx(m_decompressContext);
+  }
+
+  bool init(bool compress, int level, QString* error)
+  {
+    if (compress) {
+      if (level < 0) {
+        level = ZSTD_CLEVEL_DEFAULT;
+      } else if (level < 1 || level > ZSTD_maxCLevel()) {
+        *error = QStringLiteral("Invalid zstd compression level %1, expected 1 to %2.").arg(level).arg(ZSTD_maxCLevel());
+        return false;
+      }
+      m_compressContext = ZSTD_createCCtx();
+      if (!m_compressContext) {
+        *error = QStringLiteral("Failed to initialize zstd.");
+        return false;
+      }
+      ZSTD_CCtx_setParameter(m_compressContext, ZSTD_c_compressionLevel, level);
+      ZSTD_CCtx_setParameter(m_compressContext, ZSTD_c_checksumFlag, 1);
+    } else {
+      m_decompressContext = ZSTD_createDCtx();
+      if (!m_decompressContext) {
+        *error = QStringLiteral("Failed to initialize zstd.");
+        return false;
+      }
+    }
+    return true;
+  }
+
+  bool compress(const char* data, size_t size, CompressionMode mode, QByteArray* out, QString* error) override
+  {
+    const auto directive = mode == Finish ? ZSTD_e_end : mode == Flush ? ZSTD_e_flush : ZSTD_e_continue;
+    ZSTD_inBuffer input = { data, size, 0 };
+    bool done;
+    do {
+      ZSTD_outBuffer output = { m_output, sizeof(m_output), 0 };
+      const size_t remaining = ZSTD_compressStream2(m_compressContext, &output, &input, directive);
+      if (ZSTD_isError(remaining)) {
+        *error = QStringLiteral("Failed to compress: %1").arg(QString::fromLatin1(ZSTD_getErrorName(remaining)));
+        return false;
+      }
+      out->append(m_output, static_cast<int>(output.pos));
+      done = directive == ZSTD_e_continue ? input.pos == input.size : remaining == 0;
+    } while (!done);
+    return true;
+  }
+
+  bool decompress(const char* data, size_t size, QByteArray* out, QString* error) override
+  {
+    ZSTD_inBuffer input = { data, size, 0 };
+    ZSTD_outBuffer output;
+    do {
+      output = { m_output, sizeof(m_output), 0 };
+      // consecutive frames are decompressed transparently
+      const size_t ret = ZSTD_decompressStream(m_decompressContext, &output, &input);
+      if (ZSTD_isError(ret)) {
+        *error = QStringLiteral("Failed to decompress: %1").arg(QString::fromLatin1(ZSTD_getErrorName(ret)));
+        return false;
+      }
+      m_finished = ret == 0;
+      out->append(m_output, static_cast<int>(output.pos));
+    } while (input.pos < input.size || output.pos == output.size);
+    return true;
+  }
+
+  bool isFinished() const override
+  {
+    return m_finished;
+  }
+
+private:
+  ZSTD_CCtx* m_compressContext = nullptr;
+  ZSTD_DCtx* m_decompressContext = nullptr;
+  char m_output[OutputChunkSize];
+  bool m_finished = true;
+};
+#endif
+
+std::unique_ptr<CompressionCoder> createCoder(CompressedFile::Codec codec, bool compress, int level, QString* error)
+{
+  switch (codec) {
+  case CompressedFile::Gzip: {
+#ifdef PHANTOMJS_HAVE_ZLIB
+    std::unique_ptr<GzipCoder> coder(new GzipCoder);
+    if (coder->init(compress, level, error)) {
+      return std::move(coder);
+    }
+#endif
+    break;
+  }
+  case CompressedFile::Zstd: {
+#ifdef PHANTOMJS_HAVE_ZSTD
+    std::unique_ptr<ZstdCoder> coder(new ZstdCoder);
+    if (coder->init(compress, level, error)) {
+      return std::move(coder);
+    }
+#endif
+    break;
+  }
+  }
+  return {};
+}
+}
+
+bool CompressedFile::codecFromName(const QString& name, Codec* codec)
+{
+  if (name == QLatin1String("gzip")) {
+    *codec = Gzip;
+  } else if (name == QLatin1String("zstd")) {
+    *codec = Zstd;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+bool CompressedFile::isSupported(Codec codec)
+{
+  switch (codec) {
+  case Gzip:
+#ifdef PHANTOMJS_HAVE_ZLIB
+    return true;
+#else
+    return false;
+#endif
+  case Zstd:
+#ifdef PHANTOMJS_HAVE_ZSTD
+    return true;
+#else
+    return false;
+#endif
+  }
+  return false;
+}
+
+std::unique_ptr<CompressedFile> CompressedFile::open(const QString& path, Codec codec, QIODevice::OpenMode openMode,
+                                                     int level, QString* error)
+{
+  if (!isSupported(codec)) {
+    *error = QStringLiteral("PhantomJS was built without support for %1 compression.")
+      .arg(codec == Gzip ? QStringLiteral("gzip") : QStringLiteral("zstd"));
+    return {};
+  }
+  const bool writing = openMode & QIODevice::WriteOnly;
+  std::unique_ptr<CompressedFile> file(new CompressedFile);
+  file->m_coder = createCoder(codec, writing, level, error);
+  if (!file->m_coder) {
+    return {};
+  }
+  file->m_file.setFileName(path);
+  if (!file->m_file.open(openMode)) {
+    *error = QStringLiteral("Failed to open %1: %2").arg(path, file->m_file.errorString());
+    return {};
+  }
+  if (writing) {
+    file->m_thread = std::thread(&CompressedFile::compress, file.get());
+  }
+  return file;
+}
+
+CompressedFile::CompressedFile() = default;
+
+CompressedFile::~CompressedFile()
+{
+  close();
+}
+
+QString CompressedFile::fileName() const
+{
+  return m_file.fileName();
+}
+
+bool CompressedFile::isWritable() const
+{
+  return m_thread.joinable();
+}
+
+QByteArray CompressedFile::read(qint64 maxSize)
+{
+  while (maxSize < 0 || m_buffer.size() - m_bufferPos < maxSize) {
+    if (!fill()) {
+      break;
+    }
+  }
+  const qint64 available = m_buffer.size() - m_bufferPos;
+  const int size = static_cast<int>(maxSize < 0 ? available : qMin(maxSize, available));
+  const auto data = m_buffer.mid(m_bufferPos, size);
+  m_bufferPos += size;
+  m_pos += size;
+  return data;
+}
+
+QByteArray CompressedFile::readLine()
+{
+  int newline;
+  int searched = 0;
+  while ((newline = m_buffer.indexOf('\n', m_bufferPos + searched)) < 0) {
+    searched = m_buffer.size() - m_bufferPos;
+    if (!fill()) {
+      break;
+    }
+  }
+  const int end = newline < 0 ? m_buffer.size() : newline + 1;
+  auto line = m_buffer.mid(m_bufferPos, end - m_bufferPos);
+  m_pos += line.size();
+  m_bufferPos = end;
+  if (line.endsWith('\n')) {
+    line.chop(line.endsWith("\r\n") ? 2 : 1);
+  }
+  return line;
+}
+
+bool CompressedFile::atEnd()
+{
+  return m_bufferPos >= m_buffer.size() && !fill();
+}
+
+QString CompressedFile::readError() const
+{
+  return m_readError;
+}
+
+qint64 CompressedFile::pos() const
+{
+  return m_pos;
+}
+
+bool CompressedFile::write(const QByteArray& data)
+{
+  if (m_closed || !isWritable()) {
+    return false;
+  }
+  return data.isEmpty() || enqueue(data, Process);
+}
+
+bool CompressedFile::flush()
+{
+  if (m_closed || !isWritable()) {
+    return !m_closed;
+  }
+  return enqueue({}, Flush);
+}
+
+bool CompressedFile::close()
+{
+  if (m_closed) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_writeError.isEmpty();
+  }
+  m_closed = true;
+  bool success = true;
+  if (m_thread.joinable()) {
+    success = enqueue({}, Finish);
+    m_thread.join();
+  }
+  m_file.close();
+  return success;
+}
+
+// decompresses the next input chunk, returns false when no further data is available
+bool CompressedFile::fill()
+{
+  if (m_bufferPos) {
+    m_buffer.remove(0, m_bufferPos);
+    m_bufferPos = 0;
+  }
+  const int size = m_buffer.size();
+  while (m_buffer.size() == size && !m_inputEnd && m_readError.isEmpty() && !isWritable()) {
+    const auto input = m_file.read(InputChunkSize);
+    if (input.isEmpty()) {
+      m_inputEnd = true;
+      if (!m_coder->isFinished()) {
+        qCDebug(app) << "compressed file" << m_file.fileName() << "ends within a stream, was it flushed but not closed?";
+      }
+      break;
+    }
+    QString error;
+    if (!m_coder->decompress(input.constData(), input.size(), &m_buffer, &error)) {
+      qCWarning(app) << "reading" << m_file.fileName() << "failed:" << error;
+      m_readError = QStringLiteral("%1: %2").arg(m_file.fileName(), error);
+    }
+  }
+  return m_buffer.size() > size;
+}
+
+// the background thread of writers
+void CompressedFile::compress()
+{
+  QByteArray output;
+  bool failed = false;
+  std::unique_lock<std::mutex> lock(m_mutex);
+  for (;;) {
+    m_condition.wait(lock, [this] { return !m_queue.empty(); });
+    const auto chunk = std::move(m_queue.front());
+    m_queue.pop_front();
+    lock.unlock();
+
+    QString error;
+    if (!failed) {
+      output.clear();
+      const auto mode = static_cast<CompressionMode>(chunk.mode);
+      if (!m_coder->compress(chunk.data.constData(), chunk.data.size(), mode, &output, &error)) {
+        failed = true;
+      } else if (m_file.write(output) != output.size() || (mode != Process && !m_file.flush())) {
+        error = QStringLiteral("Failed to write %1: %2").arg(m_file.fileName(), m_file.errorString());
+        failed = true;
+      }
+    }
+
+    lock.lock();
+    if (!error.isEmpty()) {
+      m_writeError = error;
+    }
+    m_queuedBytes -= chunk.data.size();
+    ++m_processed;
+    m_condition.notify_all();
+    if (chunk.mode == Finish) {
+      return;
+    }
+  }
+}
+
+// hands @p data to the background thread, flushes and finishes wait for it to be written
+bool CompressedFile::enqueue(QByteArray data, int mode)
+{
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_condition.wait(lock, [this] { return m_queuedBytes < MaxQueuedBytes || !m_writeError.isEmpty(); });
+  if (!m_writeError.isEmpty() && mode != Finish) {
+    return false;
+  }
+  m_queuedBytes += data.size();
+  if (mode == Process && !m_queue.empty() && m_queue.back().mode == Process
+      && m_queue.back().data.size() + data.size() <= CoalesceSize) {
+    // batch small records, the background thread didn't pick up the previous one yet
+    m_queue.back().data.append(data);
+    return true;
+  }
+  Chunk chunk = { std::move(data), mode };
+  m_queue.push_back(std::move(chunk));
+  const auto ticket = ++m_enqueued;
+  m_condition.notify_all();
+  if (mode != Process) {
+    m_condition.wait(lock, [this, ticket] { return m_processed >= ticket; });
+  }
+  return m_writeError.isEmpty();
+}
@@ -0,0 +1,109 @@
+// Copyright (c) 2015 Klaralvdalens Datakonsult AB (KDAB).
+// All rights reserved. Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#ifndef PHANTOMJS_COMPRESSEDFILE_H
+#define PHANTOMJS_COMPRESSEDFILE_H
+
+#include <QByteArray>
+#include <QFile>
+#include <QString>
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+class CompressionCoder;
+
+/**
+ * A gzip or zstd compressed file that is either written or read sequentially.
+ *
+ * Writes are queued and compressed on a background thread, which also does
+ * the disk I/O, so appending records only costs a copy on the calling thread.
+ * The writer blocks once too much uncompressed data is queued. Appending to
+ * an existing file starts a new gzip member or zstd frame, concatenated files
+ * are valid for both formats and get decompressed as a whole.
+ *
+ * Reads decompress on demand into a buffer of the size of a few input chunks.
+ *
+ * The codecs are optional dependencies, see isSupported.
+ */
+class CompressedFile
+{
+public:
+  enum Codec
+  {
+    Gzip,
+    Zstd
+  };
+
+  // parses "gzip" or "zstd", returns false for unknown codecs
+  static bool codecFromName(const QString& name, Codec* codec);
+  // whether the codec was available at build time
+  static bool isSupported(Codec codec);
+
+  // @p openMode is ReadOnly, or WriteOnly with either Truncate or Append
+  // a negative @p level selects the default of the codec
+  // returns null on failure, with @p error set
+  static std::unique_ptr<CompressedFile> open(const QString& path, Codec codec, QIODevice::OpenMode openMode,
+                                              int level, QString* error);
+
+  ~CompressedFile();
+
+  QString fileName() const;
+  bool isWritable() const;
+
+  // reads up to @p maxSize uncompressed bytes, or everything until the end for negative values
+  QByteArray read(qint64 maxSize);
+  // reads the next line without the line break
+  QByteArray readLine();
+  bool atEnd();
+  // set once corrupt input stopped decompression, reads then end early
+  QString readError() const;
+  // the position in the uncompressed data
+  qint64 pos() const;
+
+  // queues @p data for compression, fails when the background thread ran into an error
+  bool write(const QByteArray& data);
+  // waits until all queued data is compressed and written, such that it can be decompressed
+  bool flush();
+  // finishes the stream and closes the file, also done by the destructor
+  bool close();
+
+private:
+  CompressedFile();
+
+  bool fill();
+  void compress();
+  bool enqueue(QByteArray data, int mode);
+
+  QFile m_file;
+  std::unique_ptr<CompressionCoder> m_coder;
+  qint64 m_pos = 0;
+  bool m_closed = false;
+
+  // reading
+  QByteArray m_buffer;
+  int m_bufferPos = 0;
+  bool m_inputEnd = false;
+  QString m_readError;
+
+  // writing, the members below are guarded by m_mutex
+  struct Chunk
+  {
+    QByteArray data;
+    int mode;
+  };
+  std::mutex m_mutex;
+  std::condition_variable m_condition;
+  std::deque<Chunk> m_queue;
+  qint64 m_queuedBytes = 0;
+  quint64 m_enqueued = 0;
+  quint64 m_processed = 0;
+  QString m_writeError;
+  std::thread m_thread;
+};
+
+#endif // PHANTOMJS_COMPRESSEDFILE_H
@@ -0,0 +1,192 @@
+// Copyright (c) 2015 Klaralvdalens Datakonsult AB (KDAB).
+// All rights reserved. Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include "config.h"
+
+#include <QFile>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QString>
+
+#include <algorithm>
+#include <iostream>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace {
+
+struct Preset
+{
+  const char* name;
+  // switches with an empty value are passed without a value
+  std::vector<std::pair<std::string, std::string>> switches;
+};
+
+// named sets of Chromium and phantomjs switches
+const Preset presets[] = {
+  // maximize page throughput of headless scraping jobs
+  {"headless-throughput", {
+    {"remote-debugging-port", "0"},
+    {"disable-gpu", ""},
+    {"disable-gpu-compositing", ""},
+    {"disable-background-networking", ""},
+    {"disable-component-update", ""},
+    {"disable-default-apps", ""},
+    {"disable-extensions", ""},
+    {"disable-sync", ""},
+    {"disable-translate", ""},
+    {"disable-speech-api", ""},
+    {"disable-notifications", ""},
+    {"disable-smooth-scrolling", ""},
+    {"disable-renderer-backgrounding", ""},
+    {"disable-background-timer-throttling", ""},
+    {"metrics-recording-only", ""},
+    {"mute-audio", ""},
+    {"no-first-run", ""},
+    {"no-pings", ""},
+  }},
+  // keep the memory footprint low when running many instances per host
+  {"low-memory", {
+    {"remote-debugging-port", "0"},
+    {"disable-gpu", ""},
+    {"disable-extensions", ""},
+    {"disable-background-networking", ""},
+    {"process-per-site", ""},
+    {"renderer-process-limit", "2"},
+    {"disk-cache-size", "52428800"},
+  }},
+};
+
+void appendSwitch(CefRefPtr<CefCommandLine> commandLine, const std::string& name, const std::string& value)
+{
+  if (commandLine->HasSwitch(name)) {
+    return;
+  }
+  if (value.empty()) {
+    commandLine->AppendSwitch(name);
+  } else {
+    commandLine->AppendSwitchWithValue(name, value);
+  }
+}
+
+}
+
+bool applyConfig(CefRefPtr<CefCommandLine> commandLine)
+{
+  // switches turned off by the config file, which the preset must not turn on again
+  std::set<std::string> disabled;
+  if (commandLine->HasSwitch("config")) {
+    const auto path = QString::fromStdString(commandLine->GetSwitchValue("config"));
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+      std::cerr << "Failed to open config file \"" << qPrintable(path) << "\".\n";
+      return false;
+    }
+    QJsonParseError error;
+    const auto config = QJsonDocument::fromJson(file.readAll(), &error).object();
+    if (error.error) {
+      std::cerr << "Failed to parse config file \"" << qPrintable(path) << "\": " << qPrintable(error.errorString()) << '\n';
+      return false;
+    }
+    for (auto it = config.begin(); it != config.end(); ++it) {
+      const auto name = it.key().toStdString();
+      const auto value = it.value();
+      if (value.isBool()) {
+        if (value.toBool()) {
+          appendSwitch(commandLine, name, "");
+        } else if (name == "ignore-ssl-errors") {
+          // the only switch that is enabled by default, see initCefSettings
+          appendSwitch(commandLine, name, "false");
+        } else {
+          // Chromium only checks for the presence of switches, so false must not add one
+          disabled.insert(name);
+        }
+      } else if (value.isDouble()) {
+        appendSwitch(commandLine, name, QString::number(value.toDouble()).toStdString());
+      } else if (value.isString()) {
+        appendSwitch(commandLine, name, value.toString().toStdString());
+      } else {
+        std::cerr << "Invalid value for \"" << name << "\" in config file \"" << qPrintable(path) << "\".\n";
+        return false;
+      }
+    }
+  }
+
+  if (commandLine->HasSwitch("preset")) {
+    const auto name = commandLine->GetSwitchValue("preset").ToString();
+    const auto it = std::find_if(std::begin(presets), std::end(presets), [&name] (const Preset& preset) {
+      return name == preset.name;
+    });
+    if (it == std::end(presets)) {
+      std::cerr << "Unknown preset \"" << name << "\". Available presets are:";
+      for (const auto& preset : presets) {
+        std::cerr << ' ' << preset.name;
+      }
+      std::cerr << '\n';
+      return false;
+    }
+    for (const auto& entry : it->switches) {
+      if (!disabled.count(entry.first)) {
+        appendSwitch(commandLine, entry.first, entry.second);
+      }
+    }
+  }
+
+  return true;
+}
+
+bool switchEnabled(CefRefPtr<CefCommandLine> commandLine, const CefString& name, bool defaultValue)
+{
+  if (!commandLine->HasSwitch(name)) {
+    return defaultValue;
+  }
+  const auto value = QString::fromStdString(commandLine->GetSwitchValue(name)).toLower();
+  return value.isEmpty() || !(value == QLatin1String("false") || value == QLatin1String("no")
+                              || value == QLatin1String("off") || value == QLatin1String("0"));
+}
+
+void initCefSettings(CefSettings& settings, CefRefPtr<CefCommandLine> commandLine)
+{
+  settings.windowless_rendering_enabled = true;
+
+  // same name and default as in the original phantomjs
+  settings.ignore_certificate_errors = switchEnabled(commandLine, "ignore-ssl-errors", true);
+
+  // NOTE: accessing the file system requires us to disable sandboxing
+  settings.no_sandbox = !switchEnabled(commandLine, "sandbox");
+
+  // 0 disables the remote debugger, run many instances with distinct ports or without it
+  settings.remote_debugging_port = 12345;
+  if (commandLine->HasSwitch("remote-debugging-port")) {
+    settings.remote_debugging_port = QString::fromStdString(commandLine->GetSwitchValue("remote-debugging-port")).toInt();
+  }
+
+  settings.persist_session_cookies = switchEnabled(commandLine, "persist-session-cookies");
+
+  if (commandLine->HasSwitch("user-agent")) {
+    CefString(&settings.user_agent) = commandLine->GetSwitchValue("user-agent");
+  }
+  if (commandLine->HasSwitch("locale")) {
+    CefString(&settings.locale) = commandLine->GetSwitchValue("locale");
+  }
+  if (commandLine->HasSwitch("log-file")) {
+    CefString(&settings.log_file) = commandLine->GetSwitchValue("log-file");
+  }
+  if (commandLine->HasSwitch("log-severity")) {
+    const auto severity = commandLine->GetSwitchValue("log-severity").ToString();
+    if (severity == "verbose") {
+      settings.log_severity = LOGSEVERITY_VERBOSE;
+    } else if (severity == "info") {
+      settings.log_severity = LOGSEVERITY_INFO;
+    } else if (severity == "warning") {
+      settings.log_severity = LOGSEVERITY_WARNING;
+    } else if (severity == "error") {
+      settings.log_severity = LOGSEVERITY_ERROR;
+    } else if (severity == "disable") {
+      settings.log_severity = LOGSEVERITY_DISABLE;
+    }
+  }
+}
@@ -0,0 +1,32 @@
+// Copyright (c) 2015 Klaralvdalens Datakonsult AB (KDAB).
+// All rights reserved. Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#ifndef PHANTOMJS_CONFIG_H
+#define PHANTOMJS_CONFIG_H
+
+#include "include/cef_app.h"
+#include "include/cef_command_line.h"
+
+/**
+ * Merges the switches of the JSON file passed via --config=<file> and those
+ * of the named --preset=<name> into the command line. Switches that were
+ * passed explicitly take precedence over the config file, which in turn takes
+ * precedence over the preset. A false value in the config file turns off a
+ * switch of the preset.
+ *
+ * The keys of the config file are switch names without leading dashes, e.g.:
+ *
+ *   {"preset": "headless-throughput", "remote-debugging-port": 9222, "disable-gpu": true}
+ *
+ * Returns false and prints an error for invalid config files or unknown presets.
+ */
+bool applyConfig(CefRefPtr<CefCommandLine> commandLine);
+
+// Initializes the CEF settings from the (merged) command line.
+void initCefSettings(CefSettings& settings, CefRefPtr<CefCommandLine> commandLine);
+
+// Whether the boolean switch is enabled, i.e. passed without a value or with a truthy one.
+bool switchEnabled(CefRefPtr<CefCommandLine> commandLine, const CefString& name, bool defaultValue = false);
+
+#endif // PHANTOMJS_CONFIG_H
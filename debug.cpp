@@ -25,3 +25,5 @@ Q_LOGGING_CATEGORY(handler, "phantomjs.handler", QtWarningMsg)
 Q_LOGGING_CATEGORY(print, "phantomjs.print", QtWarningMsg)
 Q_LOGGING_CATEGORY(app, "phantomjs.app", QtWarningMsg)
 Q_LOGGING_CATEGORY(keyevents, "phantomjs.keyevents", QtWarningMsg)
+Q_LOGGING_CATEGORY(startup, "phantomjs.startup", QtWarningMsg)
+Q_LOGGING_CATEGORY(network, "phantomjs.network", QtWarningMsg)
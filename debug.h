@@ -12,6 +12,8 @@ Q_DECLARE_LOGGING_CATEGORY(handler)
 Q_DECLARE_LOGGING_CATEGORY(app)
 Q_DECLARE_LOGGING_CATEGORY(print)
 Q_DECLARE_LOGGING_CATEGORY(keyevents)
+Q_DECLARE_LOGGING_CATEGORY(startup)
+Q_DECLARE_LOGGING_CATEGORY(network)
 
 class QDebug;
 
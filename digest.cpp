@@ -0,0 +1,787 @@
+// Copyright (c) 2015 Klaralvdalens Datakonsult AB (KDAB).
+// All rights reserved. Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include "digest.h"
+
+#include <QtEndian>
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define PHANTOMJS_X86_ACCELERATION
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+namespace {
+
+const uint64_t PRIME64_1 = 0x9E3779B185EBCA87ULL;
+const uint64_t PRIME64_2 = 0xC2B2AE3D27D4EB4FULL;
+const uint64_t PRIME64_3 = 0x165667B19E3779F9ULL;
+const uint64_t PRIME64_4 = 0x85EBCA77C2B2AE63ULL;
+const uint64_t PRIME64_5 = 0x27D4EB2F165667C5ULL;
+
+inline uint64_t rotl(uint64_t x, int r)
+{
+  return (x << r) | (x >> (64 - r));
+}
+
+inline uint64_t read64(const unsigned char* p)
+{
+  return qFromLittleEndian<quint64>(p);
+}
+
+inline uint32_t read32(const unsigned char* p)
+{
+  return qFromLittleEndian<quint32>(p);
+}
+
+inline uint64_t xxhRound(uint64_t acc, uint64_t input)
+{
+  acc += input * PRIME64_2;
+  acc = rotl(acc, 31);
+  return acc * PRIME64_1;
+}
+
+inline uint64_t mergeRound(uint64_t acc, uint64_t value)
+{
+  acc ^= xxhRound(0, value);
+  return acc * PRIME64_1 + PRIME64_4;
+}
+
+inline uint64_t mul128Fold64(uint64_t lhs, uint64_t rhs)
+{
+#ifdef __SIZEOF_INT128__
+  const auto product = static_cast<unsigned __int128>(lhs) * rhs;
+  return static_cast<uint64_t>(product) ^ static_cast<uint64_t>(product >> 64);
+#else
+  const uint64_t loLo = (lhs & 0xFFFFFFFF) * (rhs & 0xFFFFFFFF);
+  const uint64_t hiLo = (lhs >> 32) * (rhs & 0xFFFFFFFF);
+  const uint64_t loHi = (lhs & 0xFFFFFFFF) * (rhs >> 32);
+  const uint64_t hiHi = (lhs >> 32) * (rhs >> 32);
+  const uint64_t cross = (loLo >> 32) + (hiLo & 0xFFFFFFFF) + loHi;
+  const uint64_t upper = (hiLo >> 32) + (cross >> 32) + hiHi;
+  const uint64_t lower = (cross << 32) | (loLo & 0xFFFFFFFF);
+  return lower ^ upper;
+#endif
+}
+
+const uint32_t PRIME32_1 = 0x9E3779B1U;
+const uint32_t PRIME32_2 = 0x85EBCA77U;
+const uint32_t PRIME32_3 = 0xC2B2AE3DU;
+const uint64_t PRIME_MX1 = 0x165667919E3779F9ULL;
+const uint64_t PRIME_MX2 = 0x9FB21C651E98DF25ULL;
+
+// the default secret of XXH3
+const unsigned char XXH3_SECRET[192] = {
+  0xb8, 0xfe, 0x6c, 0x39, 0x23, 0xa4, 0x4b, 0xbe, 0x7c, 0x01, 0x81, 0x2c, 0xf7, 0x21, 0xad, 0x1c,
+  0xde, 0xd4, 0x6d, 0xe9, 0x83, 0x90, 0x97, 0xdb, 0x72, 0x40, 0xa4, 0xa4, 0xb7, 0xb3, 0x67, 0x1f,
+  0xcb, 0x79, 0xe6, 0x4e, 0xcc, 0xc0, 0xe5, 0x78, 0x82, 0x5a, 0xd0, 0x7d, 0xcc, 0xff, 0x72, 0x21,
+  0xb8, 0x08, 0x46, 0x74, 0xf7, 0x43, 0x24, 0x8e, 0xe0, 0x35, 0x90, 0xe6, 0x81, 0x3a, 0x26, 0x4c,
+  0x3c, 0x28, 0x52, 0xbb, 0x91, 0xc3, 0x00, 0xcb, 0x88, 0xd0, 0x65, 0x8b, 0x1b, 0x53, 0x2e, 0xa3,
+  0x71, 0x64, 0x48, 0x97, 0xa2, 0x0d, 0xf9, 0x4e, 0x38, 0x19, 0xef, 0x46, 0xa9, 0xde, 0xac, 0xd8,
+  0xa8, 0xfa, 0x76, 0x3f, 0xe3, 0x9c, 0x34, 0x3f, 0xf9, 0xdc, 0xbb, 0xc7, 0xc7, 0x0b, 0x4f, 0x1d,
+  0x8a, 0x51, 0xe0, 0x4b, 0xcd, 0xb4, 0x59, 0x31, 0xc8, 0x9f, 0x7e, 0xc9, 0xd9, 0x78, 0x73, 0x64,
+  0xea, 0xc5, 0xac, 0x83, 0x34, 0xd3, 0xeb, 0xc3, 0xc5, 0x81, 0xa0, 0xff, 0xfa, 0x13, 0x63, 0xeb,
+  0x17, 0x0d, 0xdd, 0x51, 0xb7, 0xf0, 0xda, 0x49, 0xd3, 0x16, 0x55, 0x26, 0x29, 0xd4, 0x68, 0x9e,
+  0x2b, 0x16, 0xbe, 0x58, 0x7d, 0x47, 0xa1, 0xfc, 0x8f, 0xf8, 0xb8, 0xd1, 0x7a, 0xd0, 0x31, 0xce,
+  0x45, 0xcb, 0x3a, 0x8f, 0x95, 0x16, 0x04, 0x28, 0xaf, 0xd7, 0xfb, 0xca, 0xbb, 0x4b, 0x40, 0x7e,
+};
+const size_t XXH3_STRIPE = 64;
+const size_t XXH3_STRIPES_PER_BLOCK = (sizeof(XXH3_SECRET) - XXH3_STRIPE) / 8;
+
+inline uint64_t xxh64Avalanche(uint64_t h)
+{
+  h ^= h >> 33;
+  h *= PRIME64_2;
+  h ^= h >> 29;
+  h *= PRIME64_3;
+  h ^= h >> 32;
+  return h;
+}
+
+inline uint64_t xxh3Avalanche(uint64_t h)
+{
+  h ^= h >> 37;
+  h *= PRIME_MX1;
+  h ^= h >> 32;
+  return h;
+}
+
+inline uint64_t rrmxmx(uint64_t h, uint64_t length)
+{
+  h ^= rotl(h, 49) ^ rotl(h, 24);
+  h *= PRIME_MX2;
+  h ^= (h >> 35) + length;
+  h *= PRIME_MX2;
+  h ^= h >> 28;
+  return h;
+}
+
+inline uint64_t mix16(const unsigned char* input, const unsigned char* secret)
+{
+  return mul128Fold64(read64(input) ^ read64(secret), read64(input + 8) ^ read64(secret + 8));
+}
+
+// the one-shot XXH3 of inputs up to 240 bytes, which never touch the accumulators
+uint64_t xxh3Short(const unsigned char* input, size_t length)
+{
+  const auto secret = XXH3_SECRET;
+  if (length > 128) {
+    uint64_t acc = length * PRIME64_1;
+    const size_t rounds = length / 16;
+    for (size_t i = 0; i < 8; ++i) {
+      acc += mix16(input + 16 * i, secret + 16 * i);
+    }
+    acc = xxh3Avalanche(acc);
+    for (size_t i = 8; i < rounds; ++i) {
+      acc += mix16(input + 16 * i, secret + 16 * (i - 8) + 3);
+    }
+    acc += mix16(input + length - 16, secret + 136 - 17);
+    return xxh3Avalanche(acc);
+  } else if (length > 16) {
+    uint64_t acc = length * PRIME64_1;
+    if (length > 32) {
+      if (length > 64) {
+        if (length > 96) {
+          acc += mix16(input + 48, secret + 96);
+          acc += mix16(input + length - 64, secret + 112);
+        }
+        acc += mix16(input + 32, secret + 64);
+        acc += mix16(input + length - 48, secret + 80);
+      }
+      acc += mix16(input + 16, secret + 32);
+      acc += mix16(input + length - 32, secret + 48);
+    }
+    acc += mix16(input, secret);
+    acc += mix16(input + length - 16, secret + 16);
+    return xxh3Avalanche(acc);
+  } else if (length > 8) {
+    const uint64_t low = read64(input) ^ (read64(secret + 24) ^ read64(secret + 32));
+    const uint64_t high = read64(input + length - 8) ^ (read64(secret + 40) ^ read64(secret + 48));
+    const uint64_t acc = length + qbswap<quint64>(low) + high + mul128Fold64(low, high);
+    return xxh3Avalanche(acc);
+  } else if (length >= 4) {
+    const uint64_t input64 = read32(input + length - 4) + (static_cast<uint64_t>(read32(input)) << 32);
+    return rrmxmx(input64 ^ (read64(secret + 8) ^ read64(secret + 16)), length);
+  } else if (length > 0) {
+    const uint32_t combined = (static_cast<uint32_t>(input[0]) << 16) | (static_cast<uint32_t>(input[length >> 1]) << 24)
+                            | input[length - 1] | (static_cast<uint32_t>(length) << 8);
+    return xxh64Avalanche(combined ^ static_cast<uint64_t>(read32(secret) ^ read32(secret + 4)));
+  }
+  return xxh64Avalanche(read64(secret + 56) ^ read64(secret + 64));
+}
+
+inline void xxh3Accumulate512(uint64_t* acc, const unsigned char* input, const unsigned char* secret)
+{
+  for (int i = 0; i < 8; ++i) {
+    const uint64_t value = read64(input + 8 * i);
+    const uint64_t key = value ^ read64(secret + 8 * i);
+    acc[i ^ 1] += value;
+    acc[i] += (key & 0xFFFFFFFF) * (key >> 32);
+  }
+}
+
+inline void xxh3Scramble(uint64_t* acc, const unsigned char* secret)
+{
+  for (int i = 0; i < 8; ++i) {
+    uint64_t value = acc[i];
+    value ^= value >> 47;
+    value ^= read64(secret + 8 * i);
+    acc[i] = value * PRIME32_1;
+  }
+}
+
+// accumulates consecutive stripes, the secret advances by eight bytes per stripe
+void xxh3AccumulateScalar(uint64_t* acc, const unsigned char* input, const unsigned char* secret, size_t stripes)
+{
+  for (size_t i = 0; i < stripes; ++i) {
+    xxh3Accumulate512(acc, input + i * XXH3_STRIPE, secret + i * 8);
+  }
+}
+
+#ifdef PHANTOMJS_X86_ACCELERATION
+// SSE2 is part of every x86-64 CPU
+void xxh3AccumulateSse2(uint64_t* acc, const unsigned char* input, const unsigned char* secret, size_t stripes)
+{
+  __m128i accs[4];
+  for (int i = 0; i < 4; ++i) {
+    accs[i] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(acc) + i);
+  }
+  for (size_t stripe = 0; stripe < stripes; ++stripe) {
+    const auto data = reinterpret_cast<const __m128i*>(input + stripe * XXH3_STRIPE);
+    const auto keys = reinterpret_cast<const __m128i*>(secret + stripe * 8);
+    for (int i = 0; i < 4; ++i) {
+      const __m128i value = _mm_loadu_si128(data + i);
+      const __m128i key = _mm_xor_si128(value, _mm_loadu_si128(keys + i));
+      const __m128i product = _mm_mul_epu32(key, _mm_shuffle_epi32(key, _MM_SHUFFLE(0, 3, 0, 1)));
+      const __m128i swapped = _mm_shuffle_epi32(value, _MM_SHUFFLE(1, 0, 3, 2));
+      accs[i] = _mm_add_epi64(product, _mm_add_epi64(accs[i], swapped));
+    }
+  }
+  for (int i = 0; i < 4; ++i) {
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(acc) + i, accs[i]);
+  }
+}
+
+__attribute__((target("avx2")))
+void xxh3AccumulateAvx2(uint64_t* acc, const unsigned char* input, const unsigned char* secret, size_t stripes)
+{
+  __m256i accs[2];
+  for (int i = 0; i < 2; ++i) {
+    accs[i] = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(acc) + i);
+  }
+  for (size_t stripe = 0; stripe < stripes; ++stripe) {
+    const auto data = reinterpret_cast<const __m256i*>(input + stripe * XXH3_STRIPE);
+    const auto keys = reinterpret_cast<const __m256i*>(secret + stripe * 8);
+    for (int i = 0; i < 2; ++i) {
+      const __m256i value = _mm256_loadu_si256(data + i);
+      const __m256i key = _mm256_xor_si256(value, _mm256_loadu_si256(keys + i));
+      const __m256i product = _mm256_mul_epu32(key, _mm256_shuffle_epi32(key, _MM_SHUFFLE(0, 3, 0, 1)));
+      const __m256i swapped = _mm256_shuffle_epi32(value, _MM_SHUFFLE(1, 0, 3, 2));
+      accs[i] = _mm256_add_epi64(product, _mm256_add_epi64(accs[i], swapped));
+    }
+  }
+  for (int i = 0; i < 2; ++i) {
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(acc) + i, accs[i]);
+  }
+}
+
+bool cpuHasAvx2()
+{
+  unsigned int eax, ebx, ecx, edx;
+  // the OS must save the AVX registers as well
+  if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) || !(ecx & bit_OSXSAVE) || __get_cpuid_max(0, nullptr) < 7) {
+    return false;
+  }
+  unsigned int xcrLow, xcrHigh;
+  __asm__("xgetbv" : "=a"(xcrLow), "=d"(xcrHigh) : "c"(0));
+  if ((xcrLow & 6) != 6) {
+    return false;
+  }
+  __cpuid_count(7, 0, eax, ebx, ecx, edx);
+  return ebx & (1U << 5);
+}
+#endif
+
+using Xxh3AccumulateFunction = void (*)(uint64_t* acc, const unsigned char* input, const unsigned char* secret, size_t stripes);
+
+Xxh3AccumulateFunction xxh3Accumulate()
+{
+#ifdef PHANTOMJS_X86_ACCELERATION
+  static const Xxh3AccumulateFunction function = cpuHasAvx2() ? xxh3AccumulateAvx2 : xxh3AccumulateSse2;
+  return function;
+#else
+  return xxh3AccumulateScalar;
+#endif
+}
+
+// accumulates @p stripes stripes, scrambling the accumulators at the end of every block
+void xxh3ConsumeStripes(uint64_t* acc, size_t* stripesSoFar, const unsigned char* input, size_t stripes)
+{
+  const auto secret = XXH3_SECRET;
+  const auto accumulate = xxh3Accumulate();
+  if (XXH3_STRIPES_PER_BLOCK - *stripesSoFar <= stripes) {
+    const size_t toEnd = XXH3_STRIPES_PER_BLOCK - *stripesSoFar;
+    accumulate(acc, input, secret + *stripesSoFar * 8, toEnd);
+    xxh3Scramble(acc, secret + sizeof(XXH3_SECRET) - XXH3_STRIPE);
+    const size_t afterBlock = stripes - toEnd;
+    accumulate(acc, input + toEnd * XXH3_STRIPE, secret, afterBlock);
+    *stripesSoFar = afterBlock;
+  } else {
+    accumulate(acc, input, secret + *stripesSoFar * 8, stripes);
+    *stripesSoFar += stripes;
+  }
+}
+
+// CRC-32C lookup table for the reflected Castagnoli polynomial
+struct Crc32cTable
+{
+  uint32_t values[256];
+
+  Crc32cTable()
+  {
+    for (uint32_t i = 0; i < 256; ++i) {
+      uint32_t crc = i;
+      for (int bit = 0; bit < 8; ++bit) {
+        crc = (crc >> 1) ^ ((crc & 1) ? 0x82F63B78U : 0);
+      }
+      values[i] = crc;
+    }
+  }
+};
+
+uint32_t crc32cSoftware(uint32_t crc, const unsigned char* data, size_t size)
+{
+  static const Crc32cTable table;
+  for (size_t i = 0; i < size; ++i) {
+    crc = table.values[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+  }
+  return crc;
+}
+
+const uint32_t SHA256_K[64] = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+  0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+  0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+  0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+  0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+  0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+inline uint32_t rotr(uint32_t x, int r)
+{
+  return (x >> r) | (x << (32 - r));
+}
+
+void sha256Software(uint32_t* state, const unsigned char* data, size_t blocks)
+{
+  for (; blocks; --blocks, data += 64) {
+    uint32_t w[64];
+    for (int i = 0; i < 16; ++i) {
+      w[i] = qFromBigEndian<quint32>(data + 4 * i);
+    }
+    for (int i = 16; i < 64; ++i) {
+      const uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+      const uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+      w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+    uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+    for (int i = 0; i < 64; ++i) {
+      const uint32_t t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + SHA256_K[i] + w[i];
+      const uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+      h = g;
+      g = f;
+      f = e;
+      e = d + t1;
+      d = c;
+      c = b;
+      b = a;
+      a = t1 + t2;
+    }
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+    state[5] += f;
+    state[6] += g;
+    state[7] += h;
+  }
+}
+
+#ifdef PHANTOMJS_X86_ACCELERATION
+bool cpuHasSse42()
+{
+  unsigned int eax, ebx, ecx, edx;
+  return __get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_SSE4_2);
+}
+
+bool cpuHasSha()
+{
+  unsigned int eax, ebx, ecx, edx;
+  if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) || !(ecx & bit_SSE4_1) || !(ecx & bit_SSSE3)
+      || __get_cpuid_max(0, nullptr) < 7) {
+    return false;
+  }
+  __cpuid_count(7, 0, eax, ebx, ecx, edx);
+  return ebx & (1U << 29);
+}
+
+__attribute__((target("sse4.2")))
+uint32_t crc32cHardware(uint32_t crc, const unsigned char* data, size_t size)
+{
+  uint64_t crc64 = crc;
+  for (; size >= 8; size -= 8, data += 8) {
+    uint64_t value;
+    memcpy(&value, data, sizeof(value));
+    crc64 = _mm_crc32_u64(crc64, value);
+  }
+  crc = static_cast<uint32_t>(crc64);
+  for (; size; --size, ++data) {
+    crc = _mm_crc32_u8(crc, *data);
+  }
+  return crc;
+}
+
+// the SHA-256 rounds on the SHA extensions, four rounds per iteration with the
+// message schedule rotating through four registers
+__attribute__((target("sha,sse4.1,ssse3")))
+void sha256Hardware(uint32_t* state, const unsigned char* data, size_t blocks)
+{
+  const __m128i byteSwap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+  __m128i tmp = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(state)), 0xB1);
+  __m128i state1 = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(state + 4)), 0x1B);
+  __m128i state0 = _mm_alignr_epi8(tmp, state1, 8);
+  state1 = _mm_blend_epi16(state1, tmp, 0xF0);
+
+  for (; blocks; --blocks, data += 64) {
+    const __m128i abefSave = state0;
+    const __m128i cdghSave = state1;
+    __m128i msg[4];
+    for (int i = 0; i < 16; ++i) {
+      if (i < 4) {
+        msg[i] = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 16 * i)), byteSwap);
+      }
+      __m128i rounds = _mm_add_epi32(msg[i % 4], _mm_loadu_si128(reinterpret_cast<const __m128i*>(SHA256_K + 4 * i)));
+      state1 = _mm_sha256rnds2_epu32(state1, state0, rounds);
+      if (i >= 3 && i <= 14) {
+        tmp = _mm_alignr_epi8(msg[i % 4], msg[(i + 3) % 4], 4);
+        msg[(i + 1) % 4] = _mm_sha256msg2_epu32(_mm_add_epi32(msg[(i + 1) % 4], tmp), msg[i % 4]);
+      }
+      rounds = _mm_shuffle_epi32(rounds, 0x0E);
+      state0 = _mm_sha256rnds2_epu32(state0, state1, rounds);
+      if (i >= 1 && i <= 12) {
+        msg[(i + 3) % 4] = _mm_sha256msg1_epu32(msg[(i + 3) % 4], msg[i % 4]);
+      }
+    }
+    state0 = _mm_add_epi32(state0, abefSave);
+    state1 = _mm_add_epi32(state1, cdghSave);
+  }
+
+  tmp = _mm_shuffle_epi32(state0, 0x1B);
+  state1 = _mm_shuffle_epi32(state1, 0xB1);
+  state0 = _mm_blend_epi16(tmp, state1, 0xF0);
+  state1 = _mm_alignr_epi8(state1, tmp, 8);
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(state), state0);
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(state + 4), state1);
+}
+#endif
+
+using Crc32cFunction = uint32_t (*)(uint32_t crc, const unsigned char* data, size_t size);
+using Sha256Function = void (*)(uint32_t* state, const unsigned char* data, size_t blocks);
+
+Crc32cFunction crc32cFunction()
+{
+#ifdef PHANTOMJS_X86_ACCELERATION
+  static const Crc32cFunction function = cpuHasSse42() ? crc32cHardware : crc32cSoftware;
+  return function;
+#else
+  return crc32cSoftware;
+#endif
+}
+
+Sha256Function sha256Function()
+{
+#ifdef PHANTOMJS_X86_ACCELERATION
+  static const Sha256Function function = cpuHasSha() ? sha256Hardware : sha256Software;
+  return function;
+#else
+  return sha256Software;
+#endif
+}
+
+QCryptographicHash::Algorithm cryptographicAlgorithm(const QString& name, bool* ok)
+{
+  *ok = true;
+  if (name == QLatin1String("md5")) {
+    return QCryptographicHash::Md5;
+  } else if (name == QLatin1String("sha1")) {
+    return QCryptographicHash::Sha1;
+  } else if (name == QLatin1String("sha512")) {
+    return QCryptographicHash::Sha512;
+  }
+  *ok = false;
+  return QCryptographicHash::Sha256;
+}
+}
+
+Xxh64::Xxh64(uint64_t seed)
+  : m_seed(seed)
+{
+  m_v[0] = seed + PRIME64_1 + PRIME64_2;
+  m_v[1] = seed + PRIME64_2;
+  m_v[2] = seed;
+  m_v[3] = seed - PRIME64_1;
+}
+
+void Xxh64::addData(const char* data, size_t size)
+{
+  auto p = reinterpret_cast<const unsigned char*>(data);
+  const auto end = p + size;
+  m_totalSize += size;
+
+  if (m_bufferSize + size < sizeof(m_buffer)) {
+    memcpy(m_buffer + m_bufferSize, p, size);
+    m_bufferSize += size;
+    return;
+  }
+
+  if (m_bufferSize) {
+    const auto missing = sizeof(m_buffer) - m_bufferSize;
+    memcpy(m_buffer + m_bufferSize, p, missing);
+    p += missing;
+    for (int i = 0; i < 4; ++i) {
+      m_v[i] = xxhRound(m_v[i], read64(m_buffer + i * 8));
+    }
+    m_bufferSize = 0;
+  }
+
+  while (p + 32 <= end) {
+    for (int i = 0; i < 4; ++i) {
+      m_v[i] = xxhRound(m_v[i], read64(p + i * 8));
+    }
+    p += 32;
+  }
+
+  m_bufferSize = end - p;
+  memcpy(m_buffer, p, m_bufferSize);
+}
+
+uint64_t Xxh64::result() const
+{
+  uint64_t h;
+  if (m_totalSize >= 32) {
+    h = rotl(m_v[0], 1) + rotl(m_v[1], 7) + rotl(m_v[2], 12) + rotl(m_v[3], 18);
+    for (int i = 0; i < 4; ++i) {
+      h = mergeRound(h, m_v[i]);
+    }
+  } else {
+    h = m_seed + PRIME64_5;
+  }
+  h += m_totalSize;
+
+  auto p = m_buffer;
+  const auto end = m_buffer + m_bufferSize;
+  while (p + 8 <= end) {
+    h ^= xxhRound(0, read64(p));
+    h = rotl(h, 27) * PRIME64_1 + PRIME64_4;
+    p += 8;
+  }
+  if (p + 4 <= end) {
+    h ^= static_cast<uint64_t>(read32(p)) * PRIME64_1;
+    h = rotl(h, 23) * PRIME64_2 + PRIME64_3;
+    p += 4;
+  }
+  while (p < end) {
+    h ^= *p * PRIME64_5;
+    h = rotl(h, 11) * PRIME64_1;
+    ++p;
+  }
+
+  h ^= h >> 33;
+  h *= PRIME64_2;
+  h ^= h >> 29;
+  h *= PRIME64_3;
+  h ^= h >> 32;
+  return h;
+}
+
+Xxh3::Xxh3()
+{
+  const uint64_t init[8] = {PRIME32_3, PRIME64_1, PRIME64_2, PRIME64_3, PRIME64_4, PRIME32_2, PRIME64_5, PRIME32_1};
+  memcpy(m_acc, init, sizeof(m_acc));
+}
+
+void Xxh3::addData(const char* data, size_t size)
+{
+  auto input = reinterpret_cast<const unsigned char*>(data);
+  const auto end = input + size;
+  m_totalSize += size;
+
+  // only consume the buffer once more data follows, the final stripe is handled by result
+  if (m_bufferSize + size <= sizeof(m_buffer)) {
+    memcpy(m_buffer + m_bufferSize, input, size);
+    m_bufferSize += size;
+    return;
+  }
+
+  const size_t bufferStripes = sizeof(m_buffer) / XXH3_STRIPE;
+  if (m_bufferSize) {
+    const auto missing = sizeof(m_buffer) - m_bufferSize;
+    memcpy(m_buffer + m_bufferSize, input, missing);
+    input += missing;
+    xxh3ConsumeStripes(m_acc, &m_stripesSoFar, m_buffer, bufferStripes);
+    m_bufferSize = 0;
+  }
+
+  if (input + sizeof(m_buffer) < end) {
+    do {
+      xxh3ConsumeStripes(m_acc, &m_stripesSoFar, input, bufferStripes);
+      input += sizeof(m_buffer);
+    } while (input + sizeof(m_buffer) < end);
+    // keep the last consumed stripe, result may need it to complete the final stripe
+    memcpy(m_buffer + sizeof(m_buffer) - XXH3_STRIPE, input - XXH3_STRIPE, XXH3_STRIPE);
+  }
+
+  m_bufferSize = end - input;
+  memcpy(m_buffer, input, m_bufferSize);
+}
+
+uint64_t Xxh3::result() const
+{
+  if (m_totalSize <= 240) {
+    return xxh3Short(m_buffer, m_totalSize);
+  }
+
+  uint64_t acc[8];
+  memcpy(acc, m_acc, sizeof(acc));
+  unsigned char lastStripe[XXH3_STRIPE];
+  const unsigned char* lastStripePtr = lastStripe;
+  if (m_bufferSize >= XXH3_STRIPE) {
+    size_t stripesSoFar = m_stripesSoFar;
+    xxh3ConsumeStripes(acc, &stripesSoFar, m_buffer, (m_bufferSize - 1) / XXH3_STRIPE);
+    lastStripePtr = m_buffer + m_bufferSize - XXH3_STRIPE;
+  } else {
+    const auto catchup = XXH3_STRIPE - m_bufferSize;
+    memcpy(lastStripe, m_buffer + sizeof(m_buffer) - catchup, catchup);
+    memcpy(lastStripe + catchup, m_buffer, m_bufferSize);
+  }
+  xxh3Accumulate512(acc, lastStripePtr, XXH3_SECRET + sizeof(XXH3_SECRET) - XXH3_STRIPE - 7);
+
+  uint64_t result = m_totalSize * PRIME64_1;
+  for (int i = 0; i < 4; ++i) {
+    result += mul128Fold64(acc[2 * i] ^ read64(XXH3_SECRET + 11 + 16 * i),
+                           acc[2 * i + 1] ^ read64(XXH3_SECRET + 11 + 16 * i + 8));
+  }
+  return xxh3Avalanche(result);
+}
+
+void Crc32c::addData(const char* data, size_t size)
+{
+  m_crc = crc32cFunction()(m_crc, reinterpret_cast<const unsigned char*>(data), size);
+}
+
+uint32_t Crc32c::result() const
+{
+  return ~m_crc;
+}
+
+bool Crc32c::isAccelerated()
+{
+  return crc32cFunction() != crc32cSoftware;
+}
+
+Sha256::Sha256()
+{
+  const uint32_t init[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+  memcpy(m_state, init, sizeof(m_state));
+}
+
+void Sha256::addData(const char* data, size_t size)
+{
+  auto input = reinterpret_cast<const unsigned char*>(data);
+  m_totalSize += size;
+  if (m_bufferSize) {
+    const auto missing = std::min(sizeof(m_buffer) - m_bufferSize, size);
+    memcpy(m_buffer + m_bufferSize, input, missing);
+    m_bufferSize += missing;
+    input += missing;
+    size -= missing;
+    if (m_bufferSize < sizeof(m_buffer)) {
+      return;
+    }
+    sha256Function()(m_state, m_buffer, 1);
+    m_bufferSize = 0;
+  }
+  const auto blocks = size / 64;
+  if (blocks) {
+    sha256Function()(m_state, input, blocks);
+    input += blocks * 64;
+    size -= blocks * 64;
+  }
+  memcpy(m_buffer, input, size);
+  m_bufferSize = size;
+}
+
+QByteArray Sha256::result() const
+{
+  uint32_t state[8];
+  memcpy(state, m_state, sizeof(state));
+  unsigned char padding[128] = {};
+  memcpy(padding, m_buffer, m_bufferSize);
+  padding[m_bufferSize] = 0x80;
+  const size_t blocks = m_bufferSize < 56 ? 1 : 2;
+  qToBigEndian<quint64>(m_totalSize * 8, padding + blocks * 64 - 8);
+  sha256Function()(state, padding, blocks);
+
+  QByteArray digest(32, Qt::Uninitialized);
+  for (int i = 0; i < 8; ++i) {
+    qToBigEndian<quint32>(state[i], reinterpret_cast<uchar*>(digest.data()) + 4 * i);
+  }
+  return digest;
+}
+
+bool Sha256::isAccelerated()
+{
+  return sha256Function() != sha256Software;
+}
+
+StreamDigest::StreamDigest(const QStringList& algorithms)
+{
+  foreach (const auto& name, algorithms) {
+    Algorithm algorithm;
+    algorithm.name = name;
+    bool ok = false;
+    const auto cryptographic = cryptographicAlgorithm(name, &ok);
+    if (ok) {
+      algorithm.cryptographic.reset(new QCryptographicHash(cryptographic));
+    } else if (name == QLatin1String("xxh64")) {
+      algorithm.xxh64.reset(new Xxh64);
+    } else if (name == QLatin1String("xxh3")) {
+      algorithm.xxh3.reset(new Xxh3);
+    } else if (name == QLatin1String("crc32c")) {
+      algorithm.crc32c.reset(new Crc32c);
+    } else if (name == QLatin1String("sha256")) {
+      algorithm.sha256.reset(new Sha256);
+    } else {
+      continue;
+    }
+    m_algorithms.push_back(std::move(algorithm));
+  }
+}
+
+StreamDigest::~StreamDigest() = default;
+
+bool StreamDigest::isSupported(const QString& algorithm)
+{
+  bool ok = false;
+  cryptographicAlgorithm(algorithm, &ok);
+  return ok || algorithm == QLatin1String("xxh64") || algorithm == QLatin1String("xxh3")
+    || algorithm == QLatin1String("crc32c") || algorithm == QLatin1String("sha256");
+}
+
+void StreamDigest::addData(const char* data, size_t size)
+{
+  for (auto& algorithm : m_algorithms) {
+    if (algorithm.cryptographic) {
+      // QCryptographicHash takes int sizes, mapped files can be larger
+      for (size_t offset = 0; offset < size; offset += 1 << 30) {
+        algorithm.cryptographic->addData(data + offset, static_cast<int>(std::min<size_t>(size - offset, 1 << 30)));
+      }
+    } else if (algorithm.xxh64) {
+      algorithm.xxh64->addData(data, size);
+    } else if (algorithm.xxh3) {
+      algorithm.xxh3->addData(data, size);
+    } else if (algorithm.crc32c) {
+      algorithm.crc32c->addData(data, size);
+    } else {
+      algorithm.sha256->addData(data, size);
+    }
+  }
+}
+
+QJsonObject StreamDigest::result() const
+{
+  QJsonObject result;
+  for (const auto& algorithm : m_algorithms) {
+    if (algorithm.cryptographic) {
+      result[algorithm.name] = QString::fromLatin1(algorithm.cryptographic->result().toHex());
+    } else if (algorithm.xxh64) {
+      result[algorithm.name] = QStringLiteral("%1").arg(static_cast<qulonglong>(algorithm.xxh64->result()), 16, 16, QLatin1Char('0'));
+    } else if (algorithm.xxh3) {
+      result[algorithm.name] = QStringLiteral("%1").arg(static_cast<qulonglong>(algorithm.xxh3->result()), 16, 16, QLatin1Char('0'));
+    } else if (algorithm.crc32c) {
+      result[algorithm.name] = QStringLiteral("%1").arg(algorithm.crc32c->result(), 8, 16, QLatin1Char('0'));
+    } else {
+      result[algorithm.name] = QString::fromLatin1(algorithm.sha256->result().toHex());
+    }
+  }
+  return result;
+}
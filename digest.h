@@ -0,0 +1,133 @@
+// Copyright (c) 2015 Klaralvdalens Datakonsult AB (KDAB).
+// All rights reserved. Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#ifndef PHANTOMJS_DIGEST_H
+#define PHANTOMJS_DIGEST_H
+
+#include <QCryptographicHash>
+#include <QJsonObject>
+#include <QStringList>
+
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+/**
+ * Incremental XXH64, a fast non-cryptographic hash.
+ *
+ * The digest is the canonical big endian hex representation as printed by xxhsum.
+ */
+class Xxh64
+{
+public:
+  explicit Xxh64(uint64_t seed = 0);
+
+  void addData(const char* data, size_t size);
+  uint64_t result() const;
+
+private:
+  uint64_t m_v[4];
+  unsigned char m_buffer[32];
+  size_t m_bufferSize = 0;
+  uint64_t m_totalSize = 0;
+  uint64_t m_seed;
+};
+
+/**
+ * Incremental XXH3 with 64 bit output, the default secret and seed 0.
+ *
+ * The stripes are accumulated with SSE2 or AVX2 on x86-64, which makes it
+ * considerably faster than XXH64 on large inputs. The digest matches xxhsum -H3.
+ */
+class Xxh3
+{
+public:
+  Xxh3();
+
+  void addData(const char* data, size_t size);
+  uint64_t result() const;
+
+private:
+  uint64_t m_acc[8];
+  // four stripes, the last stripe is kept at the end for the final accumulation
+  unsigned char m_buffer[256];
+  size_t m_bufferSize = 0;
+  size_t m_stripesSoFar = 0;
+  uint64_t m_totalSize = 0;
+};
+
+/**
+ * Incremental CRC-32C (Castagnoli) as used by iSCSI, ext4 and many storage formats.
+ *
+ * Uses the crc32 instruction of SSE 4.2 when the CPU supports it.
+ */
+class Crc32c
+{
+public:
+  void addData(const char* data, size_t size);
+  uint32_t result() const;
+
+  static bool isAccelerated();
+
+private:
+  uint32_t m_crc = 0xFFFFFFFF;
+};
+
+/**
+ * Incremental SHA-256.
+ *
+ * Uses the SHA extensions of x86 CPUs when available, which are several times
+ * faster than QCryptographicHash.
+ */
+class Sha256
+{
+public:
+  Sha256();
+
+  void addData(const char* data, size_t size);
+  // the 32 byte digest
+  QByteArray result() const;
+
+  static bool isAccelerated();
+
+private:
+  uint32_t m_state[8];
+  unsigned char m_buffer[64];
+  size_t m_bufferSize = 0;
+  uint64_t m_totalSize = 0;
+};
+
+/**
+ * Computes several digests of a stream in one pass.
+ *
+ * Supported algorithms are md5, sha1, sha256, sha512, xxh64, xxh3 and crc32c.
+ */
+class StreamDigest
+{
+public:
+  // unknown algorithms are ignored, see isSupported
+  explicit StreamDigest(const QStringList& algorithms);
+  ~StreamDigest();
+
+  static bool isSupported(const QString& algorithm);
+
+  void addData(const char* data, size_t size);
+  // maps the algorithm names to the hex encoded digests
+  QJsonObject result() const;
+
+private:
+  struct Algorithm
+  {
+    QString name;
+    std::unique_ptr<QCryptographicHash> cryptographic;
+    std::unique_ptr<Xxh64> xxh64;
+    std::unique_ptr<Xxh3> xxh3;
+    std::unique_ptr<Crc32c> crc32c;
+    std::unique_ptr<Sha256> sha256;
+  };
+  std::vector<Algorithm> m_algorithms;
+};
+
+#endif // PHANTOMJS_DIGEST_H
@@ -0,0 +1,418 @@
+// Copyright (c) 2015 Klaralvdalens Datakonsult AB (KDAB).
+// All rights reserved. Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include "downloads.h"
+
+#include <QByteArray>
+#include <QFile>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#ifndef Q_OS_WIN
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "include/cef_task.h"
+#include "include/cef_urlrequest.h"
+#include "include/wrapper/cef_helpers.h"
+
+#include "digest.h"
+#include "task.h"
+#include "debug.h"
+
+namespace {
+
+double now()
+{
+  using namespace std::chrono;
+  return duration<double, std::milli>(steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * Feeds the digests and writes the target of a streamed download on a thread
+ * of its own, such that neither the UI thread nor the shared FILE thread wait
+ * for hashing or for a slow reader of the target, e.g. a named pipe.
+ *
+ * The thread keeps the worker alive until all chunks got processed.
+ */
+class DownloadWorker
+{
+public:
+  using Finished = std::function<void(const QJsonObject& digests, const QString& error)>;
+
+  // a named pipe must be opened by its reader within this time
+  static const int OPEN_TIMEOUT = 30 * 1000;
+  // like the compressed files, but CefURLRequest can't be paused and its data arrives
+  // on the UI thread, so add() refuses data above this instead of blocking
+  static const qint64 MAX_QUEUED_BYTES = 32 * 1024 * 1024;
+
+  // @p target is empty for downloads that are only hashed
+  static std::shared_ptr<DownloadWorker> start(const QStringList& digests, const QString& target)
+  {
+    std::shared_ptr<DownloadWorker> worker(new DownloadWorker(digests, target));
+    std::thread([worker] () { worker->run(); }).detach();
+    return worker;
+  }
+
+  // returns false when the queue is full, i.e. the target is read more slowly than the data arrives
+  bool add(const char* data, size_t size)
+  {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      if (m_queuedBytes + static_cast<qint64>(size) > MAX_QUEUED_BYTES) {
+        return false;
+      }
+      m_queue.emplace_back(data, static_cast<int>(size));
+      m_queuedBytes += size;
+    }
+    m_condition.notify_one();
+    return true;
+  }
+
+  // set once writing the target failed, further data is discarded
+  bool failed() const
+  {
+    return m_failed;
+  }
+
+  // @p finished is called on the worker thread once all data got processed and the target is closed
+  void finish(Finished finished)
+  {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_finished = finished;
+    }
+    m_condition.notify_one();
+  }
+
+private:
+  DownloadWorker(const QStringList& digests, const QString& target)
+    : m_digest(digests)
+    , m_target(target)
+  {}
+
+  void run()
+  {
+    if (!m_target.isEmpty()) {
+      openTarget();
+    }
+    Finished finished;
+    for (;;) {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_condition.wait(lock, [this] () { return !m_queue.empty() || m_finished; });
+      if (m_queue.empty()) {
+        finished = std::move(m_finished);
+        break;
+      }
+      const auto chunk = std::move(m_queue.front());
+      m_queue.pop_front();
+      m_queuedBytes -= chunk.size();
+      lock.unlock();
+
+      m_digest.addData(chunk.constData(), chunk.size());
+      if (m_file.isOpen() && !m_failed && m_file.write(chunk) != chunk.size()) {
+        fail(m_file.errorString());
+      }
+    }
+    if (m_file.isOpen() && !m_file.flush() && !m_failed) {
+      fail(m_file.errorString());
+    }
+    m_file.close();
+    finished(m_digest.result(), m_error);
+  }
+
+  void openTarget()
+  {
+#ifndef Q_OS_WIN
+    // opening a named pipe for writing blocks until the reader opened it, poll for
+    // the reader instead, to give up when it never shows up
+    const auto path = QFile::encodeName(m_target);
+    const auto deadline = now() + OPEN_TIMEOUT;
+    int fd = -1;
+    for (;;) {
+      fd = ::open(path.constData(), O_WRONLY | O_CREAT | O_TRUNC | O_NONBLOCK | O_CLOEXEC, 0666);
+      if (fd >= 0 || errno != ENXIO || now() >= deadline) {
+        break;
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+    if (fd < 0) {
+      fail(errno == ENXIO ? QStringLiteral("no reader opened the pipe within %1 seconds").arg(OPEN_TIMEOUT / 1000)
+                          : QString::fromLocal8Bit(strerror(errno)));
+      return;
+    }
+    // the worker thread may block on writes to a slow reader
+    ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+    if (!m_file.open(fd, QIODevice::WriteOnly, QFileDevice::AutoCloseHandle)) {
+      ::close(fd);
+      fail(m_file.errorString());
+    }
+#else
+    m_file.setFileName(m_target);
+    if (!m_file.open(QIODevice::WriteOnly)) {
+      fail(m_file.errorString());
+    }
+#endif
+  }
+
+  void fail(const QString& error)
+  {
+    m_error = error;
+    m_failed = true;
+  }
+
+  // only accessed on the worker thread
+  StreamDigest m_digest;
+  const QString m_target;
+  QFile m_file;
+  QString m_error;
+
+  std::atomic<bool> m_failed{false};
+
+  // guarded by m_mutex
+  std::mutex m_mutex;
+  std::condition_variable m_condition;
+  std::deque<QByteArray> m_queue;
+  qint64 m_queuedBytes = 0;
+  Finished m_finished;
+};
+
+/**
+ * Receives the data of a download, feeds the digests and passes it on to the sink.
+ */
+class FetchClient : public CefURLRequestClient
+{
+public:
+  FetchClient(int id, const QString& url, const DownloadManager::Options& options, DownloadManager::Done done,
+              std::shared_ptr<DownloadManager> manager)
+    : m_id(id)
+    , m_url(url)
+    , m_options(options)
+    , m_done(done)
+    , m_manager(manager)
+  {}
+
+  void start(CefRefPtr<CefRequestContext> requestContext)
+  {
+    m_start = now();
+    const bool stream = m_options.sink == DownloadManager::Stream;
+    if (stream || !m_options.digests.isEmpty()) {
+      m_worker = DownloadWorker::start(m_options.digests, stream ? m_options.target : QString());
+    }
+
+    auto request = CefRequest::Create();
+    request->SetURL(m_url.toStdString());
+    request->SetMethod("GET");
+    // use the cookies of the page, like downloads started by it
+    request->SetFlags(UR_FLAG_ALLOW_CACHED_CREDENTIALS);
+    m_urlRequest = CefURLRequest::Create(request, this, requestContext);
+  }
+
+  void OnRequestComplete(CefRefPtr<CefURLRequest> request) override
+  {
+    const auto response = request->GetResponse();
+    QJsonObject result = {
+      {QStringLiteral("id"), m_id},
+      {QStringLiteral("url"), m_url},
+      {QStringLiteral("status"), response ? response->GetStatus() : 0},
+      {QStringLiteral("mimeType"), response ? QString::fromStdString(response->GetMimeType()) : QString()},
+      {QStringLiteral("size"), static_cast<double>(m_size)},
+      {QStringLiteral("time"), now() - m_start},
+      {QStringLiteral("digests"), QJsonObject()}
+    };
+
+    QString error = m_error;
+    if (error.isEmpty() && request->GetRequestStatus() != UR_SUCCESS) {
+      error = QStringLiteral("Download of %1 failed with error %2.").arg(m_url).arg(request->GetRequestError());
+    } else if (error.isEmpty() && response && response->GetStatus() >= 400) {
+      error = QStringLiteral("Download of %1 failed with HTTP status %2.").arg(m_url).arg(response->GetStatus());
+    }
+
+    if (m_options.sink == DownloadManager::Memory) {
+      result[QStringLiteral("data")] = QString::fromLatin1(m_data.toBase64());
+      m_data.clear();
+    } else if (m_options.sink == DownloadManager::Stream) {
+      result[QStringLiteral("target")] = m_options.target;
+    }
+    if (!m_worker) {
+      finish(result, error);
+      return;
+    }
+
+    // wait for the worker to hash and write the remaining data
+    CefRefPtr<FetchClient> self(this);
+    m_worker->finish([self, result, error] (const QJsonObject& digests, const QString& workerError) {
+      CefPostTask(TID_UI, makeTask([self, result, error, digests, workerError] () {
+        auto completeResult = result;
+        completeResult[QStringLiteral("digests")] = digests;
+        // a failed target cancels the request, its error explains why
+        self->finish(completeResult, workerError.isEmpty()
+                                       ? error
+                                       : QStringLiteral("Failed to write %1: %2").arg(self->m_options.target, workerError));
+      }));
+    });
+  }
+
+  void OnUploadProgress(CefRefPtr<CefURLRequest> /*request*/, int64 /*current*/, int64 /*total*/) override
+  {
+  }
+
+  void OnDownloadProgress(CefRefPtr<CefURLRequest> /*request*/, int64 /*current*/, int64 /*total*/) override
+  {
+  }
+
+  void OnDownloadData(CefRefPtr<CefURLRequest> request, const void* data, size_t data_length) override
+  {
+    if (!m_error.isEmpty()) {
+      return;
+    }
+    const auto bytes = static_cast<const char*>(data);
+    m_size += data_length;
+
+    if (m_worker && m_worker->failed()) {
+      // the target can't be written, the worker reports why once the request completed
+      request->Cancel();
+      return;
+    }
+
+    if (m_options.sink == DownloadManager::Memory) {
+      if (m_size > m_options.maxSize) {
+        m_error = QStringLiteral("Download of %1 exceeds the maximum size of %2 bytes.").arg(m_url).arg(m_options.maxSize);
+        m_data.clear();
+        request->Cancel();
+        return;
+      }
+      m_data.append(bytes, static_cast<int>(data_length));
+    }
+    if (m_worker && !m_worker->add(bytes, data_length)) {
+      m_error = QStringLiteral("Download of %1 was cancelled, %2 MB are queued for a target that isn't read fast enough.")
+                  .arg(m_url).arg(DownloadWorker::MAX_QUEUED_BYTES / (1024 * 1024));
+      m_data.clear();
+      request->Cancel();
+    }
+  }
+
+  bool GetAuthCredentials(bool /*isProxy*/, const CefString& /*host*/, int /*port*/, const CefString& /*realm*/,
+                          const CefString& /*scheme*/, CefRefPtr<CefAuthCallback> /*callback*/) override
+  {
+    return false;
+  }
+
+private:
+  void finish(const QJsonObject& result, const QString& error)
+  {
+    qCDebug(network) << "download finished" << result << error;
+    m_manager->finished(m_id, error.isEmpty());
+    m_done(result, error);
+    // break the reference cycle with the url request
+    m_urlRequest = nullptr;
+    m_worker.reset();
+  }
+
+  int m_id;
+  QString m_url;
+  DownloadManager::Options m_options;
+  DownloadManager::Done m_done;
+  std::shared_ptr<DownloadManager> m_manager;
+  CefRefPtr<CefURLRequest> m_urlRequest;
+  std::shared_ptr<DownloadWorker> m_worker;
+  QByteArray m_data;
+  qint64 m_size = 0;
+  double m_start = 0;
+  QString m_error;
+  IMPLEMENT_REFCOUNTING(FetchClient);
+};
+}
+
+std::shared_ptr<DownloadManager> DownloadManager::create(CefRefPtr<CefCommandLine> commandLine)
+{
+  int maxConcurrent = 4;
+  if (commandLine->HasSwitch("max-concurrent-downloads")) {
+    bool ok = false;
+    maxConcurrent = QString::fromStdString(commandLine->GetSwitchValue("max-concurrent-downloads")).toInt(&ok);
+    if (!ok || maxConcurrent < 1) {
+      qCWarning(network) << "invalid --max-concurrent-downloads, using 4";
+      maxConcurrent = 4;
+    }
+  }
+  return std::make_shared<DownloadManager>(maxConcurrent);
+}
+
+DownloadManager::DownloadManager(int maxConcurrent)
+  : m_maxConcurrent(maxConcurrent)
+{
+}
+
+int DownloadManager::maxConcurrent() const
+{
+  return m_maxConcurrent;
+}
+
+void DownloadManager::setMaxConcurrent(int maxConcurrent)
+{
+  m_maxConcurrent = std::max(1, maxConcurrent);
+  startNext();
+}
+
+int DownloadManager::enqueue(std::function<void(int id)> start)
+{
+  CEF_REQUIRE_UI_THREAD();
+
+  const int id = m_nextId++;
+  m_queue.enqueue({id, start});
+  startNext();
+  return id;
+}
+
+void DownloadManager::finished(int id, bool success)
+{
+  CEF_REQUIRE_UI_THREAD();
+
+  qCDebug(network) << "download" << id << "finished" << success;
+  --m_running;
+  if (success) {
+    ++m_completed;
+  } else {
+    ++m_failed;
+  }
+  startNext();
+}
+
+int DownloadManager::fetch(CefRefPtr<CefRequestContext> requestContext, const QString& url, const Options& options, Done done)
+{
+  auto self = shared_from_this();
+  return enqueue([self, requestContext, url, options, done] (int id) {
+    CefRefPtr<FetchClient> client = new FetchClient(id, url, options, done, self);
+    client->start(requestContext);
+  });
+}
+
+QJsonObject DownloadManager::statistics() const
+{
+  return {
+    {QStringLiteral("maxConcurrent"), m_maxConcurrent},
+    {QStringLiteral("running"), m_running},
+    {QStringLiteral("queued"), m_queue.size()},
+    {QStringLiteral("completed"), m_completed},
+    {QStringLiteral("failed"), m_failed}
+  };
+}
+
+void DownloadManager::startNext()
+{
+  while (m_running < m_maxConcurrent && !m_queue.isEmpty()) {
+    const auto pending = m_queue.dequeue();
+    ++m_running;
+    pending.start(pending.id);
+  }
+}
@@ -0,0 +1,88 @@
+// Copyright (c) 2015 Klaralvdalens Datakonsult AB (KDAB).
+// All rights reserved. Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#ifndef PHANTOMJS_DOWNLOADS_H
+#define PHANTOMJS_DOWNLOADS_H
+
+#include <QJsonObject>
+#include <QQueue>
+#include <QStringList>
+
+#include <functional>
+#include <memory>
+
+#include "include/cef_command_line.h"
+#include "include/cef_request_context.h"
+
+/**
+ * Schedules the downloads started by scripts.
+ *
+ * Every download gets its own id and at most maxConcurrent() downloads run
+ * at the same time, further ones are queued. Besides files written by the
+ * CEF download machinery, downloads can be streamed into memory or into an
+ * arbitrary path, e.g. a named pipe, while computing digests on the fly.
+ *
+ * The concurrency limit is configured via --max-concurrent-downloads=<n>,
+ * the default is 4.
+ *
+ * All methods are called on the CEF UI thread.
+ */
+class DownloadManager : public std::enable_shared_from_this<DownloadManager>
+{
+public:
+  enum Sink
+  {
+    // written to disk by CEF, see enqueue
+    File,
+    // kept in memory and returned to the script
+    Memory,
+    // written to the target path as the data arrives
+    Stream
+  };
+
+  struct Options
+  {
+    Sink sink = File;
+    QString target;
+    QStringList digests;
+    // downloads into memory fail when they get larger
+    qint64 maxSize = 256 * 1024 * 1024;
+  };
+
+  using Done = std::function<void(const QJsonObject& result, const QString& error)>;
+
+  static std::shared_ptr<DownloadManager> create(CefRefPtr<CefCommandLine> commandLine);
+
+  explicit DownloadManager(int maxConcurrent);
+
+  int maxConcurrent() const;
+  void setMaxConcurrent(int maxConcurrent);
+
+  // queues @p start, which must call finished with the returned id once the download is over
+  int enqueue(std::function<void(int id)> start);
+  void finished(int id, bool success);
+
+  // downloads @p url via the request context into memory or a stream, @p done is called with the result
+  int fetch(CefRefPtr<CefRequestContext> requestContext, const QString& url, const Options& options, Done done);
+
+  // running, queued, completed and failed downloads
+  QJsonObject statistics() const;
+
+private:
+  void startNext();
+
+  struct Pending
+  {
+    int id;
+    std::function<void(int id)> start;
+  };
+  QQueue<Pending> m_queue;
+  int m_maxConcurrent;
+  int m_running = 0;
+  int m_nextId = 1;
+  int m_completed = 0;
+  int m_failed = 0;
+};
+
+#endif // PHANTOMJS_DOWNLOADS_H
@@ -0,0 +1,64 @@
+// Measures how responsive a script stays during heavy file I/O, used by scripts/fs_benchmark.sh
+// usage: phantomjs fs_async.js <sync|async> [file size in MB] [copies]
+var fs = require('fs');
+var system = require('system');
+var mode = system.args[1] || 'async';
+var megabytes = parseInt(system.args[2]) || 256;
+var copies = parseInt(system.args[3]) || 8;
+
+var dir = fs.tempPath() + '/phantomjs_fs_benchmark';
+fs.makeTree(dir);
+var source = dir + '/source';
+var chunk = new Array(1024 * 1024 + 1).join('x');
+var out = fs.open(source, 'w');
+for (var i = 0; i < megabytes; ++i) {
+  out.write(chunk);
+}
+out.close();
+
+// a timer that should fire every 10ms, its lag shows how long the script was blocked
+var ticks = 0;
+var maxLag = 0;
+var last = Date.now();
+var timer = setInterval(function() {
+  var now = Date.now();
+  maxLag = Math.max(maxLag, now - last - 10);
+  last = now;
+  ++ticks;
+}, 10);
+
+function copySync(n) {
+  return new Promise(function(resolve) {
+    setTimeout(function() {
+      fs.copy(source, dir + '/copy' + n);
+      resolve();
+    }, 0);
+  });
+}
+
+function copyAsync(n) {
+  return fs.promises.copy(source, dir + '/copy' + n);
+}
+
+var start = Date.now();
+var copy = mode === 'sync' ? copySync : copyAsync;
+var done = Promise.resolve();
+for (var n = 0; n < copies; ++n) {
+  done = done.then(copy.bind(null, n));
+}
+done.then(function() {
+  var elapsed = Date.now() - start;
+  clearInterval(timer);
+  fs.remove(dir);
+  console.log('FS ' + JSON.stringify({
+    mode: mode,
+    ms: elapsed,
+    megabytesPerSecond: megabytes * copies * 1000 / elapsed,
+    ticks: ticks,
+    maxLagMs: maxLag
+  }));
+  phantom.exit();
+}, function(error) {
+  console.log(error);
+  phantom.exit(1);
+});
@@ -0,0 +1,45 @@
+// Measures the throughput of fs.hash and phantom.hash, used by scripts/hash_benchmark.sh
+// usage: phantomjs hash.js [file size in MB] [algorithms...]
+var fs = require('fs');
+var system = require('system');
+var megabytes = parseInt(system.args[1]) || 512;
+var algorithms = system.args.slice(2);
+if (!algorithms.length) {
+  algorithms = ["xxh3", "crc32c", "sha256", "xxh64", "md5"];
+}
+
+var path = fs.tempPath() + '/phantomjs_hash_benchmark';
+var chunk = new Uint8Array(1024 * 1024);
+for (var i = 0; i < chunk.length; ++i) {
+  chunk[i] = (i * 2654435761) >>> 24;
+}
+var out = fs.open(path, 'wb');
+for (var n = 0; n < megabytes; ++n) {
+  out.writeBinary(chunk);
+}
+out.close();
+
+// a string that stays in memory, to measure phantom.hash without disk I/O
+var text = new Array(16 * 1024 * 1024 / 64 + 1).join("0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef");
+
+algorithms.forEach(function(algorithm) {
+  // warm up the page cache
+  fs.hash(path, algorithm);
+  var start = Date.now();
+  var digest = fs.hash(path, algorithm);
+  var fileMs = Math.max(1, Date.now() - start);
+
+  start = Date.now();
+  phantom.hash(text, algorithm);
+  var bufferMs = Math.max(1, Date.now() - start);
+
+  console.log('HASH ' + JSON.stringify({
+    algorithm: algorithm,
+    digest: digest,
+    fileMegabytesPerSecond: megabytes * 1000 / fileMs,
+    stringMegabytesPerSecond: 16 * 1000 / bufferMs
+  }));
+});
+
+fs.remove(path);
+phantom.exit();
@@ -0,0 +1,41 @@
+// Measures the overhead of calling into the native functions, used by scripts/native_benchmark.sh
+// usage: phantomjs native_calls.js [milliseconds per function]
+var fs = require('fs');
+var system = require('system');
+var duration = parseInt(system.args[1]) || 2000;
+
+var existing = fs.tempPath();
+var missing = existing + '/phantomjs_native_benchmark_missing';
+
+// trivial natives, the cost is dominated by the bridge between V8 and the renderer process
+var calls = {
+  exists: function() { return fs.exists(existing); },
+  existsMissing: function() { return fs.exists(missing); },
+  isDirectory: function() { return fs.isDirectory(existing); },
+  tempPath: function() { return fs.tempPath(); }
+};
+
+Object.keys(calls).forEach(function(name) {
+  var call = calls[name];
+  // warm up
+  for (var i = 0; i < 1000; ++i) {
+    call();
+  }
+  var count = 0;
+  var start = Date.now();
+  var elapsed = 0;
+  while (elapsed < duration) {
+    for (var j = 0; j < 1000; ++j) {
+      call();
+    }
+    count += 1000;
+    elapsed = Date.now() - start;
+  }
+  console.log('NATIVE ' + JSON.stringify({
+    name: name,
+    calls: count,
+    callsPerSecond: count * 1000 / elapsed
+  }));
+});
+
+phantom.exit();
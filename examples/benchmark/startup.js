@@ -0,0 +1,24 @@
+// Measures the cold start of phantomjs, used by scripts/startup_benchmark.sh
+// usage: phantomjs startup.js <launch time in ms since epoch> [url]
+var firstStatement = Date.now();
+var system = require('system');
+// without an explicit launch time, fall back to the start of the browser process
+var launch = parseFloat(system.args[1]) || firstStatement - (phantom.startupTimings.bootstrapExecuted || 0);
+var url = system.args[2] || 'about:blank';
+
+var page = require('webpage').create();
+page.open(url)
+  .then(function() {
+    var result = {
+      firstStatement: firstStatement - launch,
+      firstPageLoad: Date.now() - launch,
+      startupTimings: phantom.startupTimings
+    };
+    console.log('STARTUP ' + JSON.stringify(result));
+  })
+  .catch(function(error) {
+    console.log('failed to load ' + url + ': ' + error);
+  })
+  .then(function() {
+    phantom.exit();
+  });
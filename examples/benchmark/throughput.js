@@ -0,0 +1,29 @@
+// Measures page throughput, used by scripts/preset_benchmark.sh
+// usage: phantomjs throughput.js <url> [number of page loads]
+var system = require('system');
+var url = system.args[1];
+var count = parseInt(system.args[2]) || 20;
+
+var page = require('webpage').create();
+var start = Date.now();
+var loaded = 0;
+var failed = 0;
+
+function next() {
+  if (loaded + failed >= count) {
+    var elapsed = Date.now() - start;
+    console.log('THROUGHPUT ' + JSON.stringify({
+      pages: loaded,
+      failed: failed,
+      ms: elapsed,
+      pagesPerSecond: loaded * 1000 / elapsed
+    }));
+    phantom.exit();
+    return;
+  }
+  page.open(url)
+    .then(function() { ++loaded; }, function() { ++failed; })
+    .then(next);
+}
+
+next();
@@ -0,0 +1,30 @@
+var fs = require('fs');
+
+// writes a JSONL file compressed on the fly and reads the records back
+var codec = require('system').args[1] || 'gzip';
+var output = fs.tempPath() + "/phantomjs_records.jsonl." + (codec === 'zstd' ? 'zst' : 'gz');
+var records = 100000;
+
+var start = Date.now();
+var writer = fs.openCompressed(output, {mode: 'w', codec: codec});
+for (var i = 0; i < records; ++i) {
+  writer.writeLine(JSON.stringify({id: i, url: "http://example.com/page/" + i, status: 200}));
+}
+if (!writer.close()) {
+  console.log("failed to write " + output);
+  phantom.exit(1);
+}
+console.log("wrote " + records + " records in " + (Date.now() - start) + "ms, " + fs.size(output) + " bytes");
+
+var reader = fs.openCompressed(output, {codec: codec});
+var count = 0;
+while (!reader.atEnd()) {
+  if (JSON.parse(reader.readLine()).id !== count++) {
+    console.log("unexpected record " + (count - 1));
+    phantom.exit(1);
+  }
+}
+console.log("read " + count + " records, " + reader.pos() + " bytes uncompressed");
+reader.close();
+fs.remove(output);
+phantom.exit();
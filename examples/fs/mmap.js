@@ -0,0 +1,19 @@
+var fs = require('fs');
+var system = require('system');
+
+// iterates over a large list of URLs without reading it into a single string first
+var urls = fs.mmap(system.args[1] || 'urls.txt');
+console.log("mapped " + urls.size() + " bytes");
+
+var count = 0;
+var start = Date.now();
+while (!urls.atEnd()) {
+  var url = urls.readLine();
+  if (url.length) {
+    ++count;
+  }
+}
+console.log("read " + count + " URLs in " + (Date.now() - start) + "ms");
+console.log("first bytes: " + urls.slice(0, 64));
+urls.close();
+phantom.exit();
@@ -0,0 +1,48 @@
+var fs = require('fs');
+
+// checks that the results of fs.promises arrive as proper arrays and objects,
+// exits with 1 on the first failure
+var path = fs.tempPath() + "/phantomjs_promises";
+var copyPath = path + "_copy";
+fs.makeTree(path);
+fs.write(path + "/a.txt", "a", "w");
+fs.write(path + "/b.txt", "bb", "w");
+
+function check(condition, message) {
+  if (!condition) {
+    throw new Error(message);
+  }
+}
+
+fs.promises.list(path).then(function(list) {
+  check(Array.isArray(list), "list did not resolve to an array: " + list);
+  check(list.indexOf("a.txt") !== -1 && list.indexOf("b.txt") !== -1, "list misses entries: " + list);
+  return fs.promises.listDetailed(path);
+}).then(function(entries) {
+  check(Array.isArray(entries), "listDetailed did not resolve to an array: " + entries);
+  var b = entries.filter(function(entry) { return entry.name === "b.txt"; })[0];
+  check(b && typeof b === "object", "listDetailed misses b.txt: " + JSON.stringify(entries));
+  check(b.type === "file" && b.size === 2, "unexpected entry: " + JSON.stringify(b));
+  var progress = null;
+  return fs.promises.copy(path, copyPath, {onProgress: function(counts) { progress = counts; }}).then(function(totals) {
+    check(totals && totals.files === 2 && totals.bytes === 3, "unexpected copy totals: " + JSON.stringify(totals));
+    check(progress && progress.files === 2, "unexpected copy progress: " + JSON.stringify(progress));
+    progress = null;
+    return fs.promises.remove(copyPath, {onProgress: function(counts) { progress = counts; }});
+  }).then(function(totals) {
+    check(totals && totals.files === 2 && totals.directories === 1, "unexpected remove totals: " + JSON.stringify(totals));
+    check(progress && progress.files === 2, "unexpected remove progress: " + JSON.stringify(progress));
+    check(!fs.exists(copyPath), "remove left " + copyPath);
+  });
+}).then(function() {
+  console.log("fs.promises results are fine");
+  fs.remove(path);
+  phantom.exit();
+}).catch(function(error) {
+  console.log("FAILED: " + error);
+  fs.remove(path);
+  if (fs.exists(copyPath)) {
+    fs.remove(copyPath);
+  }
+  phantom.exit(1);
+});
@@ -0,0 +1,23 @@
+var fs = require('fs');
+var system = require('system');
+
+// copies the non-empty lines of a (possibly huge) file, holding only one line in memory
+var input = system.args[1] || 'test2.txt';
+var output = fs.tempPath() + "/phantomjs_stream.txt";
+
+var source = fs.open(input, 'r');
+var target = fs.open(output, 'w');
+var lines = 0;
+while (!source.atEnd()) {
+  var line = source.readLine();
+  if (line.length) {
+    target.writeLine(line);
+    ++lines;
+  }
+}
+source.close();
+target.close();
+
+console.log("copied " + lines + " lines, " + fs.size(output) + " bytes to " + output);
+fs.remove(output);
+phantom.exit();
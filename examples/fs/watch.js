@@ -0,0 +1,24 @@
+var fs = require('fs');
+var system = require('system');
+
+// processes the files dropped into a directory as soon as they are completely written
+var dropDirectory = system.args[1] || fs.tempPath() + "/phantomjs_drop";
+fs.makeTree(dropDirectory);
+console.log("watching " + dropDirectory + ", create a file named 'stop' to exit");
+
+var watcher = fs.watch(dropDirectory, {recursive: true, debounce: 200}, function(type, path, message) {
+  if (type === "error") {
+    console.log("watching failed: " + message);
+    phantom.exit(1);
+    return;
+  }
+  if (type === "overflow") {
+    console.log("missed changes, listing " + dropDirectory + " again: " + fs.list(dropDirectory).join(", "));
+    return;
+  }
+  console.log(type + ": " + path);
+  if (path === "stop") {
+    watcher.close();
+    phantom.exit();
+  }
+});
@@ -0,0 +1,21 @@
+var page = require('webpage').create();
+var system = require('system');
+
+var url = system.args[1] || 'http://localhost:8000/';
+
+// roughly a regular 3G connection
+page.settings.networkEmulation = {
+    latency: 100,
+    downloadThroughput: 750 * 1024 / 8,
+    uploadThroughput: 250 * 1024 / 8,
+    failureRate: 0
+};
+
+var start = Date.now();
+page.open(url)
+    .then(function() {
+        console.log("Loaded " + url + " in " + (Date.now() - start) + "ms");
+    }, function(error) {
+        console.log(error);
+    })
+    .then(phantom.exit);
@@ -0,0 +1,20 @@
+var page = require('webpage').create();
+var system = require('system');
+
+// load the text only, everything else is cancelled without a round trip to this script
+page.settings.blockResourceTypes = ["image", "font", "media", "stylesheet", "subframe"];
+
+var url = system.args[1] || 'http://phantomjs.org/';
+var start = Date.now();
+page.open(url)
+    .then(function() {
+        console.log("Loaded " + url + " in " + (Date.now() - start) + "ms");
+        return page.blockStatistics();
+    })
+    .then(function(statistics) {
+        console.log("Blocked " + statistics.requests + " requests, ~" + statistics.estimatedBytes + " bytes");
+        console.log(JSON.stringify(statistics.types));
+    }, function(error) {
+        console.log(error);
+    })
+    .then(phantom.exit);
@@ -0,0 +1,27 @@
+var page = require('webpage').create();
+var fs = require('fs');
+var system = require('system');
+
+var url = system.args[1] || 'http://phantomjs.org/';
+var harFile = fs.tempPath() + '/page.har';
+
+page.startHar(harFile)
+    .then(function() {
+      return page.open(url);
+    })
+    .then(function() {
+      return page.stopHar();
+    })
+    .then(function(summary) {
+      console.log("Wrote " + summary.entries + " entries to " + summary.path);
+      // list the slowest resources
+      var entries = JSON.parse(fs.read(summary.path)).log.entries;
+      entries.sort(function(a, b) { return b.time - a.time; });
+      entries.slice(0, 10).forEach(function(entry) {
+        console.log(Math.round(entry.time) + "ms (wait " + Math.round(entry.timings.wait) + "ms) "
+                    + entry.response.status + " " + entry.request.url);
+      });
+    }, function(err) {
+      console.log("FAIL! " + err);
+    })
+    .then(phantom.exit);
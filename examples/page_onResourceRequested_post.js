@@ -7,13 +7,12 @@ page.onResourceRequested = function(data, request) {
     return;
   } else if (data.method == "POST") {
     console.log("GOT POST REQUEST!");
+    // only the types and sizes of the elements are known upfront
     console.log(JSON.stringify(data.post));
-    for (var i in data.post) {
-      var element = data.post[i];
-      if (element.type == 1) {
-        console.log(i + ": " + atob(data.post[0].bytes));
-      }
-    }
+    // the request is held back until the returned promise settles
+    return request.readPostData().then(function(body) {
+      console.log("body: " + body);
+    });
   }
 };
 
@@ -4,6 +4,10 @@ console.log("Starting to load at: " + (new Date));
 
 page.settings.resourceTimeout = 2000;
 
+page.onResourceTimeout = function(request) {
+    console.log("Timeout of " + request.url + ": " + request.errorString);
+};
+
 // the phantomjs.org website is only reachable without the www.
 // so this should trigger a timeout
 page.open('http://www.phantomjs.org')
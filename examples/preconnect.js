@@ -0,0 +1,36 @@
+var page = require('webpage').create();
+var system = require('system');
+
+var urls = system.args.length > 1 ? system.args.slice(1) : ['http://phantomjs.org/', 'https://www.kdab.com/'];
+
+page.onResourceReceived = function(response) {
+    if (response.stage === "start" && response.afterPreconnect !== undefined) {
+        console.log(response.url + ": after preconnect " + response.afterPreconnect +
+                    ", time to first byte " + Math.round(response.timeToFirstByte) + "ms");
+    }
+};
+
+function openAll(index) {
+    if (index >= urls.length) {
+        return Promise.resolve();
+    }
+    return page.open(urls[index]).then(function() {
+        return openAll(index + 1);
+    });
+}
+
+// warm up all hosts while the first page is still loading
+phantom.preconnect(urls)
+    .then(function(origins) {
+        console.log("preconnecting to " + origins.join(", "));
+        return openAll(0);
+    })
+    .then(function() {
+        return phantom.preconnectStatistics();
+    })
+    .then(function(statistics) {
+        console.log(JSON.stringify(statistics, null, 2));
+    }, function(error) {
+        console.log(error);
+    })
+    .then(phantom.exit);
@@ -0,0 +1,43 @@
+// List the followers of several accounts, loading the next profile while the current one is evaluated
+
+var users = ['PhantomJS',
+        'ariyahidayat',
+        'detronizator',
+        'KDABQt',
+        'lfranchi',
+        'jonleighton',
+        '_jamesmgreene',
+        'Vitalliumm'];
+
+var page = require('webpage').create();
+
+function profileUrl(user) {
+    return 'http://mobile.twitter.com/' + user;
+}
+
+function follow(index) {
+    if (index >= users.length) {
+        return Promise.resolve();
+    }
+    var user = users[index];
+    return page.open(profileUrl(user))
+        .then(function() {
+            if (index + 1 < users.length) {
+                // overlap the network time of the next profile with the extraction of this one
+                page.prefetch(profileUrl(users[index + 1]));
+            }
+            return page.evaluate(function () {
+                return document.querySelector('.UserProfileHeader-statCount').innerText;
+            });
+        })
+        .then(function(data) {
+            console.log(user + ': ' + data);
+        }, function() {
+            console.log(user + ': ?');
+        })
+        .then(function() {
+            return follow(index + 1);
+        });
+}
+
+follow(0).then(phantom.exit);
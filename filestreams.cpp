@@ -0,0 +1,286 @@
+// Copyright (c) 2015 Klaralvdalens Datakonsult AB (KDAB).
+// All rights reserved. Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include "filestreams.h"
+
+#include "debug.h"
+
+#include <cstring>
+#include <limits>
+
+namespace {
+// a QByteArray can't reference more of the mapping at once
+const qint64 MAX_CHUNK = std::numeric_limits<int>::max();
+}
+
+int FileStreams::open(int browserId, const QString& path, const QString& mode, QString* error)
+{
+  QIODevice::OpenMode openMode = QIODevice::NotOpen;
+  const bool update = mode.contains(QLatin1Char('+'));
+  if (mode.contains(QLatin1Char('r'))) {
+    openMode = QIODevice::ReadOnly;
+    if (update || mode.contains(QLatin1Char('w'))) {
+      openMode = QIODevice::ReadWrite;
+    }
+  } else if (mode.contains(QLatin1Char('w'))) {
+    openMode = (update ? QIODevice::ReadWrite : QIODevice::WriteOnly) | QIODevice::Truncate;
+  } else if (mode.contains(QLatin1Char('a'))) {
+    openMode = (update ? QIODevice::ReadWrite : QIODevice::WriteOnly) | QIODevice::Append;
+  } else {
+    *error = QStringLiteral("Unknown open mode \"%1\".").arg(mode);
+    return 0;
+  }
+
+  auto stream = std::make_shared<Stream>();
+  stream->browserId = browserId;
+  stream->binary = mode.contains(QLatin1Char('b'));
+  stream->file.setFileName(path);
+  if (!stream->file.open(openMode)) {
+    *error = QStringLiteral("Failed to open %1: %2").arg(path, stream->file.errorString());
+    return 0;
+  }
+  const int id = m_nextId++;
+  m_streams.insert(id, stream);
+  return id;
+}
+
+int FileStreams::map(int browserId, const QString& path, bool binary, QString* error)
+{
+  auto stream = std::make_shared<Stream>();
+  stream->browserId = browserId;
+  stream->binary = binary;
+  stream->mapped = true;
+  stream->file.setFileName(path);
+  if (!stream->file.open(QIODevice::ReadOnly)) {
+    *error = QStringLiteral("Failed to open %1: %2").arg(path, stream->file.errorString());
+    return 0;
+  }
+  stream->size = stream->file.size();
+  // empty files can't be mapped but are perfectly fine to read
+  if (stream->size > 0) {
+    stream->data = reinterpret_cast<const char*>(stream->file.map(0, stream->size));
+    if (!stream->data) {
+      *error = QStringLiteral("Failed to map %1: %2").arg(path, stream->file.errorString());
+      return 0;
+    }
+  }
+  const int id = m_nextId++;
+  m_streams.insert(id, stream);
+  return id;
+}
+
+int FileStreams::openCompressed(int browserId, const QString& path, const QString& mode, const QString& codec,
+                                int level, QString* error)
+{
+  CompressedFile::Codec compressionCodec;
+  if (!CompressedFile::codecFromName(codec, &compressionCodec)) {
+    *error = QStringLiteral("Unknown compression codec \"%1\".").arg(codec);
+    return 0;
+  }
+  QIODevice::OpenMode openMode = QIODevice::NotOpen;
+  if (mode.contains(QLatin1Char('+'))) {
+    *error = QStringLiteral("Compressed files can't be opened for reading and writing at the same time.");
+    return 0;
+  } else if (mode.contains(QLatin1Char('r'))) {
+    openMode = QIODevice::ReadOnly;
+  } else if (mode.contains(QLatin1Char('w'))) {
+    openMode = QIODevice::WriteOnly | QIODevice::Truncate;
+  } else if (mode.contains(QLatin1Char('a'))) {
+    openMode = QIODevice::WriteOnly | QIODevice::Append;
+  } else {
+    *error = QStringLiteral("Unknown open mode \"%1\".").arg(mode);
+    return 0;
+  }
+
+  auto stream = std::make_shared<Stream>();
+  stream->browserId = browserId;
+  stream->binary = mode.contains(QLatin1Char('b'));
+  stream->compressed = CompressedFile::open(path, compressionCodec, openMode, level, error);
+  if (!stream->compressed) {
+    return 0;
+  }
+  stream->file.setFileName(path);
+  const int id = m_nextId++;
+  m_streams.insert(id, stream);
+  return id;
+}
+
+bool FileStreams::contains(int id) const
+{
+  return m_streams.contains(id);
+}
+
+bool FileStreams::isBinary(int id) const
+{
+  const auto s = stream(id);
+  return s && s->binary;
+}
+
+QByteArray FileStreams::read(int id, qint64 maxSize)
+{
+  const auto s = stream(id);
+  if (!s) {
+    return {};
+  }
+  if (s->compressed) {
+    return s->compressed->read(maxSize);
+  }
+  if (s->mapped) {
+    const auto available = qMin(s->size - s->pos, MAX_CHUNK);
+    const auto size = maxSize < 0 ? available : qMin(maxSize, available);
+    const auto data = QByteArray::fromRawData(s->data + s->pos, static_cast<int>(size));
+    s->pos += size;
+    return data;
+  }
+  if (maxSize < 0) {
+    return s->file.readAll();
+  }
+  return s->file.read(maxSize);
+}
+
+QByteArray FileStreams::readLine(int id)
+{
+  const auto s = stream(id);
+  if (!s) {
+    return {};
+  }
+  if (s->compressed) {
+    return s->compressed->readLine();
+  }
+  if (s->mapped) {
+    const auto begin = s->data + s->pos;
+    // longer lines are returned in pieces of MAX_CHUNK bytes
+    const auto available = qMin(s->size - s->pos, MAX_CHUNK);
+    const auto newline = static_cast<const char*>(memchr(begin, '\n', available));
+    auto end = newline ? newline : begin + available;
+    s->pos = end - s->data + (newline ? 1 : 0);
+    if (newline && end > begin && *(end - 1) == '\r') {
+      --end;
+    }
+    return QByteArray::fromRawData(begin, static_cast<int>(end - begin));
+  }
+  auto line = s->file.readLine();
+  if (line.endsWith('\n')) {
+    line.chop(line.endsWith("\r\n") ? 2 : 1);
+  }
+  return line;
+}
+
+QByteArray FileStreams::slice(int id, qint64 start, qint64 end)
+{
+  const auto s = stream(id);
+  if (!s || s->compressed) {
+    return {};
+  }
+  const auto size = this->size(id);
+  start = qBound<qint64>(0, start, size);
+  end = qBound(start, end < 0 ? size : end, qMin(size, start + MAX_CHUNK));
+  if (s->mapped) {
+    return QByteArray::fromRawData(s->data + start, static_cast<int>(end - start));
+  }
+  const auto pos = s->file.pos();
+  if (!s->file.seek(start)) {
+    return {};
+  }
+  const auto data = s->file.read(end - start);
+  s->file.seek(pos);
+  return data;
+}
+
+qint64 FileStreams::size(int id) const
+{
+  const auto s = stream(id);
+  if (!s || s->compressed) {
+    return -1;
+  }
+  return s->mapped ? s->size : s->file.size();
+}
+
+bool FileStreams::write(int id, const QByteArray& data)
+{
+  const auto s = stream(id);
+  if (s && s->compressed) {
+    return s->compressed->write(data);
+  }
+  return s && !s->mapped && s->file.write(data) == data.size();
+}
+
+bool FileStreams::seek(int id, qint64 pos)
+{
+  const auto s = stream(id);
+  if (s && s->compressed) {
+    return false;
+  }
+  if (s && s->mapped) {
+    if (pos < 0 || pos > s->size) {
+      return false;
+    }
+    s->pos = pos;
+    return true;
+  }
+  return s && s->file.seek(pos);
+}
+
+qint64 FileStreams::pos(int id) const
+{
+  const auto s = stream(id);
+  if (!s) {
+    return -1;
+  }
+  if (s->compressed) {
+    return s->compressed->pos();
+  }
+  return s->mapped ? s->pos : s->file.pos();
+}
+
+bool FileStreams::atEnd(int id) const
+{
+  const auto s = stream(id);
+  if (!s) {
+    return true;
+  }
+  if (s->compressed) {
+    return s->compressed->atEnd();
+  }
+  return s->mapped ? s->pos >= s->size : s->file.atEnd();
+}
+
+QString FileStreams::readError(int id) const
+{
+  const auto s = stream(id);
+  return s && s->compressed ? s->compressed->readError() : QString();
+}
+
+bool FileStreams::flush(int id)
+{
+  const auto s = stream(id);
+  if (s && s->compressed) {
+    return s->compressed->flush();
+  }
+  return s && (s->mapped || s->file.flush());
+}
+
+bool FileStreams::close(int id)
+{
+  const auto s = m_streams.take(id);
+  // compressed writers report errors of the background thread when finishing the stream
+  return !s || !s->compressed || s->compressed->close();
+}
+
+void FileStreams::closeAll(int browserId)
+{
+  for (auto it = m_streams.begin(); it != m_streams.end();) {
+    if (it.value()->browserId == browserId) {
+      qCDebug(app) << "closing stream" << it.value()->file.fileName() << "left open by browser" << browserId;
+      it = m_streams.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+std::shared_ptr<FileStreams::Stream> FileStreams::stream(int id) const
+{
+  return m_streams.value(id);
+}
@@ -0,0 +1,84 @@
+// Copyright (c) 2015 Klaralvdalens Datakonsult AB (KDAB).
+// All rights reserved. Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#ifndef PHANTOMJS_FILESTREAMS_H
+#define PHANTOMJS_FILESTREAMS_H
+
+#include <QByteArray>
+#include <QFile>
+#include <QHash>
+#include <QString>
+
+#include <memory>
+
+#include "compressedfile.h"
+
+/**
+ * The files opened by fs.open in the renderer process.
+ *
+ * Streams are referenced by an id from the script and belong to the browser
+ * that opened them, such that they get closed together with the browser even
+ * if the script forgot to. Reads are buffered by QFile, so reading large files
+ * line by line only keeps a single line in memory.
+ *
+ * Only accessed on the renderer main thread.
+ */
+class FileStreams
+{
+public:
+  // @p mode is a combination of r, w, a, + and b like for fopen
+  // returns the id of the stream or 0 on failure, with @p error set
+  int open(int browserId, const QString& path, const QString& mode, QString* error);
+  // maps the file read-only into memory, reads and lines then don't go through the QFile buffer
+  int map(int browserId, const QString& path, bool binary, QString* error);
+  // opens a gzip or zstd file for reading or writing, @p mode is r, w or a with an optional b
+  // compressed streams are sequential, they can neither seek nor report their size
+  int openCompressed(int browserId, const QString& path, const QString& mode, const QString& codec, int level,
+                     QString* error);
+
+  bool contains(int id) const;
+  bool isBinary(int id) const;
+
+  // for mapped files, the returned data references the mapping and is only valid until close,
+  // at most 2GB are returned at once by read, readLine and slice
+  // reads up to @p maxSize bytes, or everything until the end for negative values
+  QByteArray read(int id, qint64 maxSize);
+  // reads the next line without the line break
+  QByteArray readLine(int id);
+  // the bytes in [@p start, @p end) without changing the position
+  QByteArray slice(int id, qint64 start, qint64 end);
+  qint64 size(int id) const;
+  bool write(int id, const QByteArray& data);
+  bool seek(int id, qint64 pos);
+  qint64 pos(int id) const;
+  bool atEnd(int id) const;
+  // the reason a compressed stream ended early due to corrupt data, empty otherwise
+  QString readError(int id) const;
+  bool flush(int id);
+  // returns false when pending compressed data could not be written
+  bool close(int id);
+  // close all streams that are still opened by the browser
+  void closeAll(int browserId);
+
+private:
+  struct Stream
+  {
+    int browserId;
+    bool binary;
+    QFile file;
+    // set for mapped files, which keep track of the position on their own
+    const char* data = nullptr;
+    qint64 size = 0;
+    qint64 pos = 0;
+    bool mapped = false;
+    // set for compressed files, used instead of the QFile
+    std::unique_ptr<CompressedFile> compressed;
+  };
+  std::shared_ptr<Stream> stream(int id) const;
+
+  QHash<int, std::shared_ptr<Stream>> m_streams;
+  int m_nextId = 1;
+};
+
+#endif // PHANTOMJS_FILESTREAMS_H
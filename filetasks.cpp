@@ -0,0 +1,145 @@
+// Copyright (c) 2015 Klaralvdalens Datakonsult AB (KDAB).
+// All rights reserved. Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include "filetasks.h"
+
+#include <QJsonArray>
+#include <QJsonObject>
+#include <QRunnable>
+
+#include "debug.h"
+#include "task.h"
+
+namespace {
+class WorkRunnable : public QRunnable
+{
+public:
+  WorkRunnable(std::function<void()> work)
+    : m_work(std::move(work))
+  {}
+
+  void run() override
+  {
+    m_work();
+  }
+
+private:
+  std::function<void()> m_work;
+};
+
+CefString toCefString(const QString& string)
+{
+  CefString result;
+  cef_string_utf16_set(reinterpret_cast<const char16*>(string.utf16()), string.size(), result.GetWritableStruct(), true);
+  return result;
+}
+}
+
+CefRefPtr<CefV8Value> toV8(const QJsonValue& value)
+{
+  switch (value.type()) {
+    case QJsonValue::Bool:
+      return CefV8Value::CreateBool(value.toBool());
+    case QJsonValue::Double:
+      return CefV8Value::CreateDouble(value.toDouble());
+    case QJsonValue::String:
+      return CefV8Value::CreateString(toCefString(value.toString()));
+    case QJsonValue::Array: {
+      const auto array = value.toArray();
+      auto result = CefV8Value::CreateArray(array.size());
+      for (int i = 0; i < array.size(); ++i) {
+        result->SetValue(i, toV8(array.at(i)));
+      }
+      return result;
+    }
+    case QJsonValue::Object: {
+      const auto object = value.toObject();
+      auto result = CefV8Value::CreateObject(nullptr);
+      for (auto it = object.begin(); it != object.end(); ++it) {
+        result->SetValue(toCefString(it.key()), toV8(it.value()), V8_PROPERTY_ATTRIBUTE_NONE);
+      }
+      return result;
+    }
+    case QJsonValue::Null:
+      return CefV8Value::CreateNull();
+    case QJsonValue::Undefined:
+      break;
+  }
+  return CefV8Value::CreateUndefined();
+}
+
+FileTasks::FileTasks(int maxThreads)
+{
+  m_pool.setMaxThreadCount(maxThreads);
+}
+
+FileTasks::~FileTasks()
+{
+  m_pool.waitForDone();
+}
+
+void FileTasks::run(CefRefPtr<CefV8Context> context, CefRefPtr<CefV8Value> callback, Work work)
+{
+  run(context, callback, nullptr, [work] (const Progress& /*progress*/, QString* error) {
+    return work(error);
+  });
+}
+
+void FileTasks::run(CefRefPtr<CefV8Context> context, CefRefPtr<CefV8Value> callback,
+                    CefRefPtr<CefV8Value> progressCallback, ProgressWork work)
+{
+  const int id = m_nextId++;
+  Pending pending;
+  pending.context = context;
+  pending.callback = callback;
+  if (progressCallback && progressCallback->IsFunction()) {
+    pending.progressCallback = progressCallback;
+  }
+  m_pending.insert(id, pending);
+
+  m_pool.start(new WorkRunnable([this, id, work] {
+    const Progress progress = [this, id] (const QJsonValue& value) {
+      CefPostTask(TID_RENDERER, makeTask([this, id, value] {
+        this->progress(id, value);
+      }));
+    };
+    QString error;
+    const auto result = work(progress, &error);
+    CefPostTask(TID_RENDERER, makeTask([this, id, result, error] {
+      finished(id, result, error);
+    }));
+  }));
+}
+
+void FileTasks::progress(int id, const QJsonValue& progress)
+{
+  const auto pending = m_pending.value(id);
+  if (!pending.progressCallback || !pending.context->IsValid()) {
+    return;
+  }
+  // posted tasks run outside of any context, V8 can't create arrays or objects there
+  pending.context->Enter();
+  pending.progressCallback->ExecuteFunctionWithContext(pending.context, nullptr, {toV8(progress)});
+  pending.context->Exit();
+}
+
+void FileTasks::finished(int id, const QJsonValue& result, const QString& error)
+{
+  const auto pending = m_pending.take(id);
+  if (!pending.context || !pending.context->IsValid()) {
+    qCDebug(app) << "dropping result of file task" << id << "for released context";
+    return;
+  }
+  pending.context->Enter();
+  CefV8ValueList arguments;
+  if (error.isEmpty()) {
+    arguments.push_back(CefV8Value::CreateNull());
+    arguments.push_back(toV8(result));
+  } else {
+    arguments.push_back(CefV8Value::CreateString(toCefString(error)));
+    arguments.push_back(CefV8Value::CreateUndefined());
+  }
+  pending.callback->ExecuteFunctionWithContext(pending.context, nullptr, arguments);
+  pending.context->Exit();
+}
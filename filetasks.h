@@ -0,0 +1,61 @@
+// Copyright (c) 2015 Klaralvdalens Datakonsult AB (KDAB).
+// All rights reserved. Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#ifndef PHANTOMJS_FILETASKS_H
+#define PHANTOMJS_FILETASKS_H
+
+#include <QHash>
+#include <QJsonValue>
+#include <QThreadPool>
+
+#include <functional>
+
+#include "include/cef_v8.h"
+
+/**
+ * Runs the file operations of fs.promises on a thread pool in the renderer process.
+ *
+ * The work itself must not touch V8. Once it is done, the result is posted back to
+ * the renderer thread where the script callback gets called in its original context,
+ * with an error string or null as first and the result as second argument.
+ *
+ * run is only called on the renderer main thread.
+ */
+class FileTasks
+{
+public:
+  // returns the result of the operation, or sets @p error
+  using Work = std::function<QJsonValue(QString* error)>;
+  // may be called by the work on its thread to report intermediate results
+  using Progress = std::function<void(const QJsonValue& progress)>;
+  using ProgressWork = std::function<QJsonValue(const Progress& progress, QString* error)>;
+
+  explicit FileTasks(int maxThreads = 4);
+  ~FileTasks();
+
+  void run(CefRefPtr<CefV8Context> context, CefRefPtr<CefV8Value> callback, Work work);
+  // @p progressCallback, if it is a function, gets called with every progress reported by @p work
+  void run(CefRefPtr<CefV8Context> context, CefRefPtr<CefV8Value> callback,
+           CefRefPtr<CefV8Value> progressCallback, ProgressWork work);
+
+private:
+  void progress(int id, const QJsonValue& progress);
+  void finished(int id, const QJsonValue& result, const QString& error);
+
+  struct Pending
+  {
+    CefRefPtr<CefV8Context> context;
+    CefRefPtr<CefV8Value> callback;
+    CefRefPtr<CefV8Value> progressCallback;
+  };
+  // the V8 handles stay on the renderer thread, the workers only know the id
+  QHash<int, Pending> m_pending;
+  int m_nextId = 1;
+  QThreadPool m_pool;
+};
+
+// converts JSON into V8 values, only call it on the renderer thread
+CefRefPtr<CefV8Value> toV8(const QJsonValue& value);
+
+#endif // PHANTOMJS_FILETASKS_H
@@ -0,0 +1,541 @@
+// Copyright (c) 2015 Klaralvdalens Datakonsult AB (KDAB).
+// All rights reserved. Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include "filetree.h"
+
+#include <QDateTime>
+#include <QDir>
+#include <QDirIterator>
+#include <QFile>
+#include <QFileInfo>
+#include <QMutex>
+#include <QRegExp>
+#include <QRunnable>
+#include <QThreadPool>
+
+#include <algorithm>
+#include <atomic>
+#include <iterator>
+#include <utility>
+#include <vector>
+
+#ifdef Q_OS_LINUX
+#include <cerrno>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace {
+// shared between the workers of a single copy or remove
+struct Counters
+{
+  std::atomic<qint64> files{0};
+  std::atomic<qint64> directories{0};
+  std::atomic<qint64> symlinks{0};
+  std::atomic<qint64> bytes{0};
+  std::atomic<bool> failed{false};
+  QMutex errorMutex;
+  QString error;
+
+  void fail(const QString& message)
+  {
+    QMutexLocker lock(&errorMutex);
+    if (!failed.exchange(true)) {
+      error = message;
+    }
+  }
+
+  QJsonObject toJson() const
+  {
+    return {
+      {QStringLiteral("files"), files.load()},
+      {QStringLiteral("directories"), directories.load()},
+      {QStringLiteral("symlinks"), symlinks.load()},
+      {QStringLiteral("bytes"), bytes.load()}
+    };
+  }
+};
+
+class FunctionRunnable : public QRunnable
+{
+public:
+  FunctionRunnable(std::function<void()> function)
+    : m_function(std::move(function))
+  {}
+
+  void run() override
+  {
+    m_function();
+  }
+
+private:
+  std::function<void()> m_function;
+};
+
+// waits for the workers while reporting the progress on the calling thread,
+// the final totals are reported also when the work took less than 100ms
+void waitForDone(QThreadPool* pool, const Counters& counters, const TreeOptions& options)
+{
+  while (!pool->waitForDone(100)) {
+    if (options.progress) {
+      options.progress(counters.toJson());
+    }
+  }
+  if (options.progress) {
+    options.progress(counters.toJson());
+  }
+}
+
+#ifdef Q_OS_LINUX
+QString systemError(const QString& action, const QString& path)
+{
+  return QStringLiteral("Failed to %1 %2: %3").arg(action, path, QString::fromLocal8Bit(strerror(errno)));
+}
+
+bool writeAll(int fd, const char* data, ssize_t size)
+{
+  while (size > 0) {
+    const auto written = ::write(fd, data, size);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    data += written;
+    size -= written;
+  }
+  return true;
+}
+#endif
+
+bool copyFile(const QString& source, const QString& target, bool overwrite, Counters* counters)
+{
+#ifdef Q_OS_LINUX
+  // opening a fifo for reading would block until a writer shows up, the file type is checked right after
+  const int in = ::open(QFile::encodeName(source).constData(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+  if (in < 0) {
+    counters->fail(systemError(QStringLiteral("open"), source));
+    return false;
+  }
+  struct stat info;
+  if (fstat(in, &info) != 0) {
+    counters->fail(systemError(QStringLiteral("stat"), source));
+    ::close(in);
+    return false;
+  }
+  if (!S_ISREG(info.st_mode)) {
+    // fifos, sockets and devices are skipped like in directory copies
+    ::close(in);
+    return false;
+  }
+  const int out = ::open(QFile::encodeName(target).constData(),
+                         O_WRONLY | O_CREAT | (overwrite ? O_TRUNC : O_EXCL) | O_CLOEXEC, info.st_mode & 07777);
+  if (out < 0) {
+    counters->fail(systemError(QStringLiteral("create"), target));
+    ::close(in);
+    return false;
+  }
+
+  bool done = false;
+#ifdef FICLONE
+  // shares the extents on copy-on-write file systems such as btrfs or xfs
+  if (ioctl(out, FICLONE, in) == 0) {
+    counters->bytes += info.st_size;
+    done = true;
+  }
+#endif
+#ifdef __NR_copy_file_range
+  // copies inside the kernel without a round trip through user space,
+  // fails e.g. across file systems on older kernels where we fall back to read/write below
+  while (!done) {
+    const auto copied = syscall(__NR_copy_file_range, in, nullptr, out, nullptr, 1 << 30, 0);
+    if (copied < 0) {
+      break;
+    } else if (copied == 0) {
+      done = true;
+    }
+    counters->bytes += copied;
+  }
+#endif
+  // both offsets are still where a failed copy_file_range left them
+  std::vector<char> buffer;
+  while (!done) {
+    buffer.resize(1024 * 1024);
+    const auto size = ::read(in, buffer.data(), buffer.size());
+    if (size < 0 && errno == EINTR) {
+      continue;
+    } else if (size < 0) {
+      counters->fail(systemError(QStringLiteral("read"), source));
+      break;
+    } else if (size == 0) {
+      done = true;
+    } else if (!writeAll(out, buffer.data(), size)) {
+      counters->fail(systemError(QStringLiteral("write"), target));
+      break;
+    }
+    counters->bytes += size;
+  }
+
+  ::close(in);
+  if (::close(out) != 0 && done) {
+    counters->fail(systemError(QStringLiteral("write"), target));
+    done = false;
+  }
+  if (done) {
+    ++counters->files;
+  }
+  return done;
+#else
+  if (!QFileInfo(source).isFile()) {
+    return false;
+  }
+  if (overwrite && QFile::exists(target)) {
+    QFile::remove(target);
+  }
+  QFile file(source);
+  if (!file.copy(target)) {
+    counters->fail(QStringLiteral("Failed to copy %1: %2").arg(source, file.errorString()));
+    return false;
+  }
+  ++counters->files;
+  counters->bytes += file.size();
+  return true;
+#endif
+}
+
+// the target of the link as stored, i.e. relative links stay relative
+QString linkTarget(const QString& path)
+{
+#ifdef Q_OS_LINUX
+  QByteArray buffer(4096, Qt::Uninitialized);
+  const auto size = readlink(QFile::encodeName(path).constData(), buffer.data(), buffer.size());
+  if (size >= 0) {
+    return QFile::decodeName(buffer.left(size));
+  }
+#endif
+  return QFileInfo(path).symLinkTarget();
+}
+
+bool copySymlink(const QString& source, const QString& target, bool overwrite, Counters* counters)
+{
+  if (overwrite) {
+    QFile::remove(target);
+  }
+  if (!QFile::link(linkTarget(source), target)) {
+    counters->fail(QStringLiteral("Failed to create the symbolic link %1").arg(target));
+    return false;
+  }
+  ++counters->symlinks;
+  return true;
+}
+
+// collects the entries found by the parallel scans of listTree
+struct Listing
+{
+  // entries by name, which the result is sorted by
+  using Entries = std::vector<std::pair<QString, QJsonObject>>;
+  QMutex mutex;
+  Entries entries;
+  QString error;
+
+  void add(Entries* entries)
+  {
+    QMutexLocker lock(&mutex);
+    std::move(entries->begin(), entries->end(), std::back_inserter(this->entries));
+  }
+
+  void fail(const QString& message)
+  {
+    QMutexLocker lock(&mutex);
+    if (error.isEmpty()) {
+      error = message;
+    }
+  }
+};
+
+QJsonObject listEntry(const QString& name, const char* type, qint64 size, qint64 mtime, int mode)
+{
+  return {
+    {QStringLiteral("name"), name},
+    {QStringLiteral("type"), QLatin1String(type)},
+    {QStringLiteral("size"), size},
+    {QStringLiteral("mtime"), mtime},
+    {QStringLiteral("mode"), mode}
+  };
+}
+
+#ifndef Q_OS_LINUX
+int permissionBits(QFile::Permissions permissions)
+{
+  int mode = 0;
+  const QFile::Permission bits[] = {
+    QFile::ReadOwner, QFile::WriteOwner, QFile::ExeOwner,
+    QFile::ReadGroup, QFile::WriteGroup, QFile::ExeGroup,
+    QFile::ReadOther, QFile::WriteOther, QFile::ExeOther
+  };
+  for (const auto bit : bits) {
+    mode = (mode << 1) | (permissions.testFlag(bit) ? 1 : 0);
+  }
+  return mode;
+}
+#endif
+
+#ifdef Q_OS_LINUX
+// the type, mode, size and mtime of @p name in the directory @p dirFd, without following symlinks
+bool statEntry(int dirFd, const char* name, struct stat* info)
+{
+#ifdef STATX_TYPE
+  // only asks for the fields of the listing, which spares e.g. network file systems the others,
+  // glibc falls back to fstatat on kernels without statx
+  struct statx extended;
+  if (statx(dirFd, name, AT_SYMLINK_NOFOLLOW, STATX_TYPE | STATX_MODE | STATX_SIZE | STATX_MTIME, &extended) != 0) {
+    return false;
+  }
+  memset(info, 0, sizeof(*info));
+  info->st_mode = extended.stx_mode;
+  info->st_size = static_cast<off_t>(extended.stx_size);
+  info->st_mtim.tv_sec = extended.stx_mtime.tv_sec;
+  info->st_mtim.tv_nsec = extended.stx_mtime.tv_nsec;
+  return true;
+#else
+  return fstatat(dirFd, name, info, AT_SYMLINK_NOFOLLOW) == 0;
+#endif
+}
+#endif
+
+// scans a single directory, subdirectories are scanned by further tasks on @p pool
+void scanDirectory(const QString& root, const QString& relative, const ListOptions& options,
+                   Listing* listing, QThreadPool* pool)
+{
+  const auto path = relative.isEmpty() ? root : root + QLatin1Char('/') + relative;
+  const auto prefix = relative.isEmpty() ? QString() : relative + QLatin1Char('/');
+  // QRegExp is not thread safe, every task uses its own copy
+  const QRegExp glob(options.glob, Qt::CaseSensitive, QRegExp::Wildcard);
+  Listing::Entries entries;
+  std::vector<QString> subdirectories;
+
+#ifdef Q_OS_LINUX
+  DIR* dir = opendir(QFile::encodeName(path).constData());
+  if (!dir) {
+    listing->fail(systemError(QStringLiteral("open"), path));
+    return;
+  }
+  const int fd = dirfd(dir);
+  while (const auto entry = readdir(dir)) {
+    if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, "..")) {
+      continue;
+    }
+    struct stat info;
+    if (!statEntry(fd, entry->d_name, &info)) {
+      // removed in the meantime
+      continue;
+    }
+    const auto name = prefix + QFile::decodeName(entry->d_name);
+    const char* type = "other";
+    if (S_ISREG(info.st_mode)) {
+      type = "file";
+    } else if (S_ISDIR(info.st_mode)) {
+      type = "directory";
+      subdirectories.push_back(name);
+    } else if (S_ISLNK(info.st_mode)) {
+      type = "symlink";
+    }
+    if (options.glob.isEmpty() || glob.exactMatch(QFile::decodeName(entry->d_name))) {
+      const qint64 mtime = static_cast<qint64>(info.st_mtim.tv_sec) * 1000 + info.st_mtim.tv_nsec / 1000000;
+      entries.emplace_back(name, listEntry(name, type, info.st_size, mtime, info.st_mode & 07777));
+    }
+  }
+  closedir(dir);
+#else
+  const QDir dir(path);
+  if (!dir.exists()) {
+    listing->fail(QStringLiteral("Failed to open %1").arg(path));
+    return;
+  }
+  foreach (const auto& info, dir.entryInfoList(QDir::NoDotAndDotDot | QDir::AllEntries | QDir::Hidden | QDir::System)) {
+    const auto name = prefix + info.fileName();
+    const char* type = "other";
+    if (info.isSymLink()) {
+      type = "symlink";
+    } else if (info.isDir()) {
+      type = "directory";
+      subdirectories.push_back(name);
+    } else if (info.isFile()) {
+      type = "file";
+    }
+    if (options.glob.isEmpty() || glob.exactMatch(info.fileName())) {
+      entries.emplace_back(name, listEntry(name, type, info.size(), info.lastModified().toMSecsSinceEpoch(),
+                                           permissionBits(info.permissions())));
+    }
+  }
+#endif
+
+  listing->add(&entries);
+  if (options.recursive) {
+    for (const auto& subdirectory : subdirectories) {
+      pool->start(new FunctionRunnable([root, subdirectory, options, listing, pool] {
+        scanDirectory(root, subdirectory, options, listing, pool);
+      }));
+    }
+  }
+}
+}
+
+QJsonObject copyTree(const QString& source, const QString& target, const TreeOptions& options, QString* error)
+{
+  Counters counters;
+  const QFileInfo sourceInfo(source);
+  if (!sourceInfo.exists() && !sourceInfo.isSymLink()) {
+    *error = QStringLiteral("%1 does not exist").arg(source);
+    return {};
+  }
+
+  if (!sourceInfo.isDir() || sourceInfo.isSymLink()) {
+    auto targetPath = target;
+    if (QFileInfo(target).isDir()) {
+      targetPath += QLatin1Char('/') + sourceInfo.fileName();
+    }
+    if (sourceInfo.isSymLink()) {
+      if (options.preserveSymlinks) {
+        copySymlink(source, targetPath, options.overwrite, &counters);
+      }
+    } else if (!sourceInfo.isFile()) {
+      *error = QStringLiteral("%1 is not a regular file").arg(source);
+      return {};
+    } else {
+      copyFile(source, targetPath, options.overwrite, &counters);
+    }
+    *error = counters.error;
+    return counters.toJson();
+  }
+
+  if (!QDir().mkpath(target)) {
+    *error = QStringLiteral("Failed to create %1").arg(target);
+    return {};
+  }
+
+  // the walk only reads metadata and creates the directories, the file contents are copied by the pool
+  QThreadPool pool;
+  pool.setMaxThreadCount(std::max(1, options.threads));
+  const QDir sourceDir(source);
+  QDirIterator it(source, QDir::NoDotAndDotDot | QDir::AllEntries | QDir::Hidden | QDir::System,
+                  QDirIterator::Subdirectories);
+  while (it.hasNext() && !counters.failed) {
+    const auto path = it.next();
+    const auto info = it.fileInfo();
+    const auto targetPath = target + QLatin1Char('/') + sourceDir.relativeFilePath(path);
+    const bool overwrite = options.overwrite;
+    if (info.isSymLink()) {
+      if (options.preserveSymlinks) {
+        pool.start(new FunctionRunnable([path, targetPath, overwrite, &counters] {
+          copySymlink(path, targetPath, overwrite, &counters);
+        }));
+      }
+    } else if (info.isDir()) {
+      if (!QDir().mkpath(targetPath)) {
+        counters.fail(QStringLiteral("Failed to create %1").arg(targetPath));
+      }
+      ++counters.directories;
+    } else if (info.isFile()) {
+      pool.start(new FunctionRunnable([path, targetPath, overwrite, &counters] {
+        if (!counters.failed) {
+          copyFile(path, targetPath, overwrite, &counters);
+        }
+      }));
+    }
+    // fifos, sockets and devices are listed due to QDir::System, which is needed for broken symlinks
+  }
+  waitForDone(&pool, counters, options);
+
+  *error = counters.error;
+  return counters.toJson();
+}
+
+QJsonObject removeTree(const QString& path, const TreeOptions& options, QString* error)
+{
+  Counters counters;
+  const QFileInfo info(path);
+  if (!info.isDir() || info.isSymLink()) {
+    if (!QFile::remove(path)) {
+      *error = QStringLiteral("Failed to remove %1").arg(path);
+      return {};
+    }
+    ++(info.isSymLink() ? counters.symlinks : counters.files);
+    counters.bytes += info.isSymLink() ? 0 : info.size();
+    return counters.toJson();
+  }
+
+  QThreadPool pool;
+  pool.setMaxThreadCount(std::max(1, options.threads));
+  QStringList directories;
+  QDirIterator it(path, QDir::NoDotAndDotDot | QDir::AllEntries | QDir::Hidden | QDir::System,
+                  QDirIterator::Subdirectories);
+  while (it.hasNext() && !counters.failed) {
+    const auto entry = it.next();
+    const auto entryInfo = it.fileInfo();
+    if (entryInfo.isDir() && !entryInfo.isSymLink()) {
+      directories << entry;
+      continue;
+    }
+    const bool symlink = entryInfo.isSymLink();
+    const auto size = symlink ? 0 : entryInfo.size();
+    pool.start(new FunctionRunnable([entry, symlink, size, &counters] {
+      if (!QFile::remove(entry)) {
+        counters.fail(QStringLiteral("Failed to remove %1").arg(entry));
+        return;
+      }
+      ++(symlink ? counters.symlinks : counters.files);
+      counters.bytes += size;
+    }));
+  }
+  waitForDone(&pool, counters, options);
+
+  if (!counters.failed) {
+    // children have longer paths than their parents
+    std::sort(directories.begin(), directories.end(), [] (const QString& lhs, const QString& rhs) {
+      return lhs.size() > rhs.size();
+    });
+    directories << path;
+    for (const auto& directory : directories) {
+      if (!QDir().rmdir(directory)) {
+        counters.fail(QStringLiteral("Failed to remove %1").arg(directory));
+        break;
+      }
+      ++counters.directories;
+    }
+  }
+
+  *error = counters.error;
+  return counters.toJson();
+}
+
+QJsonArray listTree(const QString& path, const ListOptions& options, QString* error)
+{
+  Listing listing;
+  QThreadPool pool;
+  pool.setMaxThreadCount(std::max(1, options.threads));
+  scanDirectory(path, QString(), options, &listing, &pool);
+  pool.waitForDone();
+  if (!listing.error.isEmpty()) {
+    *error = listing.error;
+    return {};
+  }
+
+  std::sort(listing.entries.begin(), listing.entries.end(), [] (const Listing::Entries::value_type& lhs,
+                                                                const Listing::Entries::value_type& rhs) {
+    return lhs.first < rhs.first;
+  });
+  QJsonArray result;
+  for (const auto& entry : listing.entries) {
+    result.append(entry.second);
+  }
+  return result;
+}
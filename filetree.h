@@ -0,0 +1,50 @@
+// Copyright (c) 2015 Klaralvdalens Datakonsult AB (KDAB).
+// All rights reserved. Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#ifndef PHANTOMJS_FILETREE_H
+#define PHANTOMJS_FILETREE_H
+
+#include <QJsonArray>
+#include <QJsonObject>
+#include <QString>
+
+#include <functional>
+
+struct TreeOptions
+{
+  // recreate symbolic links in the copy, by default they are skipped
+  bool preserveSymlinks = false;
+  // replace existing files in the target, by default copying fails on them like QFile::copy
+  bool overwrite = false;
+  // the number of files that are copied or removed in parallel
+  int threads = 4;
+  // called about every 100ms on the calling thread with the statistics so far
+  std::function<void(const QJsonObject& progress)> progress;
+};
+
+// copies the file or directory @p source to @p target, files are copied into @p target if it is a directory
+// on Linux, files are reflinked or copied via copy_file_range where the file system supports it
+// only regular files, directories and, optionally, symlinks are copied, fifos, sockets and devices are skipped
+// returns the number of copied files, directories, symlinks and bytes, or sets @p error
+QJsonObject copyTree(const QString& source, const QString& target, const TreeOptions& options, QString* error);
+
+// removes the file or directory @p path recursively without following symbolic links
+// returns the number of removed files, directories, symlinks and bytes, or sets @p error
+QJsonObject removeTree(const QString& path, const TreeOptions& options, QString* error);
+
+struct ListOptions
+{
+  bool recursive = false;
+  // wildcard pattern the entry names must match, e.g. *.png, directories are traversed regardless
+  QString glob;
+  // the number of directories that are scanned in parallel when listing recursively
+  int threads = 4;
+};
+
+// lists the entries of the directory @p path with their name relative to @p path, type, size,
+// modification time in milliseconds since the epoch and permission bits, sorted by name
+// on Linux, every entry costs a single fstatat relative to the open directory
+QJsonArray listTree(const QString& path, const ListOptions& options, QString* error);
+
+#endif // PHANTOMJS_FILETREE_H
@@ -0,0 +1,393 @@
+// Copyright (c) 2015 Klaralvdalens Datakonsult AB (KDAB).
+// All rights reserved. Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include "filewatchers.h"
+
+#include <QDirIterator>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonObject>
+#include <QSet>
+#include <QStringList>
+
+#include <vector>
+
+#ifdef Q_OS_LINUX
+#include <cerrno>
+#include <cstring>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+#include "debug.h"
+#include "filetasks.h"
+#include "task.h"
+
+namespace {
+#ifdef Q_OS_LINUX
+const uint32_t WATCH_MASK = IN_CREATE | IN_DELETE | IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB
+                          | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF;
+
+// under continuous changes, a batch is delivered at the latest this many debounce intervals after its first event
+const int MAX_BATCH_AGE = 10;
+
+// the events of a single watch that were not delivered yet
+struct PendingEvents
+{
+  // paths in the order they changed first, mapped to the resulting change
+  QStringList paths;
+  QHash<QString, QString> types;
+  // inotify dropped events, the script has to rescan
+  bool overflow = false;
+  qint64 firstEvent = -1;
+  qint64 lastEvent = 0;
+  int debounce = 0;
+
+  qint64 due() const
+  {
+    return qMin(lastEvent + debounce, firstEvent + qint64(MAX_BATCH_AGE) * debounce);
+  }
+
+  void addOverflow(qint64 now)
+  {
+    touch(now);
+    overflow = true;
+  }
+
+  void add(const QString& path, const QString& type, qint64 now)
+  {
+    touch(now);
+    auto it = types.find(path);
+    if (it == types.end()) {
+      paths << path;
+      types.insert(path, type);
+    } else if (type == QLatin1String("removed")) {
+      it.value() = type;
+    } else if (it.value() == QLatin1String("removed")) {
+      // replaced in the meantime
+      it.value() = QStringLiteral("modified");
+    }
+    // a created file that got modified afterwards is still reported as created
+  }
+
+  void touch(qint64 now)
+  {
+    if (firstEvent < 0) {
+      firstEvent = now;
+    }
+    lastEvent = now;
+  }
+
+  QJsonArray toJson() const
+  {
+    QJsonArray events;
+    if (overflow) {
+      events.append(QJsonObject{
+        {QStringLiteral("type"), QStringLiteral("overflow")},
+        {QStringLiteral("path"), QString()}
+      });
+    }
+    foreach (const auto& path, paths) {
+      events.append(QJsonObject{
+        {QStringLiteral("type"), types.value(path)},
+        {QStringLiteral("path"), path}
+      });
+    }
+    return events;
+  }
+};
+
+QString eventType(uint32_t mask)
+{
+  if (mask & (IN_CREATE | IN_MOVED_TO)) {
+    return QStringLiteral("created");
+  } else if (mask & (IN_DELETE | IN_MOVED_FROM | IN_DELETE_SELF | IN_MOVE_SELF)) {
+    return QStringLiteral("removed");
+  }
+  return QStringLiteral("modified");
+}
+#endif
+}
+
+FileWatchers::FileWatchers()
+  : m_stop(false)
+{
+}
+
+FileWatchers::~FileWatchers()
+{
+#ifdef Q_OS_LINUX
+  if (m_thread.joinable()) {
+    m_stop = true;
+    const uint64_t value = 1;
+    if (write(m_wakeup, &value, sizeof(value)) == sizeof(value)) {
+      m_thread.join();
+    } else {
+      m_thread.detach();
+    }
+  }
+  if (m_inotify != -1) {
+    close(m_inotify);
+  }
+  if (m_wakeup != -1) {
+    close(m_wakeup);
+  }
+#endif
+}
+
+int FileWatchers::watch(int browserId, CefRefPtr<CefV8Context> context, CefRefPtr<CefV8Value> callback,
+                        const QString& path, bool recursive, int debounce, QString* error)
+{
+#ifdef Q_OS_LINUX
+  if (!QFileInfo(path).exists()) {
+    *error = QStringLiteral("%1 does not exist").arg(path);
+    return 0;
+  }
+  if (m_inotify == -1) {
+    m_inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    m_wakeup = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (m_inotify == -1 || m_wakeup == -1) {
+      *error = QStringLiteral("Failed to initialize inotify: %1").arg(QString::fromLocal8Bit(strerror(errno)));
+      return 0;
+    }
+    m_thread = std::thread(&FileWatchers::run, this);
+  }
+
+  const int id = m_nextId++;
+  {
+    QMutexLocker lock(&m_mutex);
+    if (!m_error.isEmpty()) {
+      // the watcher thread stopped
+      *error = m_error;
+      return 0;
+    }
+    if (!addDirectory(id, path, QString(), recursive, debounce)) {
+      *error = QStringLiteral("Failed to watch %1: %2").arg(path, QString::fromLocal8Bit(strerror(errno)));
+      lock.unlock();
+      unwatch(id);
+      return 0;
+    }
+  }
+  Watch watch;
+  watch.browserId = browserId;
+  watch.context = context;
+  watch.callback = callback;
+  m_watches.insert(id, watch);
+  return id;
+#else
+  Q_UNUSED(browserId);
+  Q_UNUSED(context);
+  Q_UNUSED(callback);
+  Q_UNUSED(path);
+  Q_UNUSED(recursive);
+  Q_UNUSED(debounce);
+  *error = QStringLiteral("fs.watch is only supported on Linux.");
+  return 0;
+#endif
+}
+
+void FileWatchers::unwatch(int id)
+{
+  m_watches.remove(id);
+#ifdef Q_OS_LINUX
+  QMutexLocker lock(&m_mutex);
+  for (auto it = m_directories.begin(); it != m_directories.end();) {
+    auto& directories = it.value();
+    for (int i = directories.size() - 1; i >= 0; --i) {
+      if (directories.at(i).id == id) {
+        directories.remove(i);
+      }
+    }
+    if (directories.isEmpty()) {
+      inotify_rm_watch(m_inotify, it.key());
+      it = m_directories.erase(it);
+    } else {
+      ++it;
+    }
+  }
+#endif
+}
+
+void FileWatchers::unwatchAll(int browserId)
+{
+  foreach (const int id, m_watches.keys()) {
+    if (m_watches.value(id).browserId == browserId) {
+      qCDebug(app) << "removing file watch" << id << "left behind by browser" << browserId;
+      unwatch(id);
+    }
+  }
+}
+
+bool FileWatchers::addDirectory(int id, const QString& root, const QString& relative, bool recursive, int debounce)
+{
+#ifdef Q_OS_LINUX
+  const auto path = relative.isEmpty() ? root : root + QLatin1Char('/') + relative;
+  const int descriptor = inotify_add_watch(m_inotify, QFile::encodeName(path).constData(), WATCH_MASK);
+  if (descriptor == -1) {
+    return false;
+  }
+  Directory directory;
+  directory.id = id;
+  directory.root = root;
+  directory.relative = relative;
+  directory.recursive = recursive;
+  directory.debounce = debounce;
+  m_directories[descriptor].append(directory);
+
+  if (recursive && QFileInfo(path).isDir()) {
+    const auto prefix = relative.isEmpty() ? QString() : relative + QLatin1Char('/');
+    QDirIterator it(path, QDir::Dirs | QDir::NoDotAndDotDot | QDir::Hidden | QDir::NoSymLinks);
+    while (it.hasNext()) {
+      it.next();
+      // subdirectories can disappear while we walk them, that is fine
+      addDirectory(id, root, prefix + it.fileName(), true, debounce);
+    }
+  }
+  return true;
+#else
+  Q_UNUSED(id);
+  Q_UNUSED(root);
+  Q_UNUSED(relative);
+  Q_UNUSED(recursive);
+  Q_UNUSED(debounce);
+  return false;
+#endif
+}
+
+void FileWatchers::run()
+{
+#ifdef Q_OS_LINUX
+  QElapsedTimer clock;
+  clock.start();
+  QHash<int, PendingEvents> pending;
+  // large enough for many events with maximum length names
+  std::vector<char> buffer(64 * 1024);
+
+  while (!m_stop) {
+    // sleep until the next batch is due
+    int timeout = -1;
+    for (const auto& events : pending) {
+      const auto due = qMax<qint64>(0, events.due() - clock.elapsed());
+      timeout = timeout == -1 ? static_cast<int>(due) : qMin(timeout, static_cast<int>(due));
+    }
+    pollfd fds[2];
+    fds[0].fd = m_inotify;
+    fds[0].events = POLLIN;
+    fds[1].fd = m_wakeup;
+    fds[1].events = POLLIN;
+    if (poll(fds, 2, timeout) < 0 && errno != EINTR) {
+      const auto error = QStringLiteral("Polling inotify failed: %1").arg(QString::fromLocal8Bit(strerror(errno)));
+      qCWarning(app) << error;
+      // pass on what was collected, the watches don't get further events
+      for (auto it = pending.begin(); it != pending.end(); ++it) {
+        const int id = it.key();
+        const auto events = it->toJson();
+        CefPostTask(TID_RENDERER, makeTask([this, id, events] {
+          deliver(id, events);
+        }));
+      }
+      fail(error);
+      return;
+    }
+
+    if (fds[0].revents & POLLIN) {
+      QMutexLocker lock(&m_mutex);
+      ssize_t size;
+      while ((size = read(m_inotify, buffer.data(), buffer.size())) > 0) {
+        for (auto p = buffer.data(); p < buffer.data() + size;) {
+          const auto event = reinterpret_cast<const inotify_event*>(p);
+          p += sizeof(inotify_event) + event->len;
+          if (event->mask & IN_Q_OVERFLOW) {
+            // the kernel queue was full and events got lost, for any of the watches
+            qCWarning(app) << "inotify queue overflow, file watches missed changes";
+            for (const auto& directories : m_directories) {
+              for (const auto& directory : directories) {
+                auto& events = pending[directory.id];
+                events.debounce = directory.debounce;
+                events.addOverflow(clock.elapsed());
+              }
+            }
+            continue;
+          }
+          if (event->mask & IN_IGNORED) {
+            // the watched directory is gone
+            m_directories.remove(event->wd);
+            continue;
+          }
+          const auto name = event->len ? QFile::decodeName(event->name) : QString();
+          const auto type = eventType(event->mask);
+          // copy, addDirectory may modify m_directories
+          const auto directories = m_directories.value(event->wd);
+          for (const auto& directory : directories) {
+            auto path = directory.relative;
+            if (!name.isEmpty()) {
+              path = path.isEmpty() ? name : path + QLatin1Char('/') + name;
+            }
+            if (directory.recursive && (event->mask & IN_ISDIR) && (event->mask & (IN_CREATE | IN_MOVED_TO))) {
+              addDirectory(directory.id, directory.root, path, true, directory.debounce);
+            }
+            auto& events = pending[directory.id];
+            events.debounce = directory.debounce;
+            events.add(path, type, clock.elapsed());
+          }
+        }
+      }
+    }
+
+    const auto now = clock.elapsed();
+    for (auto it = pending.begin(); it != pending.end();) {
+      if (it->due() > now) {
+        ++it;
+        continue;
+      }
+      const int id = it.key();
+      const auto events = it->toJson();
+      CefPostTask(TID_RENDERER, makeTask([this, id, events] {
+        deliver(id, events);
+      }));
+      it = pending.erase(it);
+    }
+  }
+#endif
+}
+
+void FileWatchers::fail(const QString& error)
+{
+  QMutexLocker lock(&m_mutex);
+  m_error = error;
+  QSet<int> ids;
+  for (const auto& directories : m_directories) {
+    for (const auto& directory : directories) {
+      ids << directory.id;
+    }
+  }
+  const QJsonArray events{QJsonObject{
+    {QStringLiteral("type"), QStringLiteral("error")},
+    {QStringLiteral("path"), QString()},
+    {QStringLiteral("message"), error}
+  }};
+  foreach (const int id, ids) {
+    CefPostTask(TID_RENDERER, makeTask([this, id, events] {
+      deliver(id, events);
+    }));
+  }
+}
+
+void FileWatchers::deliver(int id, const QJsonArray& events)
+{
+  if (!m_watches.contains(id)) {
+    return;
+  }
+  // a copy, the callback may close the watch
+  const auto watch = m_watches.value(id);
+  if (watch.context->IsValid()) {
+    // posted tasks run outside of any context, V8 can't create arrays or objects there
+    watch.context->Enter();
+    watch.callback->ExecuteFunctionWithContext(watch.context, nullptr, {toV8(events)});
+    watch.context->Exit();
+  }
+}
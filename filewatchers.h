@@ -0,0 +1,88 @@
+// Copyright (c) 2015 Klaralvdalens Datakonsult AB (KDAB).
+// All rights reserved. Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#ifndef PHANTOMJS_FILEWATCHERS_H
+#define PHANTOMJS_FILEWATCHERS_H
+
+#include <QHash>
+#include <QJsonArray>
+#include <QMutex>
+#include <QString>
+#include <QVector>
+
+#include <atomic>
+#include <thread>
+
+#include "include/cef_v8.h"
+
+/**
+ * The watches created by fs.watch in the renderer process.
+ *
+ * On Linux, a single inotify instance is read by a watcher thread, which is
+ * started with the first watch. Events of a watch are collected until nothing
+ * happened for the debounce interval, or for at most ten intervals under
+ * continuous changes, and then delivered as a batch to the script callback
+ * on the renderer thread. An overflow of the inotify queue is reported to
+ * all watches, as events may have been lost, and so is an error that stops
+ * the watcher thread. Recursive watches add the subdirectories created later
+ * on as well. Other platforms are not supported.
+ *
+ * watch, unwatch and unwatchAll are only called on the renderer main thread.
+ */
+class FileWatchers
+{
+public:
+  FileWatchers();
+  ~FileWatchers();
+
+  // @p callback gets called with an array of {type, path} objects, where type is created, modified, removed,
+  // overflow or error and path is relative to @p path, empty for overflow and error, which also has a message,
+  // returns the id of the watch or 0 with @p error set
+  int watch(int browserId, CefRefPtr<CefV8Context> context, CefRefPtr<CefV8Value> callback,
+            const QString& path, bool recursive, int debounce, QString* error);
+  void unwatch(int id);
+  // remove all watches of the browser
+  void unwatchAll(int browserId);
+
+private:
+  // the watcher thread
+  void run();
+  // adds an inotify watch for @p relative below @p root and, if recursive, for its subdirectories
+  // m_mutex must be locked
+  bool addDirectory(int id, const QString& root, const QString& relative, bool recursive, int debounce);
+  // reports @p error to all watches and refuses new ones, called by the watcher thread before it stops
+  void fail(const QString& error);
+  void deliver(int id, const QJsonArray& events);
+
+  // only accessed on the renderer thread
+  struct Watch
+  {
+    int browserId;
+    CefRefPtr<CefV8Context> context;
+    CefRefPtr<CefV8Value> callback;
+  };
+  QHash<int, Watch> m_watches;
+  int m_nextId = 1;
+
+  // a directory watched for a script watch, shared with the watcher thread
+  struct Directory
+  {
+    int id;
+    QString root;
+    QString relative;
+    bool recursive;
+    int debounce;
+  };
+  QMutex m_mutex;
+  // by inotify watch descriptor, which is shared if scripts watch the same directory more than once
+  QHash<int, QVector<Directory>> m_directories;
+  // set once the watcher thread stopped due to an error
+  QString m_error;
+  int m_inotify = -1;
+  int m_wakeup = -1;
+  std::atomic<bool> m_stop;
+  std::thread m_thread;
+};
+
+#endif // PHANTOMJS_FILEWATCHERS_H
@@ -9,6 +9,7 @@
 #include <iostream>
 #include <locale>
 #include <algorithm>
+#include <limits>
 
 #include <QJsonDocument>
 #include <QJsonObject>
@@ -28,7 +29,16 @@
 #include "include/wrapper/cef_closure_task.h"
 #include "include/wrapper/cef_helpers.h"
 
+#include "archive.h"
+#include "downloads.h"
+#include "har.h"
+#include "preconnect.h"
 #include "print_handler.h"
+#include "proxy_handler.h"
+#include "responsecache.h"
+#include "server.h"
+#include "task.h"
+#include "digest.h"
 #include "debug.h"
 
 #include "WindowsKeyboardCodes.h"
@@ -75,6 +85,61 @@ void initWindowInfo(CefWindowInfo& window_info, bool isPhantomMain)
   }
 }
 
+struct ResourceTypeName
+{
+  cef_resource_type_t type;
+  const char* name;
+};
+
+// the resource types that can be blocked, the main document is always loaded
+const ResourceTypeName RESOURCE_TYPE_NAMES[] = {
+  {RT_SUB_FRAME, "subframe"},
+  {RT_STYLESHEET, "stylesheet"},
+  {RT_SCRIPT, "script"},
+  {RT_IMAGE, "image"},
+  {RT_FONT_RESOURCE, "font"},
+  {RT_SUB_RESOURCE, "subresource"},
+  {RT_OBJECT, "object"},
+  {RT_MEDIA, "media"},
+  {RT_WORKER, "worker"},
+  {RT_SHARED_WORKER, "sharedworker"},
+  {RT_PREFETCH, "prefetch"},
+  {RT_FAVICON, "favicon"},
+  {RT_XHR, "xhr"},
+  {RT_PING, "ping"},
+  {RT_SERVICE_WORKER, "serviceworker"},
+};
+
+QString resourceTypeName(int type)
+{
+  for (const auto& entry : RESOURCE_TYPE_NAMES) {
+    if (entry.type == type) {
+      return QString::fromLatin1(entry.name);
+    }
+  }
+  return QString::number(type);
+}
+
+quint32 resourceTypeMask(const QJsonArray& names)
+{
+  quint32 mask = 0;
+  for (const auto& value : names) {
+    const auto name = value.toString();
+    bool found = false;
+    for (const auto& entry : RESOURCE_TYPE_NAMES) {
+      if (!name.compare(QLatin1String(entry.name), Qt::CaseInsensitive)) {
+        mask |= 1u << entry.type;
+        found = true;
+        break;
+      }
+    }
+    if (!found) {
+      qCWarning(handler) << "unknown resource type" << name << "in blockResourceTypes";
+    }
+  }
+  return mask;
+}
+
 cef_state_t toState(const QJsonValue& value)
 {
   if (value.isBool()) {
@@ -185,7 +250,9 @@ QJsonObject toJson(const CefRefPtr<CefDownloadItem>& item)
 }
 
 PhantomJSHandler::PhantomJSHandler()
-    : m_messageRouter(CefMessageRouterBrowserSide::Create(messageRouterConfig()))
+    : m_downloadManager(std::make_shared<DownloadManager>(4))
+    , m_preconnector(std::make_shared<Preconnector>())
+    , m_messageRouter(CefMessageRouterBrowserSide::Create(messageRouterConfig()))
 {
   m_messageRouter->AddHandler(this, false);
 }
@@ -203,7 +270,8 @@ CefMessageRouterConfig PhantomJSHandler::messageRouterConfig()
 }
 
 CefRefPtr<CefBrowser> PhantomJSHandler::createBrowser(const CefString& url, bool isPhantomMain,
-                                                      const QJsonObject& config)
+                                                      const QJsonObject& config,
+                                                      CefRefPtr<CefRequestContext> requestContext)
 {
   CefWindowInfo window_info;
   initWindowInfo(window_info, isPhantomMain);
@@ -213,8 +281,140 @@ CefRefPtr<CefBrowser> PhantomJSHandler::createBrowser(const CefString& url, bool
 
   qCDebug(handler) << url << isPhantomMain << config;
 
-  return CefBrowserHost::CreateBrowserSync(window_info, this, url, browser_settings,
-                                           NULL);
+  auto browser = CefBrowserHost::CreateBrowserSync(window_info, this, url, browser_settings,
+                                                   requestContext);
+  if (browser && isPhantomMain) {
+    m_browsers[browser->GetIdentifier()].isPhantomMain = true;
+    // tell the renderer that this browser may access the native phantom functions
+    // the message is queued and thus arrives before any script is loaded into the browser
+    auto message = CefProcessMessage::Create("phantomMain");
+    message->GetArgumentList()->SetBool(0, m_jobServer != nullptr);
+    browser->SendProcessMessage(PID_RENDERER, message);
+  }
+  return browser;
+}
+
+void PhantomJSHandler::setJobServer(JobServer* jobServer)
+{
+  m_jobServer = jobServer;
+}
+
+void PhantomJSHandler::setResponseCache(std::shared_ptr<ResponseCache> responseCache)
+{
+  m_responseCache = responseCache;
+}
+
+void PhantomJSHandler::setDownloadManager(std::shared_ptr<DownloadManager> downloadManager)
+{
+  m_downloadManager = downloadManager;
+}
+
+void PhantomJSHandler::setNetworkArchive(std::shared_ptr<NetworkArchive> networkArchive)
+{
+  m_networkArchive = networkArchive;
+}
+
+int PhantomJSHandler::exitCode() const
+{
+  return m_exitCode;
+}
+
+void PhantomJSHandler::setExitCode(int exitCode)
+{
+  m_exitCode = exitCode;
+}
+
+void PhantomJSHandler::quit()
+{
+  CEF_REQUIRE_UI_THREAD();
+
+  m_quitting = true;
+  if (m_browsers.empty()) {
+    quitMessageLoop();
+  } else {
+    CloseAllBrowsers(true);
+  }
+}
+
+void PhantomJSHandler::quitMessageLoop()
+{
+  CEF_REQUIRE_UI_THREAD();
+
+  if (!m_networkArchive) {
+    CefQuitMessageLoop();
+    return;
+  }
+  // the archive records are appended on the FILE thread, close it after the pending ones
+  // instead of relying on the destructor, which doesn't run when the process exits early
+  auto archive = m_networkArchive;
+  CefPostTask(TID_FILE, makeTask([archive] () {
+    archive->close();
+    CefPostTask(TID_UI, makeTask([] () {
+      CefQuitMessageLoop();
+    }));
+  }));
+}
+
+int PhantomJSHandler::ownerId(int browserId) const
+{
+  const auto& info = m_browsers.value(browserId);
+  return info.isPhantomMain ? browserId : info.ownerId;
+}
+
+void PhantomJSHandler::closeJob(int browserId, int exitCode)
+{
+  CEF_REQUIRE_UI_THREAD();
+
+  auto it = m_browsers.find(browserId);
+  if (it == m_browsers.end() || !it->isPhantomMain) {
+    return;
+  }
+  it->exitCode = exitCode;
+  auto mainBrowser = it->browser;
+  foreach (const auto& info, m_browsers.values()) {
+    if (info.ownerId == browserId) {
+      info.browser->GetHost()->CloseBrowser(true);
+    }
+  }
+  mainBrowser->GetHost()->CloseBrowser(true);
+}
+
+std::shared_ptr<HarRecorder> PhantomJSHandler::harRecorder(const CefRefPtr<CefBrowser>& browser)
+{
+  QMutexLocker lock(&m_harMutex);
+  return m_harRecorders.value(browser->GetIdentifier());
+}
+
+void PhantomJSHandler::preconnect(CefRefPtr<CefBrowser> browser, const QJsonObject& json, CefRefPtr<Callback> callback)
+{
+  QStringList urls;
+  foreach (const auto& url, json.value(QStringLiteral("urls")).toArray()) {
+    urls << url.toString();
+  }
+  // the hints warm up the request context the browser's navigations will use
+  const auto origins = m_preconnector->preconnect(browser->GetMainFrame(), urls);
+  callback->Success(QJsonDocument(origins).toJson(QJsonDocument::Compact).constData());
+}
+
+void PhantomJSHandler::setNetworkSettings(int browserId, const QJsonObject& settings)
+{
+  NetworkSettings networkSettings;
+  networkSettings.resourceTimeout = std::max(0, settings.value(QStringLiteral("resourceTimeout")).toInt());
+  networkSettings.blockedResourceTypes = resourceTypeMask(settings.value(QStringLiteral("blockResourceTypes")).toArray());
+  const auto emulation = settings.value(QStringLiteral("networkEmulation")).toObject();
+  networkSettings.latency = std::max(0, emulation.value(QStringLiteral("latency")).toInt());
+  networkSettings.downloadThroughput = std::max<qint64>(0, emulation.value(QStringLiteral("downloadThroughput")).toDouble());
+  networkSettings.uploadThroughput = std::max<qint64>(0, emulation.value(QStringLiteral("uploadThroughput")).toDouble());
+  networkSettings.failureRate = qBound(0., emulation.value(QStringLiteral("failureRate")).toDouble(), 1.);
+
+  QMutexLocker lock(&m_networkSettingsMutex);
+  m_networkSettings[browserId] = networkSettings;
+}
+
+PhantomJSHandler::NetworkSettings PhantomJSHandler::networkSettings(const CefRefPtr<CefBrowser>& browser)
+{
+  QMutexLocker lock(&m_networkSettingsMutex);
+  return m_networkSettings.value(browser->GetIdentifier());
 }
 
 bool PhantomJSHandler::OnProcessMessageReceived(CefRefPtr<CefBrowser> browser,
@@ -225,7 +425,19 @@ bool PhantomJSHandler::OnProcessMessageReceived(CefRefPtr<CefBrowser> browser,
     return true;
   }
   if (message->GetName() == "exit") {
-    CloseAllBrowsers(true);
+    const auto args = message->GetArgumentList();
+    const int exitCode = args->GetSize() ? args->GetInt(0) : 0;
+    if (m_jobServer) {
+      closeJob(browser->GetIdentifier(), exitCode);
+    } else {
+      m_exitCode = exitCode;
+      CloseAllBrowsers(true);
+    }
+    return true;
+  } else if (message->GetName() == "printError" && m_jobServer) {
+    m_jobServer->jobOutput(browser->GetIdentifier(), QStringLiteral("error"), {
+      {QStringLiteral("message"), QString::fromStdString(message->GetArgumentList()->GetString(0))}
+    });
     return true;
   }
   return false;
@@ -233,7 +445,13 @@ bool PhantomJSHandler::OnProcessMessageReceived(CefRefPtr<CefBrowser> browser,
 
 bool PhantomJSHandler::OnConsoleMessage(CefRefPtr<CefBrowser> browser, const CefString& message, const CefString& source, int line)
 {
-  if (!canEmitSignal(browser)) {
+  if (m_jobServer && m_jobServer->isJob(browser->GetIdentifier())) {
+    m_jobServer->jobOutput(browser->GetIdentifier(), QStringLiteral("console"), {
+      {QStringLiteral("message"), QString::fromStdString(message)},
+      {QStringLiteral("source"), QString::fromStdString(source)},
+      {QStringLiteral("line"), line}
+    });
+  } else if (!canEmitSignal(browser)) {
     auto shortSource = QFileInfo(QString::fromStdString(source)).fileName().toStdString();
     QMessageLogger(shortSource.c_str(), line, 0).debug() << message;
   } else {
@@ -243,6 +461,13 @@ bool PhantomJSHandler::OnConsoleMessage(CefRefPtr<CefBrowser> browser, const Cef
   return true;
 }
 
+void PhantomJSHandler::OnTitleChange(CefRefPtr<CefBrowser> browser, const CefString& title)
+{
+  if (auto har = harRecorder(browser)) {
+    har->setPageTitle(QString::fromStdString(title));
+  }
+}
+
 void PhantomJSHandler::OnAfterCreated(CefRefPtr<CefBrowser> browser)
 {
   CEF_REQUIRE_UI_THREAD();
@@ -255,6 +480,7 @@ void PhantomJSHandler::OnAfterCreated(CefRefPtr<CefBrowser> browser)
     auto parentBrowser = m_popupToParentMapping.dequeue();
     // we don't open about:blank for popups
     browserInfo.firstLoadFinished = true;
+    browserInfo.ownerId = ownerId(parentBrowser);
     emitSignal(m_browsers.value(parentBrowser).browser, QStringLiteral("onPopupCreated"),
                {browser->GetIdentifier()}, true);
   }
@@ -288,11 +514,28 @@ void PhantomJSHandler::OnBeforeClose(CefRefPtr<CefBrowser> browser)
 
   m_messageRouter->OnBeforeClose(browser);
 
-  m_browsers.remove(browser->GetIdentifier());
+  std::shared_ptr<HarRecorder> har;
+  {
+    QMutexLocker lock(&m_harMutex);
+    har = m_harRecorders.take(browser->GetIdentifier());
+  }
+  if (har) {
+    har->close(nullptr);
+  }
+  {
+    QMutexLocker lock(&m_networkSettingsMutex);
+    m_networkSettings.remove(browser->GetIdentifier());
+    m_blockStatistics.remove(browser->GetIdentifier());
+  }
 
-  if (m_browsers.empty()) {
+  const auto info = m_browsers.take(browser->GetIdentifier());
+  if (info.isPhantomMain && m_jobServer) {
+    m_jobServer->jobFinished(browser->GetIdentifier(), info.exitCode);
+  }
+
+  if (m_browsers.empty() && (!m_jobServer || m_quitting)) {
     // All browser windows have closed. Quit the application message loop.
-    CefQuitMessageLoop();
+    quitMessageLoop();
   }
 }
 
@@ -346,6 +589,12 @@ void PhantomJSHandler::OnLoadStart(CefRefPtr<CefBrowser> browser, CefRefPtr<CefF
 
   qCDebug(handler) << browser->GetIdentifier() << frame->GetURL() << isMain(frame);
 
+  if (isMain(frame)) {
+    if (auto har = harRecorder(browser)) {
+      har->startPage(QString::fromStdString(frame->GetURL()));
+    }
+  }
+
   // filter out events from sub frames
   if (!isMain(frame) || !canEmitSignal(browser) || !m_browsers.value(browser->GetIdentifier()).firstLoadFinished) {
     return;
@@ -388,6 +637,10 @@ void PhantomJSHandler::OnLoadEnd(CefRefPtr<CefBrowser> browser, CefRefPtr<CefFra
     return;
   }
 
+  if (auto har = harRecorder(browser)) {
+    har->finishPage();
+  }
+
   /// TODO: is this OK?
   const bool success = httpStatusCode < 400;
   handleLoadEnd(browser, httpStatusCode, frame->GetURL(), success);
@@ -490,6 +743,14 @@ void PhantomJSHandler::OnPaint(CefRefPtr<CefBrowser> browser, PaintElementType t
 void PhantomJSHandler::OnRenderProcessTerminated(CefRefPtr<CefBrowser> browser, TerminationStatus status)
 {
   m_messageRouter->OnRenderProcessTerminated(browser);
+
+  if (m_jobServer && m_jobServer->isJob(browser->GetIdentifier())) {
+    // don't let a crashed job linger around forever
+    m_jobServer->jobOutput(browser->GetIdentifier(), QStringLiteral("error"), {
+      {QStringLiteral("message"), QStringLiteral("Render process terminated with status %1.").arg(status)}
+    });
+    closeJob(browser->GetIdentifier(), 1);
+  }
 }
 
 bool PhantomJSHandler::OnBeforeBrowse(CefRefPtr<CefBrowser> browser, CefRefPtr<CefFrame> frame, CefRefPtr<CefRequest> request, bool is_redirect)
@@ -513,12 +774,32 @@ QJsonObject headerMapToJson(const CefRefPtr<T>& r)
 CefRequestHandler::ReturnValue PhantomJSHandler::OnBeforeResourceLoad(CefRefPtr<CefBrowser> browser, CefRefPtr<CefFrame> frame,
                                                    CefRefPtr<CefRequest> request, CefRefPtr<CefRequestCallback> callback)
 {
+  const int resourceType = request->GetResourceType();
+  if (networkSettings(browser).blockedResourceTypes & (1u << resourceType)) {
+    // cancel synchronously, without a round trip to the script
+    QMutexLocker lock(&m_networkSettingsMutex);
+    auto& statistics = m_blockStatistics[browser->GetIdentifier()];
+    ++statistics.requests;
+    ++statistics.requestsPerType[resourceType];
+    const auto sizes = m_resourceSizes.value(resourceType);
+    if (sizes.first) {
+      statistics.estimatedBytes += sizes.second / sizes.first;
+    }
+    qCDebug(network) << "blocked" << resourceTypeName(resourceType) << request->GetURL();
+    return RV_CANCEL;
+  }
+
+  if (auto har = harRecorder(browser)) {
+    har->requestStarted(request);
+  }
+
   if (!canEmitSignal(browser)) {
     return RV_CONTINUE;
   }
 
   qCDebug(handler) << browser->GetIdentifier() << frame->GetURL() << request->GetURL();
 
+  // only describe the post data, the script reads the bytes on demand via readPostData
   QJsonArray jsonPost;
   if (const auto post = request->GetPostData()) {
     CefPostData::ElementVector elements;
@@ -527,11 +808,8 @@ CefRequestHandler::ReturnValue PhantomJSHandler::OnBeforeResourceLoad(CefRefPtr<
       QJsonObject elementJson = {{QStringLiteral("type"), element->GetType()}};
       switch (element->GetType()) {
         case PDE_TYPE_BYTES: {
-          QByteArray bytes;
-          bytes.resize(static_cast<int>(element->GetBytesCount()));
-          element->GetBytes(bytes.size(), bytes.data());
-          const auto STRING_BYTES = QStringLiteral("bytes");
-          elementJson[STRING_BYTES] = QString::fromUtf8(bytes.toBase64());
+          const auto STRING_SIZE = QStringLiteral("size");
+          elementJson[STRING_SIZE] = static_cast<double>(element->GetBytesCount());
           break;
         }
         case PDE_TYPE_FILE: {
@@ -555,7 +833,10 @@ CefRequestHandler::ReturnValue PhantomJSHandler::OnBeforeResourceLoad(CefRefPtr<
   jsonRequest[QStringLiteral("resourceType")] = static_cast<int>(request->GetResourceType());
   jsonRequest[QStringLiteral("transitionType")] = static_cast<int>(request->GetTransitionType());
 
-  m_requestCallbacks[request->GetIdentifier()] = {request, callback};
+  {
+    QMutexLocker lock(&m_requestCallbacksMutex);
+    m_requestCallbacks[request->GetIdentifier()] = {request, callback};
+  }
 
   emitSignal(browser, QStringLiteral("onBeforeResourceLoad"),
              {jsonRequest, QString::number(request->GetIdentifier())}, true);
@@ -563,9 +844,91 @@ CefRequestHandler::ReturnValue PhantomJSHandler::OnBeforeResourceLoad(CefRefPtr<
   return RV_CONTINUE_ASYNC;
 }
 
+CefRefPtr<CefResourceHandler> PhantomJSHandler::GetResourceHandler(CefRefPtr<CefBrowser> browser, CefRefPtr<CefFrame> frame,
+                                                                   CefRefPtr<CefRequest> request)
+{
+  if (request->GetResourceType() == RT_MAIN_FRAME) {
+    // the navigation is sent to the network now, after the script handled onResourceRequested
+    m_preconnector->navigationStarted(request);
+  }
+
+  if (m_networkArchive && m_networkArchive->mode() == NetworkArchive::Replay) {
+    // never touch the network while replaying
+    return m_networkArchive->lookup(request);
+  } else if (m_responseCache) {
+    if (auto handler = m_responseCache->lookup(request, browser->GetHost()->GetRequestContext())) {
+      return handler;
+    }
+  }
+
+  const auto settings = networkSettings(browser);
+  // the timeout of frame documents is handled by the script, which stops the whole page
+  const auto resourceType = request->GetResourceType();
+  const bool isFrame = resourceType == RT_MAIN_FRAME || resourceType == RT_SUB_FRAME;
+  const int timeout = isFrame ? 0 : settings.resourceTimeout;
+  if (timeout <= 0 && !settings.emulatesNetwork()) {
+    return nullptr;
+  }
+  const auto url = QUrl(QString::fromStdString(request->GetURL()));
+  if (url.scheme() != QLatin1String("http") && url.scheme() != QLatin1String("https")) {
+    return nullptr;
+  }
+
+  // load the resource ourselves, which allows us to cancel or throttle it individually
+  ProxyResourceHandler::Options options;
+  options.timeout = timeout;
+  options.latency = settings.latency;
+  options.downloadThroughput = settings.downloadThroughput;
+  options.uploadThroughput = settings.uploadThroughput;
+  options.failureRate = settings.failureRate;
+  const auto requestId = request->GetIdentifier();
+  options.onTimeout = [this, browser, requestId, url] () {
+    qCDebug(network) << "resource timeout" << browser->GetIdentifier() << requestId << url;
+    if (!canEmitSignal(browser)) {
+      return;
+    }
+    QJsonObject jsonRequest;
+    jsonRequest[QStringLiteral("id")] = QString::number(requestId);
+    jsonRequest[QStringLiteral("url")] = url.toString();
+    jsonRequest[QStringLiteral("time")] = QDateTime::currentDateTimeUtc().toString(Qt::ISODate);
+    jsonRequest[QStringLiteral("errorCode")] = 408;
+    jsonRequest[QStringLiteral("errorString")] = QStringLiteral("Network timeout on resource.");
+    emitSignal(browser, QStringLiteral("onResourceTimeout"), {jsonRequest});
+  };
+  return new ProxyResourceHandler(browser->GetHost()->GetRequestContext(), options);
+}
+
+void PhantomJSHandler::OnResourceRedirect(CefRefPtr<CefBrowser> browser, CefRefPtr<CefFrame> frame,
+                                          CefRefPtr<CefRequest> request, CefString& new_url)
+{
+  // OnResourceResponse saw the redirect response, fall back to a plain 302 otherwise
+  const auto redirectStatus = m_redirectStatus.take(request->GetIdentifier());
+  const int status = redirectStatus.first ? redirectStatus.first : 302;
+  const auto statusText = redirectStatus.first ? redirectStatus.second : QStringLiteral("Found");
+  if (m_networkArchive) {
+    m_networkArchive->recordRedirect(request, new_url, status, statusText);
+  }
+  if (auto har = harRecorder(browser)) {
+    har->redirected(request, QString::fromStdString(new_url), status, statusText);
+  }
+}
+
 bool PhantomJSHandler::OnResourceResponse(CefRefPtr<CefBrowser> browser, CefRefPtr<CefFrame> frame,
                                           CefRefPtr<CefRequest> request, CefRefPtr<CefResponse> response)
 {
+  if (auto har = harRecorder(browser)) {
+    har->responseStarted(request, response);
+  }
+  if (response->GetStatus() / 100 == 3 && !response->GetHeader("Location").empty()) {
+    m_redirectStatus[request->GetIdentifier()] = qMakePair(response->GetStatus(),
+                                                          QString::fromStdString(response->GetStatusText()));
+  }
+
+  QJsonObject navigation;
+  if (request->GetResourceType() == RT_MAIN_FRAME) {
+    navigation = m_preconnector->navigationResponded(request);
+  }
+
   if (canEmitSignal(browser)) {
     QJsonObject jsonResponse;
     jsonResponse[QStringLiteral("status")] = response->GetStatus();
@@ -574,12 +937,87 @@ bool PhantomJSHandler::OnResourceResponse(CefRefPtr<CefBrowser> browser, CefRefP
     jsonResponse[QStringLiteral("headers")] = headerMapToJson(response);
     jsonResponse[QStringLiteral("url")] = QString::fromStdString(request->GetURL());
     jsonResponse[QStringLiteral("id")] = QString::number(request->GetIdentifier());
-    /// TODO: time, stage, bodySize, redirectUrl
+    jsonResponse[QStringLiteral("time")] = QDateTime::currentDateTimeUtc().toString(Qt::ISODate);
+    jsonResponse[QStringLiteral("stage")] = QStringLiteral("start");
+    const auto redirectUrl = response->GetHeader("Location");
+    if (!redirectUrl.empty()) {
+      jsonResponse[QStringLiteral("redirectUrl")] = QString::fromStdString(redirectUrl);
+    }
+    if (!navigation.isEmpty()) {
+      jsonResponse[QStringLiteral("afterPreconnect")] = navigation.value(QStringLiteral("afterPreconnect"));
+      jsonResponse[QStringLiteral("timeToFirstByte")] = navigation.value(QStringLiteral("timeToFirstByte"));
+    }
     emitSignal(browser, QStringLiteral("onResourceReceived"), {jsonResponse});
+    if (request->GetResourceType() == RT_MAIN_FRAME) {
+      // the main document arrived in time, the script must not stop the page anymore
+      emitSignal(browser, QStringLiteral("onMainFrameResponse"), {}, true);
+    }
   }
   return false;
 }
 
+#if CHROME_VERSION_BUILD >= 2526
+CefRefPtr<CefResponseFilter> PhantomJSHandler::GetResourceResponseFilter(CefRefPtr<CefBrowser> browser, CefRefPtr<CefFrame> frame,
+                                                                         CefRefPtr<CefRequest> request, CefRefPtr<CefResponse> response)
+{
+  // both the cache and the archive need the body, but only a single filter can be installed
+  const bool cache = m_responseCache && m_responseCache->startRecording(request, response);
+  const bool archive = m_networkArchive && m_networkArchive->startRecording(request, response);
+  // the HAR only needs the decoded size
+  const bool har = harRecorder(browser) != nullptr;
+  if (!cache && !archive && !har) {
+    return nullptr;
+  }
+  // archives keep everything, the cache skips large bodies
+  const qint64 maxSize = archive ? std::numeric_limits<int>::max() : cache ? m_responseCache->maxObjectSize() : 0;
+  CefRefPtr<BodyRecorder> recorder = new BodyRecorder(maxSize);
+  m_bodyRecorders[request->GetIdentifier()] = recorder;
+  return recorder.get();
+}
+
+void PhantomJSHandler::OnResourceLoadComplete(CefRefPtr<CefBrowser> browser, CefRefPtr<CefFrame> frame,
+                                              CefRefPtr<CefRequest> request, CefRefPtr<CefResponse> response,
+                                              URLRequestStatus status, int64 received_content_length)
+{
+  auto recorder = m_bodyRecorders.take(request->GetIdentifier());
+  m_redirectStatus.remove(request->GetIdentifier());
+  const bool success = status == UR_SUCCESS;
+
+  if (success) {
+    QMutexLocker lock(&m_networkSettingsMutex);
+    auto& sizes = m_resourceSizes[request->GetResourceType()];
+    ++sizes.first;
+    sizes.second += received_content_length;
+  }
+
+  if (auto har = harRecorder(browser)) {
+    har->requestFinished(request, response, success, received_content_length,
+                         recorder ? recorder->totalSize() : -1);
+  }
+
+  if (canEmitSignal(browser)) {
+    QJsonObject jsonResponse;
+    jsonResponse[QStringLiteral("status")] = response->GetStatus();
+    jsonResponse[QStringLiteral("url")] = QString::fromStdString(request->GetURL());
+    jsonResponse[QStringLiteral("id")] = QString::number(request->GetIdentifier());
+    jsonResponse[QStringLiteral("time")] = QDateTime::currentDateTimeUtc().toString(Qt::ISODate);
+    jsonResponse[QStringLiteral("stage")] = QStringLiteral("end");
+    jsonResponse[QStringLiteral("bodySize")] = static_cast<double>(received_content_length);
+    emitSignal(browser, QStringLiteral("onResourceReceived"), {jsonResponse});
+  }
+
+  if (!recorder) {
+    return;
+  }
+  if (m_responseCache) {
+    m_responseCache->finishRecording(request, recorder, success);
+  }
+  if (m_networkArchive) {
+    m_networkArchive->finishRecording(request, recorder, success);
+  }
+}
+#endif
+
 bool PhantomJSHandler::GetAuthCredentials(CefRefPtr<CefBrowser> browser, CefRefPtr<CefFrame> frame,
                                           bool isProxy, const CefString& host, int port, const CefString& realm, const CefString& scheme,
                                           CefRefPtr<CefAuthCallback> callback)
@@ -632,10 +1070,13 @@ bool PhantomJSHandler::OnQuery(CefRefPtr<CefBrowser> browser, CefRefPtr<CefFrame
 
   if (type == QLatin1String("createBrowser")) {
     const auto& settings = json.value(QStringLiteral("settings")).toObject();
-    auto subBrowser = createBrowser("about:blank", false, settings);
+    // share the request context of the phantom main browser, which differs per job in server mode
+    auto subBrowser = createBrowser("about:blank", false, settings, browser->GetHost()->GetRequestContext());
     auto& info = m_browsers[subBrowser->GetIdentifier()];
+    info.ownerId = ownerId(browser->GetIdentifier());
     info.authName = settings.value(QStringLiteral("userName")).toString().toStdString();
     info.authPassword = settings.value(QStringLiteral("password")).toString().toStdString();
+    setNetworkSettings(subBrowser->GetIdentifier(), settings);
     callback->Success(std::to_string(subBrowser->GetIdentifier()));
     return true;
   } else if (type == QLatin1String("returnEvaluateJavaScript")) {
@@ -656,7 +1097,11 @@ bool PhantomJSHandler::OnQuery(CefRefPtr<CefBrowser> browser, CefRefPtr<CefFrame
     }
   } else if (type == QLatin1String("beforeResourceLoadResponse")) {
     const auto requestId = static_cast<uint64>(json.value(QStringLiteral("requestId")).toString().toULongLong());
-    auto callback = takeCallback(&m_requestCallbacks, requestId);
+    RequestInfo callback;
+    {
+      QMutexLocker lock(&m_requestCallbacksMutex);
+      callback = takeCallback(&m_requestCallbacks, requestId);
+    }
     if (!callback.callback || !callback.request) {
       qCWarning(handler) << "Unknown request with id" << requestId << "for query" << json;
       return false;
@@ -674,9 +1119,70 @@ bool PhantomJSHandler::OnQuery(CefRefPtr<CefBrowser> browser, CefRefPtr<CefFrame
       headers.insert(std::make_pair(it.key().toStdString(), it.value().toString().toStdString()));
     }
     callback.request->SetHeaderMap(headers);
-    // TODO: post support
+    const auto postData = requestData.value(QStringLiteral("postData"));
+    if (postData.isString()) {
+      // replaces the complete body of the request
+      const auto string = postData.toString();
+      const auto bytes = requestData.value(QStringLiteral("postDataEncoding")).toString() == QLatin1String("base64")
+                       ? QByteArray::fromBase64(string.toLatin1()) : string.toUtf8();
+      auto element = CefPostDataElement::Create();
+      element->SetToBytes(bytes.size(), bytes.constData());
+      auto post = CefPostData::Create();
+      post->AddElement(element);
+      callback.request->SetPostData(post);
+    }
     callback.callback->Continue(true);
     return true;
+  } else if (type == QLatin1String("readPostData")) {
+    const auto requestId = static_cast<uint64>(json.value(QStringLiteral("requestId")).toString().toULongLong());
+    CefRefPtr<CefRequest> pendingRequest;
+    {
+      QMutexLocker lock(&m_requestCallbacksMutex);
+      pendingRequest = m_requestCallbacks.value(requestId).request;
+    }
+    if (!pendingRequest) {
+      callback->Failure(1, "The request was sent already.");
+      return true;
+    }
+    // concatenate the bytes elements, file elements are only referenced by path
+    QByteArray bytes;
+    if (const auto post = pendingRequest->GetPostData()) {
+      CefPostData::ElementVector elements;
+      post->GetElements(elements);
+      for (const auto& element : elements) {
+        if (element->GetType() == PDE_TYPE_BYTES) {
+          const auto offset = bytes.size();
+          bytes.resize(offset + static_cast<int>(element->GetBytesCount()));
+          element->GetBytes(element->GetBytesCount(), bytes.data() + offset);
+        }
+      }
+    }
+    if (json.value(QStringLiteral("encoding")).toString() == QLatin1String("base64")) {
+      callback->Success(bytes.toBase64().constData());
+    } else {
+      callback->Success(QString::fromUtf8(bytes).toStdString());
+    }
+    return true;
+  } else if (type == QLatin1String("preconnect") && !json.contains(QStringLiteral("browser"))) {
+    preconnect(browser, json, callback);
+    return true;
+  } else if (type == QLatin1String("downloadStatistics")) {
+    const auto maxConcurrent = json.value(QStringLiteral("maxConcurrent")).toInt();
+    if (maxConcurrent > 0) {
+      m_downloadManager->setMaxConcurrent(maxConcurrent);
+    }
+    callback->Success(QJsonDocument(m_downloadManager->statistics()).toJson(QJsonDocument::Compact).constData());
+    return true;
+  } else if (type == QLatin1String("preconnectStatistics")) {
+    callback->Success(QJsonDocument(m_preconnector->statistics()).toJson(QJsonDocument::Compact).constData());
+    return true;
+  } else if (type == QLatin1String("responseCacheStatistics")) {
+    if (!m_responseCache) {
+      callback->Success("null");
+    } else {
+      callback->Success(QJsonDocument(m_responseCache->statistics()).toJson(QJsonDocument::Compact).constData());
+    }
+    return true;
   } else if (type == QLatin1String("beforeDownloadResponse")) {
     const auto requestId = static_cast<uint64>(json.value(QStringLiteral("requestId")).toString().toULongLong());
     const auto target = json.value(QStringLiteral("target")).toString().toStdString();
@@ -715,6 +1221,11 @@ bool PhantomJSHandler::OnQuery(CefRefPtr<CefBrowser> browser, CefRefPtr<CefFrame
     const auto url = QUrl::fromUserInput(json.value(QStringLiteral("url")).toString(),
                                          json.value(QStringLiteral("libraryPath")).toString(),
                                          QUrl::AssumeLocalFile);
+    // settings may have changed since the page got created
+    const auto settings = json.value(QStringLiteral("settings"));
+    if (settings.isObject()) {
+      setNetworkSettings(subBrowserId, settings.toObject());
+    }
     subBrowser->GetMainFrame()->LoadURL(url.toString().toStdString());
     m_waitForLoadedCallbacks.insert(subBrowser->GetIdentifier(), callback);
     return true;
@@ -916,11 +1427,132 @@ bool PhantomJSHandler::OnQuery(CefRefPtr<CefBrowser> browser, CefRefPtr<CefFrame
     }
     callback->Success({});
     return true;
+  } else if (type == QLatin1String("startHar")) {
+    auto har = std::make_shared<HarRecorder>(json.value(QStringLiteral("path")).toString());
+    if (!har->open()) {
+      callback->Failure(1, "Failed to open HAR file: " + har->errorString().toStdString());
+      return true;
+    }
+    std::shared_ptr<HarRecorder> previous;
+    {
+      QMutexLocker lock(&m_harMutex);
+      previous = m_harRecorders.value(subBrowserId);
+      m_harRecorders[subBrowserId] = har;
+    }
+    if (previous) {
+      previous->close(nullptr);
+    }
+    callback->Success({});
+    return true;
+  } else if (type == QLatin1String("swapBrowser")) {
+    // a prefetched browser replaces the previous one of the same page
+    const int previousId = json.value(QStringLiteral("previous")).toInt();
+    std::shared_ptr<HarRecorder> replaced;
+    {
+      QMutexLocker lock(&m_harMutex);
+      if (auto har = m_harRecorders.take(previousId)) {
+        replaced = m_harRecorders.value(subBrowserId);
+        m_harRecorders[subBrowserId] = har;
+      }
+    }
+    if (replaced) {
+      replaced->close(nullptr);
+    }
+    setNetworkSettings(subBrowserId, json.value(QStringLiteral("settings")).toObject());
+    callback->Success({});
+    return true;
+  } else if (type == QLatin1String("stopHar")) {
+    std::shared_ptr<HarRecorder> har;
+    {
+      QMutexLocker lock(&m_harMutex);
+      har = m_harRecorders.take(subBrowserId);
+    }
+    if (!har) {
+      callback->Failure(1, "No HAR is being recorded.");
+      return true;
+    }
+    // resolve once the file got written completely
+    har->close([callback] (const QJsonObject& summary) {
+      const auto error = summary.value(QStringLiteral("error")).toString();
+      if (!error.isEmpty()) {
+        callback->Failure(1, QStringLiteral("Failed to write HAR file %1: %2")
+                               .arg(summary.value(QStringLiteral("path")).toString(), error).toStdString());
+        return;
+      }
+      callback->Success(QJsonDocument(summary).toJson(QJsonDocument::Compact).constData());
+    });
+    return true;
+  } else if (type == QLatin1String("preconnect")) {
+    preconnect(subBrowser, json, callback);
+    return true;
+  } else if (type == QLatin1String("blockStatistics")) {
+    BlockStatistics statistics;
+    {
+      QMutexLocker lock(&m_networkSettingsMutex);
+      statistics = m_blockStatistics.value(subBrowserId);
+    }
+    QJsonObject perType;
+    for (auto it = statistics.requestsPerType.begin(); it != statistics.requestsPerType.end(); ++it) {
+      perType[resourceTypeName(it.key())] = static_cast<double>(it.value());
+    }
+    const QJsonObject jsonStatistics = {
+      {QStringLiteral("requests"), static_cast<double>(statistics.requests)},
+      {QStringLiteral("estimatedBytes"), static_cast<double>(statistics.estimatedBytes)},
+      {QStringLiteral("types"), perType}
+    };
+    callback->Success(QJsonDocument(jsonStatistics).toJson(QJsonDocument::Compact).constData());
+    return true;
   } else if (type == QLatin1String("download")) {
     const auto source = json.value(QStringLiteral("source")).toString();
-    const auto target = json.value(QStringLiteral("target")).toString();
-    m_downloadTargets[source] = {target, callback};
-    subBrowser->GetHost()->StartDownload(source.toStdString());
+    const auto options = json.value(QStringLiteral("options")).toObject();
+    const auto target = options.value(QStringLiteral("target")).toString();
+    const auto sink = options.value(QStringLiteral("sink")).toString(QStringLiteral("file"));
+    QStringList digests;
+    foreach (const auto& digest, options.value(QStringLiteral("digests")).toArray()) {
+      if (!StreamDigest::isSupported(digest.toString())) {
+        callback->Failure(1, "Unsupported digest: " + digest.toString().toStdString());
+        return true;
+      }
+      digests << digest.toString();
+    }
+
+    if (sink == QLatin1String("file") && digests.isEmpty()) {
+      // let CEF write the file, which reports the progress via onDownloadUpdated
+      auto host = subBrowser->GetHost();
+      m_downloadManager->enqueue([this, host, source, target, callback] (int id) {
+        m_downloadTargets[source].enqueue({id, target, callback});
+        host->StartDownload(source.toStdString());
+      });
+      return true;
+    }
+
+    DownloadManager::Options fetchOptions;
+    fetchOptions.target = target;
+    fetchOptions.digests = digests;
+    if (sink == QLatin1String("memory")) {
+      fetchOptions.sink = DownloadManager::Memory;
+      if (options.contains(QStringLiteral("maxSize"))) {
+        fetchOptions.maxSize = static_cast<qint64>(options.value(QStringLiteral("maxSize")).toDouble());
+      }
+    } else if (sink == QLatin1String("file") || sink == QLatin1String("stream")) {
+      // files need to be hashed, so we write them ourselves
+      fetchOptions.sink = DownloadManager::Stream;
+      if (target.isEmpty()) {
+        callback->Failure(1, "No download target given.");
+        return true;
+      }
+    } else {
+      callback->Failure(1, "Unknown download sink: " + sink.toStdString());
+      return true;
+    }
+    m_downloadManager->fetch(subBrowser->GetHost()->GetRequestContext(), source, fetchOptions,
+                             [callback] (const QJsonObject& result, const QString& error) {
+      if (error.isEmpty()) {
+        callback->Success(QJsonDocument(result).toJson(QJsonDocument::Compact).constData());
+      } else {
+        callback->Failure(1, error.toStdString());
+      }
+    });
     return true;
   }
   return false;
@@ -939,7 +1571,15 @@ void PhantomJSHandler::OnQueryCanceled(CefRefPtr<CefBrowser> browser, CefRefPtr<
 void PhantomJSHandler::OnBeforeDownload(CefRefPtr<CefBrowser> browser, CefRefPtr<CefDownloadItem> download_item, const CefString& suggested_name, CefRefPtr<CefBeforeDownloadCallback> callback)
 {
   const auto source = QString::fromStdString(download_item->GetOriginalUrl());
-  const auto target = m_downloadTargets.take(source);
+  // concurrent downloads of the same URL are matched in the order they were started
+  DownloadTargetInfo target;
+  auto it = m_downloadTargets.find(source);
+  if (it != m_downloadTargets.end()) {
+    target = it->dequeue();
+    if (it->isEmpty()) {
+      m_downloadTargets.erase(it);
+    }
+  }
 
   qCDebug(handler) << browser->GetIdentifier() << source << target.target;
 
@@ -956,6 +1596,7 @@ void PhantomJSHandler::OnBeforeDownload(CefRefPtr<CefBrowser> browser, CefRefPtr
   }
 
   m_downloadCallbacks[download_item->GetId()] = target.callback;
+  m_managedDownloads[download_item->GetId()] = target.id;
   callback->Continue(target.target.toStdString(), false);
 }
 
@@ -975,10 +1616,13 @@ void PhantomJSHandler::OnDownloadUpdated(CefRefPtr<CefBrowser> browser, CefRefPt
     if (download_item->IsCanceled()) {
       errorMessage = "Download of " + download_item->GetURL().ToString() + " canceled.";
     } else if (!download_item->IsComplete()) {
-      errorMessage = "Download of " + download_item->GetURL().ToString() + " ailed.";
+      errorMessage = "Download of " + download_item->GetURL().ToString() + " failed.";
     } else {
        data = QJsonDocument(jsonDownloadItem).toJson();
     }
+    if (m_managedDownloads.contains(download_item->GetId())) {
+      m_downloadManager->finished(m_managedDownloads.take(download_item->GetId()), errorMessage.empty());
+    }
     auto callback = m_downloadCallbacks.take(download_item->GetId());
     if (callback) {
       if (errorMessage.empty()) {
@@ -6,13 +6,25 @@
 #define CEF_TESTS_PHANTOMJS_HANDLER_H_
 
 #include "include/cef_client.h"
+#include "include/cef_version.h"
 #include "include/wrapper/cef_message_router.h"
 
 #include <QQueue>
 #include <QHash>
+#include <QMutex>
 #include <QRect>
 #include <QJsonObject>
 
+#include <memory>
+
+class JobServer;
+class ResponseCache;
+class NetworkArchive;
+class DownloadManager;
+class BodyRecorder;
+class HarRecorder;
+class Preconnector;
+
 class PhantomJSHandler : public CefClient,
                       public CefDisplayHandler,
                       public CefLifeSpanHandler,
@@ -30,7 +42,24 @@ class PhantomJSHandler : public CefClient,
   static CefMessageRouterConfig messageRouterConfig();
 
   CefRefPtr<CefBrowser> createBrowser(const CefString& url, bool isPhantomMain,
-                                      const QJsonObject& config = {});
+                                      const QJsonObject& config = {},
+                                      CefRefPtr<CefRequestContext> requestContext = nullptr);
+
+  // When set, phantom main browsers are jobs of this server and closing them won't quit the application.
+  void setJobServer(JobServer* jobServer);
+
+  // When set, responses are served from and stored in the shared response cache.
+  void setResponseCache(std::shared_ptr<ResponseCache> responseCache);
+  // When set, responses are recorded into or replayed from the network archive.
+  void setNetworkArchive(std::shared_ptr<NetworkArchive> networkArchive);
+  // Replaces the default download manager, which runs at most four downloads at once.
+  void setDownloadManager(std::shared_ptr<DownloadManager> downloadManager);
+
+  int exitCode() const;
+  void setExitCode(int exitCode);
+
+  // Close all browsers and quit the application message loop afterwards.
+  void quit();
 
   // CefClient methods:
   virtual CefRefPtr<CefDisplayHandler> GetDisplayHandler() override
@@ -65,6 +94,7 @@ class PhantomJSHandler : public CefClient,
                              const CefString& message,
                              const CefString& source,
                              int line) override;
+  virtual void OnTitleChange(CefRefPtr<CefBrowser> browser, const CefString& title) override;
 
   // CefLifeSpanHandler methods:
   virtual void OnAfterCreated(CefRefPtr<CefBrowser> browser) override;
@@ -103,8 +133,19 @@ class PhantomJSHandler : public CefClient,
                                                       CefRefPtr<CefFrame> frame,
                                                       CefRefPtr<CefRequest> request,
                                                       CefRefPtr<CefRequestCallback> callback) override;
+  CefRefPtr<CefResourceHandler> GetResourceHandler(CefRefPtr<CefBrowser> browser, CefRefPtr<CefFrame> frame,
+                                                   CefRefPtr<CefRequest> request) override;
+  void OnResourceRedirect(CefRefPtr<CefBrowser> browser, CefRefPtr<CefFrame> frame,
+                          CefRefPtr<CefRequest> request, CefString& new_url) override;
   bool OnResourceResponse(CefRefPtr<CefBrowser> browser, CefRefPtr<CefFrame> frame,
                           CefRefPtr<CefRequest> request, CefRefPtr<CefResponse> response) override;
+#if CHROME_VERSION_BUILD >= 2526
+  CefRefPtr<CefResponseFilter> GetResourceResponseFilter(CefRefPtr<CefBrowser> browser, CefRefPtr<CefFrame> frame,
+                                                         CefRefPtr<CefRequest> request, CefRefPtr<CefResponse> response) override;
+  void OnResourceLoadComplete(CefRefPtr<CefBrowser> browser, CefRefPtr<CefFrame> frame,
+                              CefRefPtr<CefRequest> request, CefRefPtr<CefResponse> response,
+                              URLRequestStatus status, int64 received_content_length) override;
+#endif
   bool GetAuthCredentials(CefRefPtr<CefBrowser> browser, CefRefPtr<CefFrame> frame, bool isProxy,
                           const CefString & host, int port, const CefString & realm,
                           const CefString & scheme, CefRefPtr<CefAuthCallback> callback) override;
@@ -133,6 +174,35 @@ private:
   void emitSignal(const CefRefPtr<CefBrowser>& browser, const QString& signal,
                   const QJsonArray& arguments, bool internal = false);
   void handleLoadEnd(CefRefPtr<CefBrowser> browser, int statusCode, const CefString& url, bool success);
+  // id of the phantom main browser that (indirectly) created the given browser
+  int ownerId(int browserId) const;
+  // close the phantom main browser of a job together with all browsers it created
+  void closeJob(int browserId, int exitCode);
+  std::shared_ptr<HarRecorder> harRecorder(const CefRefPtr<CefBrowser>& browser);
+  void preconnect(CefRefPtr<CefBrowser> browser, const QJsonObject& json, CefRefPtr<Callback> callback);
+  // finishes the network archive and then quits the CEF message loop
+  void quitMessageLoop();
+
+  // network related settings of a web page, applied in the browser process
+  struct NetworkSettings
+  {
+    // in ms, 0 disables the timeout
+    int resourceTimeout = 0;
+    // bit mask of the cef_resource_type_t values that are cancelled right away
+    quint32 blockedResourceTypes = 0;
+    // network emulation, see ProxyResourceHandler::Options
+    int latency = 0;
+    qint64 downloadThroughput = 0;
+    qint64 uploadThroughput = 0;
+    double failureRate = 0;
+
+    bool emulatesNetwork() const
+    {
+      return latency > 0 || downloadThroughput > 0 || uploadThroughput > 0 || failureRate > 0;
+    }
+  };
+  void setNetworkSettings(int browserId, const QJsonObject& settings);
+  NetworkSettings networkSettings(const CefRefPtr<CefBrowser>& browser);
 
   // List of existing browser windows. Only accessed on the CEF UI thread.
   struct BrowserInfo
@@ -142,9 +212,43 @@ private:
     CefString authPassword;
     CefRefPtr<CefMessageRouterBrowserSide::Callback> signalCallback;
     bool firstLoadFinished = false;
+    bool isPhantomMain = false;
+    int ownerId = -1;
+    int exitCode = 0;
   };
   QHash<int, BrowserInfo> m_browsers;
 
+  JobServer* m_jobServer = nullptr;
+  std::shared_ptr<ResponseCache> m_responseCache;
+  std::shared_ptr<NetworkArchive> m_networkArchive;
+  std::shared_ptr<DownloadManager> m_downloadManager;
+  std::shared_ptr<Preconnector> m_preconnector;
+#if CHROME_VERSION_BUILD >= 2526
+  // response bodies recorded for the cache or archive, only accessed on the CEF IO thread
+  QHash<uint64, CefRefPtr<BodyRecorder>> m_bodyRecorders;
+#endif
+  // status and status text of redirect responses, taken in OnResourceRedirect which
+  // doesn't get the response, only accessed on the CEF IO thread
+  QHash<uint64, QPair<int, QString>> m_redirectStatus;
+  // HAR recorders per browser, accessed on the UI and IO threads
+  QMutex m_harMutex;
+  QHash<int, std::shared_ptr<HarRecorder>> m_harRecorders;
+  // network settings per browser, accessed on the UI and IO threads
+  QMutex m_networkSettingsMutex;
+  QHash<int, NetworkSettings> m_networkSettings;
+  // requests cancelled due to the blocked resource types per browser, guarded by m_networkSettingsMutex
+  struct BlockStatistics
+  {
+    qint64 requests = 0;
+    qint64 estimatedBytes = 0;
+    QHash<int, qint64> requestsPerType;
+  };
+  QHash<int, BlockStatistics> m_blockStatistics;
+  // number and total size of the loaded resources per type, used to estimate the bytes saved by blocking
+  QHash<int, QPair<qint64, qint64>> m_resourceSizes;
+  int m_exitCode = 0;
+  bool m_quitting = false;
+
   CefRefPtr<CefMessageRouterBrowserSide> m_messageRouter;
   // NOTE: using QHash prevents a strange ABI issue discussed here: http://www.magpcss.org/ceforum/viewtopic.php?f=6&t=13543
   QMultiHash<int32, CefRefPtr<CefMessageRouterBrowserSide::Callback>> m_waitForLoadedCallbacks;
@@ -163,13 +267,18 @@ private:
     CefRefPtr<CefRequest> request;
     CefRefPtr<CefRequestCallback> callback;
   };
+  // pending requests of OnBeforeResourceLoad, accessed on the UI and IO threads
+  QMutex m_requestCallbacksMutex;
   QHash<uint64, RequestInfo> m_requestCallbacks;
   struct DownloadTargetInfo
   {
+    int id;
     QString target;
     CefRefPtr<CefMessageRouterBrowserSide::Callback> callback;
   };
-  QHash<QString, DownloadTargetInfo> m_downloadTargets;
+  QHash<QString, QQueue<DownloadTargetInfo>> m_downloadTargets;
+  // maps the CEF download item ids to the ids of the download manager
+  QHash<uint, int> m_managedDownloads;
   QHash<uint, CefRefPtr<CefBeforeDownloadCallback>> m_beforeDownloadCallbacks;
   QHash<uint, CefRefPtr<CefDownloadItemCallback>> m_downloadItemCallbacks;
   QHash<uint, CefRefPtr<CefMessageRouterBrowserSide::Callback>> m_downloadCallbacks;
@@ -0,0 +1,344 @@
+// Copyright (c) 2015 Klaralvdalens Datakonsult AB (KDAB).
+// All rights reserved. Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include "har.h"
+
+#include <QDateTime>
+#include <QJsonDocument>
+#include <QUrl>
+#include <QUrlQuery>
+
+#include <chrono>
+
+#include "include/cef_task.h"
+#include "include/cef_version.h"
+
+#include "task.h"
+#include "debug.h"
+
+namespace {
+
+double now()
+{
+  using namespace std::chrono;
+  return duration<double, std::milli>(steady_clock::now().time_since_epoch()).count();
+}
+
+QString isoNow()
+{
+  return QDateTime::currentDateTimeUtc().toString(QStringLiteral("yyyy-MM-ddTHH:mm:ss.zzzZ"));
+}
+
+template<typename T>
+QJsonArray headersToHar(const CefRefPtr<T>& r)
+{
+  QJsonArray headers;
+  typename T::HeaderMap headerMap;
+  r->GetHeaderMap(headerMap);
+  for (const auto& header : headerMap) {
+    headers.append(QJsonObject{
+      {QStringLiteral("name"), QString::fromStdString(header.first)},
+      {QStringLiteral("value"), QString::fromStdString(header.second)}
+    });
+  }
+  return headers;
+}
+
+qint64 postDataSize(const CefRefPtr<CefRequest>& request)
+{
+  const auto post = request->GetPostData();
+  if (!post) {
+    return 0;
+  }
+  qint64 size = 0;
+  CefPostData::ElementVector elements;
+  post->GetElements(elements);
+  for (const auto& element : elements) {
+    size += element->GetBytesCount();
+  }
+  return size;
+}
+
+QJsonObject requestToHar(const CefRefPtr<CefRequest>& request, const QString& url)
+{
+  QJsonArray queryString;
+  foreach (const auto& item, QUrlQuery(QUrl(url)).queryItems(QUrl::FullyDecoded)) {
+    queryString.append(QJsonObject{{QStringLiteral("name"), item.first}, {QStringLiteral("value"), item.second}});
+  }
+  return {
+    {QStringLiteral("method"), QString::fromStdString(request->GetMethod())},
+    {QStringLiteral("url"), url},
+    {QStringLiteral("httpVersion"), QString()},
+    {QStringLiteral("cookies"), QJsonArray()},
+    {QStringLiteral("headers"), headersToHar(request)},
+    {QStringLiteral("queryString"), queryString},
+    {QStringLiteral("headersSize"), -1},
+    {QStringLiteral("bodySize"), static_cast<double>(postDataSize(request))}
+  };
+}
+}
+
+HarRecorder::HarRecorder(const QString& path)
+  : m_file(path)
+{
+}
+
+bool HarRecorder::open()
+{
+  if (!m_file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+    return false;
+  }
+  const QJsonObject creator = {
+    {QStringLiteral("name"), QStringLiteral("phantomjs-cef")},
+    {QStringLiteral("version"), QStringLiteral(CEF_VERSION)}
+  };
+  m_file.write("{\"log\":{\"version\":\"1.2\",\"creator\":");
+  m_file.write(QJsonDocument(creator).toJson(QJsonDocument::Compact));
+  m_file.write(",\"entries\":[\n");
+  return true;
+}
+
+QString HarRecorder::errorString() const
+{
+  return m_file.errorString();
+}
+
+void HarRecorder::startPage(const QString& url)
+{
+  QMutexLocker lock(&m_mutex);
+  m_pageStart = now();
+  m_pages.append(QJsonObject{
+    {QStringLiteral("startedDateTime"), isoNow()},
+    {QStringLiteral("id"), QStringLiteral("page_%1").arg(m_pages.size() + 1)},
+    {QStringLiteral("title"), url},
+    {QStringLiteral("pageTimings"), QJsonObject{
+      {QStringLiteral("onContentLoad"), -1},
+      {QStringLiteral("onLoad"), -1}
+    }}
+  });
+}
+
+void HarRecorder::setPageTitle(const QString& title)
+{
+  QMutexLocker lock(&m_mutex);
+  if (m_pages.isEmpty() || title.isEmpty()) {
+    return;
+  }
+  auto page = m_pages.last().toObject();
+  page[QStringLiteral("title")] = title;
+  m_pages[m_pages.size() - 1] = page;
+}
+
+void HarRecorder::finishPage()
+{
+  QMutexLocker lock(&m_mutex);
+  if (m_pages.isEmpty()) {
+    return;
+  }
+  auto page = m_pages.last().toObject();
+  auto timings = page.value(QStringLiteral("pageTimings")).toObject();
+  if (timings.value(QStringLiteral("onLoad")).toDouble() >= 0) {
+    return;
+  }
+  timings[QStringLiteral("onLoad")] = now() - m_pageStart;
+  page[QStringLiteral("pageTimings")] = timings;
+  m_pages[m_pages.size() - 1] = page;
+}
+
+void HarRecorder::requestStarted(CefRefPtr<CefRequest> request)
+{
+  Entry entry;
+  entry.startedDateTime = isoNow();
+  entry.start = now();
+  entry.request = requestToHar(request, QString::fromStdString(request->GetURL()));
+
+  QMutexLocker lock(&m_mutex);
+  if (m_pages.size()) {
+    entry.request[QStringLiteral("_pageref")] = m_pages.last().toObject().value(QStringLiteral("id"));
+  }
+  m_entries[request->GetIdentifier()] = entry;
+}
+
+void HarRecorder::responseStarted(CefRefPtr<CefRequest> request, CefRefPtr<CefResponse> response)
+{
+  const QJsonObject jsonResponse = {
+    {QStringLiteral("status"), response->GetStatus()},
+    {QStringLiteral("statusText"), QString::fromStdString(response->GetStatusText())},
+    {QStringLiteral("httpVersion"), QString()},
+    {QStringLiteral("cookies"), QJsonArray()},
+    {QStringLiteral("headers"), headersToHar(response)},
+    {QStringLiteral("redirectURL"), QString::fromStdString(response->GetHeader("Location"))},
+    {QStringLiteral("headersSize"), -1}
+  };
+
+  QMutexLocker lock(&m_mutex);
+  auto it = m_entries.find(request->GetIdentifier());
+  if (it != m_entries.end()) {
+    it->responseStart = now();
+    it->response = jsonResponse;
+  }
+}
+
+void HarRecorder::redirected(CefRefPtr<CefRequest> request, const QString& newUrl, int status,
+                             const QString& statusText)
+{
+  const auto end = now();
+
+  QMutexLocker lock(&m_mutex);
+  auto it = m_entries.find(request->GetIdentifier());
+  if (it == m_entries.end()) {
+    return;
+  }
+  // every hop of the chain gets its own entry, with the headers when the redirect response was seen
+  QJsonObject response = it->response;
+  if (response.isEmpty()) {
+    response = {
+      {QStringLiteral("status"), status},
+      {QStringLiteral("statusText"), statusText},
+      {QStringLiteral("httpVersion"), QString()},
+      {QStringLiteral("cookies"), QJsonArray()},
+      {QStringLiteral("headers"), QJsonArray()},
+      {QStringLiteral("headersSize"), -1}
+    };
+  }
+  response[QStringLiteral("redirectURL")] = newUrl;
+  response[QStringLiteral("bodySize")] = -1;
+  response[QStringLiteral("content")] = QJsonObject{{QStringLiteral("size"), 0}, {QStringLiteral("mimeType"), QString()}};
+  if (it->responseStart < 0) {
+    it->responseStart = end;
+  }
+  writeEntry(*it, end, response);
+
+  // the request continues with the same identifier for the new URL
+  Entry next;
+  next.startedDateTime = isoNow();
+  next.start = end;
+  next.request = requestToHar(request, newUrl);
+  next.request[QStringLiteral("_pageref")] = it->request.value(QStringLiteral("_pageref"));
+  *it = next;
+}
+
+void HarRecorder::requestFinished(CefRefPtr<CefRequest> request, CefRefPtr<CefResponse> response, bool success,
+                                  qint64 receivedBytes, qint64 decodedSize)
+{
+  const auto end = now();
+
+  QMutexLocker lock(&m_mutex);
+  auto it = m_entries.find(request->GetIdentifier());
+  if (it == m_entries.end()) {
+    return;
+  }
+  const auto entry = m_entries.take(request->GetIdentifier());
+  auto jsonResponse = entry.response;
+  if (jsonResponse.isEmpty()) {
+    jsonResponse = {
+      {QStringLiteral("status"), response ? response->GetStatus() : 0},
+      {QStringLiteral("statusText"), QString()},
+      {QStringLiteral("httpVersion"), QString()},
+      {QStringLiteral("cookies"), QJsonArray()},
+      {QStringLiteral("headers"), QJsonArray()},
+      {QStringLiteral("redirectURL"), QString()},
+      {QStringLiteral("headersSize"), -1}
+    };
+  }
+  jsonResponse[QStringLiteral("bodySize")] = static_cast<double>(receivedBytes);
+  jsonResponse[QStringLiteral("content")] = QJsonObject{
+    {QStringLiteral("size"), static_cast<double>(decodedSize >= 0 ? decodedSize : receivedBytes)},
+    {QStringLiteral("mimeType"), response ? QString::fromStdString(response->GetMimeType()) : QString()}
+  };
+  if (!success) {
+    jsonResponse[QStringLiteral("_error")] = QStringLiteral("failed");
+  }
+  writeEntry(entry, end, jsonResponse);
+}
+
+void HarRecorder::writeEntry(const Entry& entry, double end, const QJsonObject& response)
+{
+  // must be called with m_mutex locked
+  if (m_closed) {
+    return;
+  }
+  const auto responseStart = entry.responseStart >= 0 ? entry.responseStart : end;
+  const QJsonObject timings = {
+    {QStringLiteral("blocked"), -1},
+    {QStringLiteral("dns"), -1},
+    {QStringLiteral("connect"), -1},
+    {QStringLiteral("ssl"), -1},
+    {QStringLiteral("send"), 0},
+    {QStringLiteral("wait"), responseStart - entry.start},
+    {QStringLiteral("receive"), end - responseStart}
+  };
+  auto request = entry.request;
+  const auto pageref = request.take(QStringLiteral("_pageref"));
+  QJsonObject jsonEntry = {
+    {QStringLiteral("startedDateTime"), entry.startedDateTime},
+    {QStringLiteral("time"), end - entry.start},
+    {QStringLiteral("request"), request},
+    {QStringLiteral("response"), response},
+    {QStringLiteral("cache"), QJsonObject()},
+    {QStringLiteral("timings"), timings}
+  };
+  if (!pageref.isUndefined()) {
+    jsonEntry[QStringLiteral("pageref")] = pageref;
+  }
+  ++m_entryCount;
+  write(QJsonDocument(jsonEntry).toJson(QJsonDocument::Compact));
+}
+
+void HarRecorder::write(const QByteArray& data)
+{
+  auto self = shared_from_this();
+  CefPostTask(TID_FILE, makeTask([self, data] () {
+    if (!self->m_firstEntry) {
+      self->writeToFile(",\n");
+    }
+    self->m_firstEntry = false;
+    self->writeToFile(data);
+  }));
+}
+
+void HarRecorder::writeToFile(const QByteArray& data)
+{
+  if (m_file.write(data) != data.size() && m_writeError.isEmpty()) {
+    m_writeError = m_file.errorString();
+  }
+}
+
+void HarRecorder::close(std::function<void(const QJsonObject& summary)> done)
+{
+  QMutexLocker lock(&m_mutex);
+  if (m_closed) {
+    return;
+  }
+  m_closed = true;
+  // requests that are still pending are dropped
+  m_entries.clear();
+
+  const QJsonObject summary = {
+    {QStringLiteral("path"), m_file.fileName()},
+    {QStringLiteral("entries"), m_entryCount},
+    {QStringLiteral("pages"), m_pages.size()}
+  };
+  const auto pages = QJsonDocument(m_pages).toJson(QJsonDocument::Compact);
+  auto self = shared_from_this();
+  CefPostTask(TID_FILE, makeTask([self, pages, summary, done] () {
+    self->writeToFile("\n],\"pages\":");
+    self->writeToFile(pages);
+    self->writeToFile("}}\n");
+    if (!self->m_file.flush() && self->m_writeError.isEmpty()) {
+      self->m_writeError = self->m_file.errorString();
+    }
+    self->m_file.close();
+    auto result = summary;
+    if (!self->m_writeError.isEmpty()) {
+      qCWarning(network) << "failed to write HAR" << self->m_file.fileName() << self->m_writeError;
+      result[QStringLiteral("error")] = self->m_writeError;
+    } else {
+      qCDebug(network) << "finished HAR" << summary;
+    }
+    if (done) {
+      done(result);
+    }
+  }));
+}
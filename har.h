@@ -0,0 +1,85 @@
+// Copyright (c) 2015 Klaralvdalens Datakonsult AB (KDAB).
+// All rights reserved. Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#ifndef PHANTOMJS_HAR_H
+#define PHANTOMJS_HAR_H
+
+#include <QFile>
+#include <QHash>
+#include <QJsonArray>
+#include <QJsonObject>
+#include <QMutex>
+
+#include <functional>
+#include <memory>
+
+#include "include/cef_request.h"
+#include "include/cef_response.h"
+
+/**
+ * Streams the network activity of a single page into a HAR 1.2 file.
+ *
+ * Entries are written to disk on the CEF FILE thread as soon as a request
+ * finished, so long running pages don't accumulate them in memory. The pages
+ * array follows the entries, since it is only complete when recording stops.
+ *
+ * CEF doesn't expose Chromium's load timing, so the blocked, dns, connect and
+ * ssl phases are reported as -1. The wait phase spans from sending the request
+ * to receiving the response headers, i.e. it includes connection setup for new
+ * connections, followed by the receive phase until the load completed.
+ *
+ * All methods may be called from the UI and IO threads.
+ */
+class HarRecorder : public std::enable_shared_from_this<HarRecorder>
+{
+public:
+  explicit HarRecorder(const QString& path);
+
+  bool open();
+  QString errorString() const;
+
+  // main frame navigations, the page title is the URL until the document title is known
+  void startPage(const QString& url);
+  void setPageTitle(const QString& title);
+  void finishPage();
+
+  void requestStarted(CefRefPtr<CefRequest> request);
+  void responseStarted(CefRefPtr<CefRequest> request, CefRefPtr<CefResponse> response);
+  // @p status and @p statusText are used when the redirect response was not seen by responseStarted
+  void redirected(CefRefPtr<CefRequest> request, const QString& newUrl, int status, const QString& statusText);
+  // @p decodedSize is the size of the decoded body, or -1 if unknown
+  void requestFinished(CefRefPtr<CefRequest> request, CefRefPtr<CefResponse> response, bool success,
+                       qint64 receivedBytes, qint64 decodedSize);
+
+  // finish the HAR file, @p done is called on the FILE thread once everything was written
+  // the summary contains an "error" when writing the file failed
+  void close(std::function<void(const QJsonObject& summary)> done);
+
+private:
+  struct Entry
+  {
+    QString startedDateTime;
+    double start = 0;
+    double responseStart = -1;
+    QJsonObject request;
+    QJsonObject response;
+  };
+  void writeEntry(const Entry& entry, double end, const QJsonObject& response);
+  void write(const QByteArray& data);
+  // only called on the FILE thread, remembers the first error
+  void writeToFile(const QByteArray& data);
+
+  QFile m_file;
+  QMutex m_mutex;
+  QHash<uint64, Entry> m_entries;
+  QJsonArray m_pages;
+  double m_pageStart = 0;
+  int m_entryCount = 0;
+  bool m_closed = false;
+  // only accessed on the FILE thread
+  bool m_firstEntry = true;
+  QString m_writeError;
+};
+
+#endif // PHANTOMJS_HAR_H
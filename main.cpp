@@ -7,10 +7,12 @@
 #endif
 
 #include <QGuiApplication>
-#include <QStandardPaths>
 #include <QtPlugin>
 
 #include "app.h"
+#include "cache.h"
+#include "config.h"
+#include "startup.h"
 
 #include "include/base/cef_logging.h"
 
@@ -35,6 +37,8 @@ Q_IMPORT_PLUGIN (QMinimalIntegrationPlugin);
 
 int main(int argc, char** argv)
 {
+  const auto process_start = startupTimestamp();
+
   void* sandbox_info = NULL;
 
 #if OS_WIN
@@ -66,6 +70,8 @@ int main(int argc, char** argv)
     return exit_code;
   }
 
+  recordStartupTiming("processStart", process_start);
+
   if (argc < 2) {
     std::cerr << "Missing script parameter.\n";
     return 1;
@@ -76,16 +82,29 @@ int main(int argc, char** argv)
   QGuiApplication qtApp(argc, argv);
   Q_UNUSED(qtApp);
 
+  // NOTE: the global command line is only available after CefInitialize
+  CefRefPtr<CefCommandLine> command_line = CefCommandLine::CreateCommandLine();
+#if OS_WIN
+  command_line->InitFromString(::GetCommandLineW());
+#else
+  command_line->InitFromArgv(argc, argv);
+#endif
+  if (!applyConfig(command_line)) {
+    return 1;
+  }
+  // forward the switches of the config file and preset to Chromium
+  app->setCommandLine(command_line);
+
   // Specify CEF global settings here.
   CefSettings settings;
-  // TODO: make this configurable like previously in phantomjs
-  settings.ignore_certificate_errors = true;
-  settings.remote_debugging_port = 12345;
-  settings.windowless_rendering_enabled = true;
-  // NOTE: accessing the file system requires us to disable sandboxing
-  settings.no_sandbox = true;
-
-  const auto cachePath = QStandardPaths::writableLocation(QStandardPaths::CacheLocation);
+  initCefSettings(settings, command_line);
+
+  // every instance may get its own cache, which must outlive CefShutdown
+  CacheDirectory cacheDirectory(command_line);
+  if (!cacheDirectory.isValid()) {
+    return 1;
+  }
+  const auto cachePath = cacheDirectory.path();
 #if OS_WIN
   const auto wPath = cachePath.toStdWString();
   cef_string_set(wPath.data(), wPath.size(), &settings.cache_path, 1);
@@ -93,17 +112,19 @@ int main(int argc, char** argv)
   cef_string_set(cachePath.utf16(), cachePath.size(), &settings.cache_path, 1);
 #endif
 
-  //   settings.log_severity = LOGSEVERITY_VERBOSE;
-
   // Initialize CEF for the browser process.
+  recordStartupTiming("cefInitializeStart");
   CefInitialize(main_args, settings, app, NULL);
+  recordStartupTiming("cefInitializeEnd");
 
   // Run the CEF message loop. This will block until CefQuitMessageLoop() is
   // called.
   CefRunMessageLoop();
 
+  exit_code = app->exitCode();
+
   // Shut down CEF.
   CefShutdown();
 
-  return 0;
+  return exit_code;
 }
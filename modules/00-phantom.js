@@ -43,9 +43,10 @@ if (!phantom)
     throw Error("require(" + file + ") is not yet implemented");
   };
 
-  phantom.exit = function() {
+  phantom.exit = function(code) {
     native function exit();
-    exit();
+    // ignore non-numeric values, e.g. when used as promise continuation via .then(phantom.exit)
+    exit(typeof(code) === "number" ? code : 0);
   };
 
   phantom.injectJs = function(file) {
@@ -62,6 +63,43 @@ if (!phantom)
     return true;
   };
 
+  // resolves to the hits, misses and stored bytes of the shared response cache, or null when disabled
+  phantom.responseCacheStatistics = function() {
+    return phantom.internal.query({type: "responseCacheStatistics"}).then(function(statistics) {
+      return JSON.parse(statistics);
+    });
+  };
+
+  // hints Chromium to warm up DNS, TCP and TLS for the origins of the given URLs ahead of navigations,
+  // resolves to the hinted origins
+  phantom.preconnect = function(urls) {
+    return phantom.internal.query({
+      type: "preconnect",
+      urls: Array.isArray(urls) ? urls : [urls]
+    }).then(function(results) {
+      return JSON.parse(results);
+    });
+  };
+
+  // resolves to the navigations with and without a preceding preconnect per hinted origin
+  // with their average time to first byte
+  phantom.preconnectStatistics = function() {
+    return phantom.internal.query({type: "preconnectStatistics"}).then(function(statistics) {
+      return JSON.parse(statistics);
+    });
+  };
+
+  // resolves to the running, queued, completed and failed downloads of page.download,
+  // optionally changes the number of downloads that may run at the same time
+  phantom.downloadStatistics = function(maxConcurrent) {
+    return phantom.internal.query({
+      type: "downloadStatistics",
+      maxConcurrent: maxConcurrent || 0
+    }).then(function(statistics) {
+      return JSON.parse(statistics);
+    });
+  };
+
   // can be overwritten by the user
   phantom.onError = null;
 
@@ -167,6 +205,36 @@ if (!phantom)
       native function readFile();
       return readFile(file);
     },
+    // called from the bootstrap code with the startup timings recorded in the browser process
+    initStartupTimings: function(browserTimings) {
+      native function startupTimings();
+      var phases = [];
+      function add(timings) {
+        for (var phase in timings) {
+          phases.push({phase: phase, time: timings[phase]});
+        }
+      }
+      add(browserTimings);
+      add(startupTimings());
+      add({bootstrapExecuted: Date.now()});
+      phases.sort(function(a, b) { return a.time - b.time; });
+      // all timings are given in ms relative to the start of the browser process
+      var start = browserTimings.processStart;
+      phantom.internal.processStart = start;
+      phantom.startupTimings = {};
+      phases.forEach(function(entry) {
+        phantom.startupTimings[entry.phase] = entry.time - start;
+      });
+    },
+    // called from the bootstrap code to execute the user provided script
+    runScript: function(file) {
+      native function runScript();
+      phantom.startupTimings.scriptStart = Date.now() - phantom.internal.processStart;
+      if (!runScript(file)) {
+        phantom.internal.onScriptLoadError();
+      }
+    },
+    processStart: 0,
     onScriptLoadError: function() {
       native function printError();
       printError("Failed to load script \""+ phantom.args[0] + "\". Exiting now.");
@@ -174,9 +242,10 @@ if (!phantom)
     }
   };
 
-  // will be initialized from code executed via PhantomJSApp::OnContextInitialized
+  // will be initialized from code executed via PhantomJSApp::runScript
   phantom.args = [];
   phantom.libraryPath = "";
+  phantom.startupTimings = {};
 
   phantom.wait = function(msDelay) {
     return new Promise(function (fulfill) {
@@ -44,20 +44,27 @@
       zoomFactor: 1.,
       createBrowser: null,
       id: null,
+      openCount: 0,
+      mainFrameResponded: false,
       dispatchSignal: function(signal, args) {
+        var result;
         if (typeof(webpage[signal]) === "function") {
-          webpage[signal].apply(webpage, args);
+          result = webpage[signal].apply(webpage, args);
         }
         var waiter = internal.signalWaiters[signal];
         if (waiter) {
           delete internal.signalWaiters[signal];
           waiter.apply(webpage, args);
         }
+        return result;
       },
-      onBeforeResourceLoad: function(request, requestId) {
+      applySettings: function(request) {
         if (typeof(webpage.settings.userAgent) === "string") {
           request.headers["User-Agent"] = webpage.settings.userAgent;
         }
+      },
+      onBeforeResourceLoad: function(request, requestId) {
+        internal.applySettings(request);
         // TODO request.time
         var allow = true;
         var networkRequest = {
@@ -69,15 +76,37 @@
           },
           setHeader: function(key, value) {
             request.headers[key] = value;
+          },
+          // resolves to the body of the request, as UTF-8 string or base64 encoded
+          // if the encoding is "base64". Only request.post describes it upfront.
+          readPostData: function(encoding) {
+            return phantom.internal.query({
+              type: "readPostData",
+              requestId: requestId,
+              encoding: encoding
+            });
+          },
+          // replaces the body of the request, data is a string or base64 encoded if the encoding is "base64"
+          setPostData: function(data, encoding) {
+            request.postData = data;
+            request.postDataEncoding = encoding;
           }
         };
-        internal.dispatchSignal("onResourceRequested", [request, networkRequest]);
-        phantom.internal.query({
-          type: "beforeResourceLoadResponse",
-          requestId: requestId,
-          request: request,
-          allow: allow
-        });
+        function respond() {
+          phantom.internal.query({
+            type: "beforeResourceLoadResponse",
+            requestId: requestId,
+            request: request,
+            allow: allow
+          });
+        }
+        var result = internal.dispatchSignal("onResourceRequested", [request, networkRequest]);
+        if (result && typeof(result.then) === "function") {
+          // the request is held back until the returned promise settles, e.g. after reading the post data
+          result.then(respond, respond);
+        } else {
+          respond();
+        }
       },
       onLoadEnd: function(url, success) {
         internal.url = url;
@@ -112,25 +141,36 @@
           });
         }
       },
+      onMainFrameResponse: function() {
+        internal.mainFrameResponded = true;
+      },
       onPopupCreated: function(browserId) {
         var popup = new phantom.WebPage(browserId);
         internal.dispatchSignal("onPopupCreated", [popup]);
       },
+      // resolves to the id of the hidden browser used by prefetch
+      companion: null,
+      // the URL loaded by the companion, see prefetch
+      prefetched: null,
       signalWaiters: {}
     };
-    function initialize(id) {
-      internal.id = id;
-      // send current values of some properties
-      webpage.viewportSize = internal.viewportSize;
-      webpage.zoomFactor = internal.zoomFactor;
+    function subscribeSignals(id) {
       startPhantomJsQuery({
         request: JSON.stringify({
           type: 'webPageSignals',
-          browser: internal.id
+          browser: id
         }),
         persistent: true,
         onSuccess: function(response) {
           var response = JSON.parse(response);
+          if (id !== internal.id) {
+            // the signals of the companion browser are hidden from the script, except for its
+            // requests, which go through the same onResourceRequested handler as the ones of the page
+            if (response.signal === "onBeforeResourceLoad") {
+              internal.onBeforeResourceLoad.apply(webpage, response.args);
+            }
+            return;
+          }
           if (!response.internal) {
             internal.dispatchSignal(response.signal, response.args);
           } else {
@@ -140,6 +180,23 @@
         onFailure: function() {}
       });
     }
+    function sendProperties(id) {
+      ["viewportSize", "zoomFactor"].forEach(function(name) {
+        phantom.internal.query({
+          type: "setProperty",
+          name: name,
+          value: internal[name],
+          browser: id
+        });
+      });
+    }
+    function initialize(id) {
+      internal.id = id;
+      // send current values of some properties
+      webpage.viewportSize = internal.viewportSize;
+      webpage.zoomFactor = internal.zoomFactor;
+      subscribeSignals(id);
+    }
     if (popupId) {
       // this webpage got created from the onPopupCreated signal handler,
       // there is already a fully initialized browser on the other side
@@ -173,7 +230,7 @@
     this.onPaint = function() {};
     this.onResourceRequested = function(requestData, networkRequest) {};
     this.onResourceReceived = function(response) {};
-    // TODO: onResourceTimeout
+    this.onResourceTimeout = function(request) {};
     this.onDownloadUpdated = function(downloadItem) {};
     this.onBeforeDownload = function(downloadRequest) {};
     this.onPopupCreated = function(popup) {};
@@ -182,20 +239,114 @@
         internal.signalWaiters[signal] = resolve;
       });
     };
+    // loads url in a hidden companion browser, a later open(url) then swaps it in
+    // instead of loading the page again. Resolves to the load status.
+    this.prefetch = function(url) {
+      return createBrowser().then(function() {
+        if (!internal.companion) {
+          internal.companion = phantom.internal.query({
+            type: "createBrowser",
+            settings: webpage.settings
+          }).then(function(response) {
+            var id = parseInt(response);
+            subscribeSignals(id);
+            return id;
+          });
+        }
+        return internal.companion;
+      }).then(function(id) {
+        // a single load at a time, otherwise the previous prefetch would resolve with the next load
+        var previous = internal.prefetched;
+        return (previous ? previous.loaded : Promise.resolve()).then(function() {
+          return id;
+        });
+      }).then(function(id) {
+        sendProperties(id);
+        var prefetched = {url: url, id: id};
+        prefetched.loaded = phantom.internal.query({
+          type: "openWebPage",
+          url: url,
+          libraryPath: webpage.libraryPath,
+          settings: webpage.settings,
+          browser: id
+        }).then(function() {
+          return "success";
+        }, function() {
+          return "fail";
+        });
+        internal.prefetched = prefetched;
+        return prefetched.loaded;
+      });
+    };
+    function swapPrefetched(url) {
+      var prefetched = internal.prefetched;
+      internal.prefetched = null;
+      internal.dispatchSignal("onLoadStarted", [url]);
+      return prefetched.loaded.then(function(status) {
+        var previous = internal.id;
+        internal.id = prefetched.id;
+        internal.url = url;
+        // the HAR capture and the current network settings move along to the swapped in browser
+        phantom.internal.query({
+          type: "swapBrowser",
+          previous: previous,
+          settings: webpage.settings,
+          browser: prefetched.id
+        });
+        // the previous browser becomes the companion for the next prefetch, once it got cleared
+        internal.companion = phantom.internal.query({
+          type: "openWebPage",
+          url: "about:blank",
+          browser: previous
+        }).then(function() {
+          return previous;
+        }, function() {
+          return previous;
+        });
+        internal.dispatchSignal("onLoadFinished", [status, url]);
+        if (status !== "success") {
+          throw new Error("Failed to load " + url);
+        }
+      });
+    }
     this.open = function(url, callback) {
+      var openId = ++internal.openCount;
+      internal.mainFrameResponded = false;
+      if (internal.prefetched && internal.prefetched.url === url) {
+        var swapped = swapPrefetched(url);
+        if (typeof(callback) === "function") {
+          return swapped.then(function() {
+            callback("success");
+          }, function() {
+            callback("fail");
+          });
+        }
+        return swapped;
+      }
       var ret = createBrowser().then(function() {
         return phantom.internal.query({
           type: "openWebPage",
           url: url,
           libraryPath: webpage.libraryPath,
+          settings: webpage.settings,
           browser: internal.id})
       });
-      // TODO: this is just a workaround as it won't catch timeouts
-      //       for embedded resources such as images or scripts.
-      //       http://www.magpcss.org/ceforum/viewtopic.php?f=6&t=13080&p=28385#p28385
+      // embedded resources such as images or scripts are cancelled individually
+      // by the browser process, which reports them via onResourceTimeout. Only
+      // a main document that doesn't respond in time stops the whole page.
       if (webpage.settings.resourceTimeout > 0) {
-        ret = Promise.race([ret,
+        var loaded = ret;
+        ret = Promise.race([loaded,
             phantom.wait(webpage.settings.resourceTimeout).then(function() {
+              if (internal.mainFrameResponded || openId !== internal.openCount) {
+                return loaded;
+              }
+              internal.dispatchSignal("onResourceTimeout", [{
+                url: url,
+                time: new Date().toISOString(),
+                errorCode: 408,
+                errorString: "Network timeout on resource."
+              }]);
               webpage.stop();
               return webpage.waitForLoaded();
             })]);
@@ -306,15 +457,23 @@
       if (internal.id === null) {
         return;
       }
-      startPhantomJsQuery({
-        request: JSON.stringify({
-          type: 'closeWebPage',
-          browser: internal.id
-        }),
-        persistent: false,
-        onSuccess: function() {},
-        onFailure: function() {}
-      });
+      function closeBrowser(id) {
+        startPhantomJsQuery({
+          request: JSON.stringify({
+            type: 'closeWebPage',
+            browser: id
+          }),
+          persistent: false,
+          onSuccess: function() {},
+          onFailure: function() {}
+        });
+      }
+      closeBrowser(internal.id);
+      if (internal.companion) {
+        internal.companion.then(closeBrowser);
+        internal.companion = null;
+        internal.prefetched = null;
+      }
       internal.id = null;
     };
     this.evaluateJavaScript = function(code) {
@@ -383,18 +542,68 @@
         browser: internal.id
       });
     };
+    // target is either the path of the file or an object with the following options:
+    //   sink: "file" (default), "memory" or "stream", the latter writes to any path, e.g. a named pipe
+    //   target: the path for the "file" and "stream" sinks
+    //   digests: algorithms to hash the body with while it arrives, e.g. ["sha256", "xxh64"]
+    //   maxSize: in bytes, the "memory" sink fails for larger bodies, default 256MB
+    // in memory downloads resolve with the base64 encoded body as data
     this.download = function(source, target) {
+      var options = typeof(target) === "object" ? target : {target: target};
       return createBrowser().then(function() {
         return phantom.internal.query({
           type: 'download',
           source: source,
-          target: target,
+          options: options,
           browser: internal.id
         }).then(function(downloadItem) {
           return JSON.parse(downloadItem);
         });
       });
     };
+    // stream all requests of this page into a HAR file until stopHar is called or the page gets closed
+    this.startHar = function(path) {
+      return createBrowser().then(function() {
+        return phantom.internal.query({
+          type: 'startHar',
+          path: path,
+          browser: internal.id
+        });
+      });
+    };
+    // resolves to the path and the number of entries and pages once the HAR file is complete
+    this.stopHar = function() {
+      verifyBrowserCreated();
+      return phantom.internal.query({
+        type: 'stopHar',
+        browser: internal.id
+      }).then(function(summary) {
+        return JSON.parse(summary);
+      });
+    };
+    // like phantom.preconnect, but for the request context of this page
+    this.preconnect = function(urls) {
+      return createBrowser().then(function() {
+        return phantom.internal.query({
+          type: 'preconnect',
+          urls: Array.isArray(urls) ? urls : [urls],
+          browser: internal.id
+        });
+      }).then(function(results) {
+        return JSON.parse(results);
+      });
+    };
+    // resolves to the number of requests cancelled due to settings.blockResourceTypes,
+    // per type and in total, as well as an estimate of the bytes that were not loaded
+    this.blockStatistics = function() {
+      verifyBrowserCreated();
+      return phantom.internal.query({
+        type: 'blockStatistics',
+        browser: internal.id
+      }).then(function(statistics) {
+        return JSON.parse(statistics);
+      });
+    };
     this.injectJs = function(file) {
       verifyBrowserCreated();
       var path = phantom.internal.findLibrary(file, webpage.libraryPath);
@@ -456,8 +665,37 @@
       userAgent: null,
       userName: null,
       password: null,
-      resourceTimeout: 30 * 1000, // ms timeout
+      blockResourceTypes: [], // e.g. ["image", "font", "media", "stylesheet"]
+      // e.g. {latency: 150, downloadThroughput: 200 * 1024, uploadThroughput: 50 * 1024, failureRate: 0.01}
+      // with the latency in ms and the throughput in bytes per second
+      networkEmulation: null,
     };
+    // in ms, the default only applies to the main document, see open. Sub resources are loaded
+    // by the browser process to time them out individually, which is only done when the script
+    // sets the timeout explicitly. toJSON thus leaves out the default.
+    var resourceTimeout = 30 * 1000;
+    var resourceTimeoutSet = false;
+    Object.defineProperty(this.settings, "resourceTimeout", {
+      enumerable: true,
+      get: function() {
+        return resourceTimeout;
+      },
+      set: function(value) {
+        resourceTimeout = value;
+        resourceTimeoutSet = true;
+      }
+    });
+    Object.defineProperty(this.settings, "toJSON", {
+      value: function() {
+        var settings = {};
+        for (var key in this) {
+          if (key !== "resourceTimeout" || resourceTimeoutSet) {
+            settings[key] = this[key];
+          }
+        }
+        return settings;
+      }
+    });
     function addProperty(name, object) {
       Object.defineProperty(object, name, {
         get: function() {
@@ -1,7 +1,192 @@
 (function() {
 
+  // Converts the result of the binary natives, an ArrayBuffer or a string with one character per byte.
+  function toBytes(data) {
+    if (typeof data !== "string") {
+      return new Uint8Array(data);
+    }
+    var bytes = new Uint8Array(data.length);
+    for (var i = 0; i < data.length; ++i) {
+      bytes[i] = data.charCodeAt(i);
+    }
+    return bytes;
+  }
+
+  // Converts an ArrayBuffer or typed array into a string with one character per byte for the binary natives.
+  function fromBytes(data) {
+    if (typeof data === "string") {
+      return data;
+    }
+    var bytes = ArrayBuffer.isView(data) ? new Uint8Array(data.buffer, data.byteOffset, data.byteLength)
+                                         : new Uint8Array(data);
+    var chunks = [];
+    for (var i = 0; i < bytes.length; i += 8192) {
+      chunks.push(String.fromCharCode.apply(null, bytes.subarray(i, i + 8192)));
+    }
+    return chunks.join("");
+  }
+
+  // Hashes a string, which is UTF-8 encoded, or the bytes of an ArrayBuffer or typed array.
+  // Supported algorithms are xxh3, crc32c, sha256, xxh64, md5, sha1 and sha512, sha256 is the default.
+  // Returns the hex encoded digest.
+  phantom.hash = function(data, algorithm) {
+    native function hashData();
+    var binary = typeof data !== "string";
+    return hashData(binary ? fromBytes(data) : data, algorithm || "sha256", binary);
+  };
+
+  // A file opened via fs.open, see FileStreams in the renderer process.
+  function FileStream(id) {
+    this._id = id;
+  }
+
+  // Reads @p size bytes or everything up to the end of the file.
+  FileStream.prototype.read = function(size) {
+    native function fileRead();
+    return size === undefined ? fileRead(this._id) : fileRead(this._id, size);
+  };
+
+  // Reads the next line without the trailing line break, check atEnd() to detect the end of the file.
+  FileStream.prototype.readLine = function() {
+    native function fileReadLine();
+    return fileReadLine(this._id);
+  };
+
+  // Like read, but returns a Uint8Array independent of the mode of the stream.
+  FileStream.prototype.readBinary = function(size) {
+    native function fileReadBinary();
+    return toBytes(size === undefined ? fileReadBinary(this._id) : fileReadBinary(this._id, size));
+  };
+
+  // Writes an ArrayBuffer or typed array as is.
+  FileStream.prototype.writeBinary = function(data) {
+    native function fileWriteBinary();
+    return fileWriteBinary(this._id, fromBytes(data));
+  };
+
+  // The bytes in [start, end) without moving the position, end defaults to the end of the file.
+  FileStream.prototype.slice = function(start, end) {
+    native function fileSlice();
+    return end === undefined ? fileSlice(this._id, start) : fileSlice(this._id, start, end);
+  };
+
+  FileStream.prototype.size = function() {
+    native function fileSize();
+    return fileSize(this._id);
+  };
+
+  FileStream.prototype.write = function(data) {
+    native function fileWrite();
+    return fileWrite(this._id, String(data));
+  };
+
+  FileStream.prototype.writeLine = function(data) {
+    return this.write(data + "\n");
+  };
+
+  FileStream.prototype.seek = function(pos) {
+    native function fileSeek();
+    return fileSeek(this._id, pos);
+  };
+
+  FileStream.prototype.pos = function() {
+    native function filePos();
+    return filePos(this._id);
+  };
+
+  FileStream.prototype.atEnd = function() {
+    native function fileAtEnd();
+    return fileAtEnd(this._id);
+  };
+
+  FileStream.prototype.flush = function() {
+    native function fileFlush();
+    return fileFlush(this._id);
+  };
+
+  // Returns false when data written to a compressed stream could not be stored.
+  FileStream.prototype.close = function() {
+    native function fileClose();
+    return fileClose(this._id);
+  };
+
+  // Runs the operation on a worker thread of the renderer process, see FileTasks.
+  // @p onProgress is called with intermediate results for operations that report them.
+  function runAsync(operation, args, onProgress) {
+    native function fsAsync();
+    return new Promise(function(resolve, reject) {
+      var strings = Array.prototype.map.call(args, function(arg) {
+        return arg === undefined ? "" : String(arg);
+      });
+      fsAsync(operation, strings, function(error, result) {
+        if (error) {
+          reject(error);
+        } else {
+          resolve(result);
+        }
+      }, onProgress);
+    });
+  }
+
   phantom.Fs = function() {
 
+    // Promise based variants of the operations below that don't block the script.
+    this.promises = {};
+    ["read", "write", "list", "size", "exists",
+     "isFile", "isDirectory", "lastModified", "makeTree"].forEach(function(operation) {
+      this.promises[operation] = function() {
+        return runAsync(operation, arguments);
+      };
+    }, this);
+
+    this.promises.hash = function(path, algorithm) {
+      return runAsync("hash", [path, algorithm || "sha256"]);
+    };
+
+    this.promises.listDetailed = function(path, options) {
+      return runAsync("listDetailed", [path, JSON.stringify(options || {})]);
+    };
+
+    // Copies files in parallel, @p options can contain preserveSymlinks, overwrite, threads and an onProgress callback.
+    // Resolves to the number of copied files, directories, symlinks and bytes.
+    this.promises.copy = function(source, target, options) {
+      options = options || {};
+      return runAsync("copy", [source, target, JSON.stringify(options)], options.onProgress);
+    };
+
+    // Removes files in parallel, @p options can contain threads and an onProgress callback.
+    this.promises.remove = function(path, options) {
+      options = options || {};
+      return runAsync("remove", [path, JSON.stringify(options)], options.onProgress);
+    };
+
+    // @p mode is a string like "r", "w", "a", "rw" or "rb", or an object with a mode property
+    this.open = function(path, mode) {
+      native function fileOpen();
+      if (mode && typeof mode === "object") {
+        mode = mode.mode;
+      }
+      return new FileStream(fileOpen(path, mode || "r"));
+    };
+
+    // Maps the file read-only into memory and returns a stream on it, pass "b" as mode for binary data.
+    // Only the parts that are read are converted into strings.
+    this.mmap = function(path, mode) {
+      native function fileMap();
+      return new FileStream(fileMap(path, String(mode || "").indexOf("b") !== -1));
+    };
+
+    // Opens a gzip or zstd file as stream, @p options can contain mode ("r", "w" or "a", optionally with "b"),
+    // codec and level. The codec defaults to zstd for .zst files and gzip otherwise. Written data is
+    // compressed on a background thread, close the stream to finish the file.
+    this.openCompressed = function(path, options) {
+      native function fileOpenCompressed();
+      options = options || {};
+      var codec = options.codec || (/\.zst$/.test(path) ? "zstd" : "gzip");
+      var level = options.level === undefined ? -1 : options.level;
+      return new FileStream(fileOpenCompressed(path, options.mode || "r", codec, level));
+    };
+
     this.write = function(file, content, mode) {
       native function write();
       return write(file, content, mode);
@@ -12,6 +197,18 @@
       return read(file);
     };
 
+    // The contents of the file as Uint8Array.
+    this.readBinary = function(file) {
+      native function readBinary();
+      return toBytes(readBinary(file));
+    };
+
+    // Writes an ArrayBuffer or typed array, pass "a" as mode to append.
+    this.writeBinary = function(file, data, mode) {
+      native function writeBinary();
+      return writeBinary(file, fromBytes(data), mode || "w");
+    };
+
     this.lastModified = function(file) {
       native function lastModified();
       return lastModified(file);
@@ -37,6 +234,45 @@
       return list(file);
     };
 
+    // The hex encoded digest of the file, see phantom.hash for the algorithms.
+    this.hash = function(path, algorithm) {
+      native function hashFile();
+      return hashFile(path, algorithm || "sha256");
+    };
+
+    // Lists the entries with name, type, size, mtime and mode in a single call,
+    // @p options can contain recursive, a glob pattern for the names and threads.
+    this.listDetailed = function(path, options) {
+      native function listDetailed();
+      return listDetailed(path, JSON.stringify(options || {}));
+    };
+
+    // Calls @p callback(type, path) for every created, modified or removed entry below @p path,
+    // the type is overflow when events got lost, or error with the message as third argument when
+    // watching stopped working. @p options can contain recursive and debounce,
+    // the time in ms after the last change until the changes are reported, 100 by default.
+    // Returns a watcher with a close function.
+    this.watch = function(path, options, callback) {
+      native function watch();
+      native function unwatch();
+      if (typeof options === "function") {
+        callback = options;
+        options = {};
+      }
+      options = options || {};
+      var debounce = options.debounce === undefined ? 100 : options.debounce;
+      var id = watch(path, !!options.recursive, debounce, function(events) {
+        events.forEach(function(event) {
+          callback(event.type, event.path, event.message);
+        });
+      });
+      return {
+        close: function() {
+          unwatch(id);
+        }
+      };
+    };
+
     this.copy = function(src,dest) {
       native function copy();
       return copy(src,dest);
@@ -0,0 +1,139 @@
+// Copyright (c) 2015 Klaralvdalens Datakonsult AB (KDAB).
+// All rights reserved. Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include "preconnect.h"
+
+#include <QJsonDocument>
+#include <QUrl>
+
+#include <chrono>
+
+#include "debug.h"
+
+namespace {
+
+double now()
+{
+  using namespace std::chrono;
+  return duration<double, std::milli>(steady_clock::now().time_since_epoch()).count();
+}
+
+QString originOf(const QUrl& url)
+{
+  return url.adjusted(QUrl::RemoveUserInfo | QUrl::RemovePath | QUrl::RemoveQuery | QUrl::RemoveFragment).toString();
+}
+
+// appends the hints to the document, Blink starts preconnecting as soon as a link is inserted
+const char HINT_SCRIPT[] =
+  "(function(origins) {\n"
+  "  var parent = document.head || document.documentElement;\n"
+  "  if (!parent) return;\n"
+  "  origins.forEach(function(origin) {\n"
+  "    ['dns-prefetch', 'preconnect'].forEach(function(rel) {\n"
+  "      var link = document.createElement('link');\n"
+  "      link.rel = rel;\n"
+  "      link.href = origin;\n"
+  "      parent.appendChild(link);\n"
+  "    });\n"
+  "  });\n"
+  "})(%1);";
+}
+
+QJsonArray Preconnector::preconnect(CefRefPtr<CefFrame> frame, const QStringList& urls)
+{
+  QStringList origins;
+  foreach (const auto& url, urls) {
+    const auto parsed = QUrl::fromUserInput(url);
+    if (parsed.scheme() != QLatin1String("http") && parsed.scheme() != QLatin1String("https")) {
+      qCWarning(network) << "cannot preconnect to" << url;
+      continue;
+    }
+    const auto origin = originOf(parsed);
+    if (!origins.contains(origin)) {
+      origins << origin;
+    }
+  }
+  const auto json = QJsonArray::fromStringList(origins);
+  if (origins.isEmpty()) {
+    return json;
+  }
+
+  // the origins are embedded as a JSON array, which also takes care of the escaping
+  const auto code = QString::fromLatin1(HINT_SCRIPT).arg(QString::fromUtf8(QJsonDocument(json).toJson(QJsonDocument::Compact)));
+  frame->ExecuteJavaScript(code.toStdString(), frame->GetURL(), 0);
+
+  const auto hinted = now();
+  QMutexLocker lock(&m_mutex);
+  foreach (const auto& origin, origins) {
+    auto& entry = m_origins[origin];
+    ++entry.preconnects;
+    entry.hintedSince = hinted;
+  }
+  qCDebug(network) << "preconnect hints for" << origins;
+  return json;
+}
+
+void Preconnector::navigationStarted(CefRefPtr<CefRequest> request)
+{
+  const auto origin = originOf(QUrl(QString::fromStdString(request->GetURL())));
+
+  QMutexLocker lock(&m_mutex);
+  auto it = m_origins.find(origin);
+  if (it == m_origins.end()) {
+    return;
+  }
+  Navigation navigation;
+  navigation.origin = origin;
+  navigation.start = now();
+  navigation.hinted = it->hintedSince >= 0 && navigation.start - it->hintedSince < HINT_LIFETIME;
+  // at most the first navigation can use the preconnected socket
+  it->hintedSince = -1;
+  m_navigations[request->GetIdentifier()] = navigation;
+}
+
+QJsonObject Preconnector::navigationResponded(CefRefPtr<CefRequest> request)
+{
+  QMutexLocker lock(&m_mutex);
+  auto it = m_navigations.find(request->GetIdentifier());
+  if (it == m_navigations.end()) {
+    return {};
+  }
+  const auto navigation = *it;
+  m_navigations.erase(it);
+
+  const auto timeToFirstByte = now() - navigation.start;
+  auto& origin = m_origins[navigation.origin];
+  if (navigation.hinted) {
+    ++origin.hintedNavigations;
+    origin.hintedTimeToFirstByte += timeToFirstByte;
+  } else {
+    ++origin.otherNavigations;
+    origin.otherTimeToFirstByte += timeToFirstByte;
+  }
+  return {
+    {QStringLiteral("afterPreconnect"), navigation.hinted},
+    {QStringLiteral("timeToFirstByte"), timeToFirstByte}
+  };
+}
+
+QJsonObject Preconnector::statistics() const
+{
+  QMutexLocker lock(&m_mutex);
+  QJsonObject statistics;
+  for (auto it = m_origins.begin(); it != m_origins.end(); ++it) {
+    const auto& origin = it.value();
+    const auto hinted = origin.hintedNavigations ? origin.hintedTimeToFirstByte / origin.hintedNavigations : -1;
+    const auto other = origin.otherNavigations ? origin.otherTimeToFirstByte / origin.otherNavigations : -1;
+    statistics[it.key()] = QJsonObject{
+      {QStringLiteral("preconnects"), origin.preconnects},
+      {QStringLiteral("navigationsAfterPreconnect"), origin.hintedNavigations},
+      {QStringLiteral("otherNavigations"), origin.otherNavigations},
+      {QStringLiteral("averageTimeToFirstByteAfterPreconnect"), hinted},
+      {QStringLiteral("averageOtherTimeToFirstByte"), other},
+      // negative when either kind of navigation is missing
+      {QStringLiteral("difference"), hinted >= 0 && other >= 0 ? other - hinted : -1}
+    };
+  }
+  return statistics;
+}
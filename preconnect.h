@@ -0,0 +1,74 @@
+// Copyright (c) 2015 Klaralvdalens Datakonsult AB (KDAB).
+// All rights reserved. Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#ifndef PHANTOMJS_PRECONNECT_H
+#define PHANTOMJS_PRECONNECT_H
+
+#include <QHash>
+#include <QJsonArray>
+#include <QJsonObject>
+#include <QMutex>
+#include <QStringList>
+
+#include "include/cef_frame.h"
+#include "include/cef_request.h"
+
+/**
+ * Warms up connections to hosts that are about to be visited.
+ *
+ * CEF doesn't expose Chromium's predictor, so <link rel=dns-prefetch> and
+ * <link rel=preconnect> hints for the origin of every URL are injected into
+ * a frame instead. Blink hands them to the network stack of the frame's
+ * request context, which resolves the host and opens an idle TCP and TLS
+ * connection without sending any request.
+ *
+ * Main frame navigations to hinted origins are tracked to compare their time
+ * to the first response byte with other navigations to the same origin.
+ * Chromium neither reports whether a hint got acted upon nor whether a socket
+ * was reused, so a navigation only counts as following a preconnect when it
+ * is the first one to the origin within HINT_LIFETIME after the hint. That
+ * is a guess and is reported as such, not as connection reuse.
+ *
+ * preconnect is called on the UI thread, the navigation tracking on the IO thread.
+ */
+class Preconnector
+{
+public:
+  // Chromium closes unused preconnected sockets after five minutes at the latest
+  static const int HINT_LIFETIME = 5 * 60 * 1000;
+
+  // injects the hints into @p frame, returns the hinted origins
+  QJsonArray preconnect(CefRefPtr<CefFrame> frame, const QStringList& urls);
+
+  void navigationStarted(CefRefPtr<CefRequest> request);
+  // returns the navigation details when the origin was hinted before, an empty object otherwise
+  QJsonObject navigationResponded(CefRefPtr<CefRequest> request);
+
+  // navigations with and without a preceding hint per hinted origin
+  QJsonObject statistics() const;
+
+private:
+  struct Origin
+  {
+    // in ms of the steady clock, negative when no hint is pending
+    double hintedSince = -1;
+    int preconnects = 0;
+    int hintedNavigations = 0;
+    int otherNavigations = 0;
+    double hintedTimeToFirstByte = 0;
+    double otherTimeToFirstByte = 0;
+  };
+  struct Navigation
+  {
+    QString origin;
+    double start = 0;
+    bool hinted = false;
+  };
+
+  mutable QMutex m_mutex;
+  QHash<QString, Origin> m_origins;
+  QHash<uint64, Navigation> m_navigations;
+};
+
+#endif // PHANTOMJS_PRECONNECT_H
@@ -0,0 +1,381 @@
+// Copyright (c) 2015 Klaralvdalens Datakonsult AB (KDAB).
+// All rights reserved. Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include "proxy_handler.h"
+
+#include <QString>
+#include <QUrl>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <random>
+
+#include "include/cef_task.h"
+#include "include/wrapper/cef_helpers.h"
+
+#include "task.h"
+#include "debug.h"
+
+namespace {
+
+double now()
+{
+  using namespace std::chrono;
+  return duration<double, std::milli>(steady_clock::now().time_since_epoch()).count();
+}
+
+// only used on the IO thread
+double randomValue()
+{
+  static std::mt19937 engine{std::random_device{}()};
+  return std::uniform_real_distribution<double>(0, 1)(engine);
+}
+
+qint64 postDataSize(const CefRefPtr<CefRequest>& request)
+{
+  const auto post = request->GetPostData();
+  if (!post) {
+    return 0;
+  }
+  qint64 size = 0;
+  CefPostData::ElementVector elements;
+  post->GetElements(elements);
+  for (const auto& element : elements) {
+    size += element->GetBytesCount();
+  }
+  return size;
+}
+}
+
+/**
+ * Forwards the CefURLRequest events to the handler, until it gets detached.
+ */
+class ProxyResourceHandler::Client : public CefURLRequestClient
+{
+public:
+  explicit Client(ProxyResourceHandler* handler)
+    : m_handler(handler)
+  {}
+
+  void detach()
+  {
+    m_handler = nullptr;
+  }
+
+  void OnRequestComplete(CefRefPtr<CefURLRequest> /*request*/) override
+  {
+    if (m_handler) {
+      m_handler->onComplete();
+    }
+  }
+
+  void OnUploadProgress(CefRefPtr<CefURLRequest> /*request*/, int64 /*current*/, int64 /*total*/) override
+  {
+  }
+
+  void OnDownloadProgress(CefRefPtr<CefURLRequest> /*request*/, int64 /*current*/, int64 /*total*/) override
+  {
+    // the first progress notification arrives once the response headers got parsed
+    if (m_handler) {
+      m_handler->onHeadersAvailable();
+    }
+  }
+
+  void OnDownloadData(CefRefPtr<CefURLRequest> /*request*/, const void* data, size_t data_length) override
+  {
+    if (m_handler) {
+      m_handler->onData(data, data_length);
+    }
+  }
+
+  bool GetAuthCredentials(bool /*isProxy*/, const CefString& /*host*/, int /*port*/, const CefString& /*realm*/,
+                          const CefString& /*scheme*/, CefRefPtr<CefAuthCallback> /*callback*/) override
+  {
+    return false;
+  }
+
+private:
+  ProxyResourceHandler* m_handler;
+  IMPLEMENT_REFCOUNTING(Client);
+};
+
+ProxyResourceHandler::ProxyResourceHandler(CefRefPtr<CefRequestContext> requestContext, const Options& options)
+  : m_requestContext(requestContext)
+  , m_options(options)
+{
+}
+
+ProxyResourceHandler::~ProxyResourceHandler()
+{
+}
+
+bool ProxyResourceHandler::ProcessRequest(CefRefPtr<CefRequest> request, CefRefPtr<CefCallback> callback)
+{
+  CEF_REQUIRE_IO_THREAD();
+
+  m_headersCallback = callback;
+  m_url = QString::fromStdString(request->GetURL());
+
+  CefRefPtr<ProxyResourceHandler> self(this);
+  if (m_options.timeout > 0) {
+    CefPostDelayedTask(TID_IO, makeTask([self] () {
+      self->onTimeout();
+    }), m_options.timeout);
+  }
+
+  if (m_options.failureRate > 0 && randomValue() < m_options.failureRate) {
+    // like a connection that got dropped, nothing is sent
+    CefPostDelayedTask(TID_IO, makeTask([self] () {
+      self->fail();
+    }), m_options.latency);
+    return true;
+  }
+
+  qint64 delay = m_options.latency;
+  if (m_options.uploadThroughput > 0) {
+    delay += postDataSize(request) * 1000 / m_options.uploadThroughput;
+  }
+  if (delay > 0) {
+    CefPostDelayedTask(TID_IO, makeTask([self, request] () {
+      self->start(request);
+    }), delay);
+  } else {
+    start(request);
+  }
+  return true;
+}
+
+void ProxyResourceHandler::start(CefRefPtr<CefRequest> request)
+{
+  if (m_canceled) {
+    return;
+  }
+
+  CefRequest::HeaderMap headers;
+  request->GetHeaderMap(headers);
+  auto proxyRequest = CefRequest::Create();
+  proxyRequest->Set(request->GetURL(), request->GetMethod(), request->GetPostData(), headers);
+  // the original flags decide about cookies, e.g. for fetch with credentials "omit", let Chromium follow redirects
+  proxyRequest->SetFlags(request->GetFlags() | UR_FLAG_STOP_ON_REDIRECT);
+  proxyRequest->SetFirstPartyForCookies(request->GetFirstPartyForCookies());
+
+  m_client = new Client(this);
+  m_urlRequest = CefURLRequest::Create(proxyRequest, m_client.get(), m_requestContext);
+}
+
+void ProxyResourceHandler::fail()
+{
+  if (m_complete || m_canceled) {
+    return;
+  }
+  qCDebug(network) << "emulated network failure" << m_url;
+  m_canceled = true;
+  if (auto callback = m_headersCallback) {
+    m_headersCallback = nullptr;
+    callback->Cancel();
+  }
+}
+
+void ProxyResourceHandler::GetResponseHeaders(CefRefPtr<CefResponse> response, int64& response_length,
+                                              CefString& redirectUrl)
+{
+  CEF_REQUIRE_IO_THREAD();
+
+  response_length = -1;
+  const auto proxyResponse = m_urlRequest ? m_urlRequest->GetResponse() : nullptr;
+  if (!proxyResponse) {
+    response->SetStatus(502);
+    response->SetStatusText("Bad Gateway");
+    return;
+  }
+  response->SetStatus(proxyResponse->GetStatus());
+  response->SetStatusText(proxyResponse->GetStatusText());
+  response->SetMimeType(proxyResponse->GetMimeType());
+  CefResponse::HeaderMap headers;
+  proxyResponse->GetHeaderMap(headers);
+  // the data of the url request is decoded already, its length is unknown upfront
+  for (auto it = headers.begin(); it != headers.end();) {
+    const auto name = QString::fromStdString(it->first);
+    if (!name.compare(QLatin1String("content-encoding"), Qt::CaseInsensitive)
+        || !name.compare(QLatin1String("content-length"), Qt::CaseInsensitive))
+    {
+      it = headers.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  response->SetHeaderMap(headers);
+
+  const int status = proxyResponse->GetStatus();
+  const auto location = proxyResponse->GetHeader("Location");
+  if (status >= 300 && status < 400 && !location.empty()) {
+    redirectUrl = QUrl(m_url).resolved(QUrl(QString::fromStdString(location))).toString().toStdString();
+  }
+}
+
+bool ProxyResourceHandler::ReadResponse(void* data_out, int bytes_to_read, int& bytes_read,
+                                        CefRefPtr<CefCallback> callback)
+{
+  CEF_REQUIRE_IO_THREAD();
+
+  if (m_failed) {
+    // fail the response, which otherwise would appear to be complete
+    bytes_read = 0;
+    CefPostTask(TID_IO, makeTask([callback] () {
+      callback->Cancel();
+    }));
+    return true;
+  }
+
+  const int available = m_buffer.size() - m_bufferOffset;
+  if (available > 0) {
+    qint64 allowed = bytes_to_read;
+    if (m_options.downloadThroughput > 0) {
+      if (m_readStart < 0) {
+        m_readStart = now();
+      }
+      const double elapsed = now() - m_readStart;
+      allowed = static_cast<qint64>(elapsed * m_options.downloadThroughput / 1000) - m_bytesRead;
+      if (allowed <= 0) {
+        // wait until the next chunk of roughly 100ms may be passed on
+        const qint64 chunk = std::min<qint64>(available, std::max<qint64>(1, m_options.downloadThroughput / 10));
+        const auto delay = std::ceil((m_bytesRead + chunk) * 1000. / m_options.downloadThroughput - elapsed);
+        bytes_read = 0;
+        m_readCallback = callback;
+        scheduleRead(std::max(1, static_cast<int>(delay)));
+        return true;
+      }
+    }
+    bytes_read = static_cast<int>(std::min<qint64>(std::min(available, bytes_to_read), allowed));
+    memcpy(data_out, m_buffer.constData() + m_bufferOffset, bytes_read);
+    m_bufferOffset += bytes_read;
+    m_bytesRead += bytes_read;
+    if (m_bufferOffset == m_buffer.size()) {
+      m_buffer.clear();
+      m_bufferOffset = 0;
+    }
+    return true;
+  }
+
+  bytes_read = 0;
+  if (m_complete || m_canceled) {
+    return false;
+  }
+  // continue once more data arrived
+  m_readCallback = callback;
+  return true;
+}
+
+void ProxyResourceHandler::Cancel()
+{
+  CEF_REQUIRE_IO_THREAD();
+
+  m_canceled = true;
+  finish();
+}
+
+void ProxyResourceHandler::onHeadersAvailable()
+{
+  if (m_headersAvailable || m_canceled) {
+    return;
+  }
+  m_headersAvailable = true;
+  if (auto callback = m_headersCallback) {
+    m_headersCallback = nullptr;
+    callback->Continue();
+  }
+}
+
+void ProxyResourceHandler::onData(const void* data, size_t size)
+{
+  onHeadersAvailable();
+  m_buffer.append(static_cast<const char*>(data), static_cast<int>(size));
+  continueRead();
+}
+
+void ProxyResourceHandler::onComplete()
+{
+  m_complete = true;
+  // redirects stop the request, but still carry a response
+  const auto response = m_urlRequest->GetResponse();
+  const bool redirect = response && response->GetStatus() / 100 == 3 && !response->GetHeader("Location").empty();
+  if (!m_headersAvailable && (!response || response->GetStatus() <= 0)) {
+    // failed before any response arrived, fail the original request as well
+    if (auto callback = m_headersCallback) {
+      m_headersCallback = nullptr;
+      callback->Cancel();
+    }
+  } else if (m_urlRequest->GetRequestStatus() != UR_SUCCESS && !redirect) {
+    // failed mid-body, like after a timeout the truncated body must not look like a successful load
+    qCDebug(network) << "request failed after the response started" << m_url << m_urlRequest->GetRequestError();
+    m_failed = true;
+    m_buffer.clear();
+    m_bufferOffset = 0;
+    onHeadersAvailable();
+  } else {
+    onHeadersAvailable();
+  }
+  finish();
+  continueRead();
+}
+
+void ProxyResourceHandler::onTimeout()
+{
+  if (m_complete || m_canceled) {
+    return;
+  }
+  qCDebug(network) << "resource timeout after" << m_options.timeout << "ms" << m_url;
+  m_canceled = true;
+  m_failed = true;
+  if (m_options.onTimeout) {
+    m_options.onTimeout();
+  }
+  if (auto callback = m_headersCallback) {
+    // nothing arrived yet, fail the request
+    m_headersCallback = nullptr;
+    callback->Cancel();
+  }
+  finish();
+  // a truncated body must not look like a successful load, the page sees a network error instead
+  m_buffer.clear();
+  m_bufferOffset = 0;
+  continueRead();
+}
+
+void ProxyResourceHandler::finish()
+{
+  // break the reference cycle with the client
+  if (m_client) {
+    m_client->detach();
+    m_client = nullptr;
+  }
+  if (m_urlRequest) {
+    if (!m_complete) {
+      m_urlRequest->Cancel();
+    }
+  }
+}
+
+void ProxyResourceHandler::scheduleRead(int delay)
+{
+  if (m_readScheduled) {
+    return;
+  }
+  m_readScheduled = true;
+  CefRefPtr<ProxyResourceHandler> self(this);
+  CefPostDelayedTask(TID_IO, makeTask([self] () {
+    self->m_readScheduled = false;
+    self->continueRead();
+  }), delay);
+}
+
+void ProxyResourceHandler::continueRead()
+{
+  if (auto callback = m_readCallback) {
+    m_readCallback = nullptr;
+    callback->Continue();
+  }
+}
@@ -0,0 +1,101 @@
+// Copyright (c) 2015 Klaralvdalens Datakonsult AB (KDAB).
+// All rights reserved. Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#ifndef PHANTOMJS_PROXY_HANDLER_H
+#define PHANTOMJS_PROXY_HANDLER_H
+
+#include <QByteArray>
+#include <QString>
+
+#include <functional>
+
+#include "include/cef_request_context.h"
+#include "include/cef_resource_handler.h"
+#include "include/cef_urlrequest.h"
+
+/**
+ * Resource handler that loads the request itself via a CefURLRequest.
+ *
+ * Chromium offers no way to cancel a single in-flight request of a page,
+ * so requests that need per request control are proxied through this
+ * handler. The request is cancelled when it doesn't finish within the
+ * timeout, without affecting any other resource of the page. Responses that
+ * started already fail with a network error rather than ending early.
+ *
+ * The handler can also emulate slow networks: the request is delayed by the
+ * latency and the time needed to upload the post data, the response body is
+ * passed on no faster than the download throughput, and requests fail
+ * randomly with the given failure rate.
+ *
+ * Redirects are not followed by the handler but passed on to Chromium, which
+ * then issues a new request for the target.
+ *
+ * All methods are called on the CEF IO thread.
+ */
+class ProxyResourceHandler : public CefResourceHandler
+{
+public:
+  struct Options
+  {
+    // in ms, 0 disables the timeout
+    int timeout = 0;
+    std::function<void()> onTimeout;
+
+    // network emulation
+    // in ms, added before the request is sent
+    int latency = 0;
+    // in bytes per second, 0 disables throttling
+    qint64 downloadThroughput = 0;
+    qint64 uploadThroughput = 0;
+    // probability in [0, 1] to fail a request
+    double failureRate = 0;
+  };
+
+  ProxyResourceHandler(CefRefPtr<CefRequestContext> requestContext, const Options& options);
+  ~ProxyResourceHandler();
+
+  bool ProcessRequest(CefRefPtr<CefRequest> request, CefRefPtr<CefCallback> callback) override;
+  void GetResponseHeaders(CefRefPtr<CefResponse> response, int64& response_length,
+                          CefString& redirectUrl) override;
+  bool ReadResponse(void* data_out, int bytes_to_read, int& bytes_read,
+                    CefRefPtr<CefCallback> callback) override;
+  void Cancel() override;
+
+private:
+  class Client;
+  friend class Client;
+
+  void start(CefRefPtr<CefRequest> request);
+  void fail();
+  void onHeadersAvailable();
+  void onData(const void* data, size_t size);
+  void onComplete();
+  void onTimeout();
+  void finish();
+  void scheduleRead(int delay);
+  void continueRead();
+
+  CefRefPtr<CefRequestContext> m_requestContext;
+  Options m_options;
+  QString m_url;
+  CefRefPtr<Client> m_client;
+  CefRefPtr<CefURLRequest> m_urlRequest;
+  CefRefPtr<CefCallback> m_headersCallback;
+  CefRefPtr<CefCallback> m_readCallback;
+  QByteArray m_buffer;
+  int m_bufferOffset = 0;
+  // for throttling, in ms since the epoch of the steady clock
+  double m_readStart = -1;
+  qint64 m_bytesRead = 0;
+  bool m_readScheduled = false;
+  bool m_headersAvailable = false;
+  bool m_complete = false;
+  bool m_canceled = false;
+  // timed out or failed mid-body, the response is failed on the next read,
+  // also when its headers were passed on already
+  bool m_failed = false;
+  IMPLEMENT_REFCOUNTING(ProxyResourceHandler);
+};
+
+#endif // PHANTOMJS_PROXY_HANDLER_H
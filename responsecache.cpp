@@ -0,0 +1,628 @@
+// Copyright (c) 2015 Klaralvdalens Datakonsult AB (KDAB).
+// All rights reserved. Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include "responsecache.h"
+
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDirIterator>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QLocale>
+#include <QSaveFile>
+#include <QStandardPaths>
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <iostream>
+
+#ifdef Q_OS_WIN
+#include <sys/utime.h>
+#else
+#include <utime.h>
+#endif
+
+#include "include/cef_task.h"
+
+#include "proxy_handler.h"
+#include "task.h"
+#include "debug.h"
+
+namespace {
+
+// added to all responses served from the cache, which also prevents storing them again
+const char CACHE_HEADER[] = "X-PhantomJS-Cache";
+
+bool isCacheableRequest(const CefRefPtr<CefRequest>& request, QString* url)
+{
+  if (request->GetMethod() != "GET") {
+    return false;
+  }
+  *url = QString::fromStdString(request->GetURL());
+  return url->startsWith(QLatin1String("http://")) || url->startsWith(QLatin1String("https://"));
+}
+
+// whether the request carries credentials, its response may be specific to the user
+bool hasCredentials(const CefRefPtr<CefRequest>& request)
+{
+  CefRequest::HeaderMap headers;
+  request->GetHeaderMap(headers);
+  for (const auto& header : headers) {
+    const auto name = QString::fromStdString(header.first);
+    if (!name.compare(QLatin1String("cookie"), Qt::CaseInsensitive)
+        || !name.compare(QLatin1String("authorization"), Qt::CaseInsensitive))
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+// whether the response must not be shared, independent of any rule
+bool isPrivateResponse(const QHash<QString, QString>& headers)
+{
+  if (headers.contains(QStringLiteral("set-cookie"))) {
+    return true;
+  }
+  foreach (const auto& directive, headers.value(QStringLiteral("cache-control")).toLower().split(',')) {
+    const auto trimmed = directive.trimmed();
+    if (trimmed == QLatin1String("private") || trimmed == QLatin1String("no-store")) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// marks the entry as recently used, see ResponseCache::evict
+void touch(const QString& path)
+{
+#ifdef Q_OS_WIN
+  _wutime(reinterpret_cast<const wchar_t*>(path.utf16()), nullptr);
+#else
+  utime(QFile::encodeName(path).constData(), nullptr);
+#endif
+}
+
+// lower-cased header names, repeated headers are joined
+QHash<QString, QString> headerHash(const CefResponse::HeaderMap& headers)
+{
+  QHash<QString, QString> hash;
+  for (const auto& header : headers) {
+    auto& value = hash[QString::fromStdString(header.first).toLower()];
+    if (!value.isEmpty()) {
+      value += QLatin1String(", ");
+    }
+    value += QString::fromStdString(header.second);
+  }
+  return hash;
+}
+
+// the expiry time in ms since epoch according to the cache headers, or 0 when the response may not be stored
+qint64 expiryFromHeaders(const QHash<QString, QString>& headers, qint64 now)
+{
+  if (headers.contains(QStringLiteral("set-cookie"))) {
+    return 0;
+  }
+  const auto vary = headers.value(QStringLiteral("vary")).trimmed().toLower();
+  if (!vary.isEmpty() && vary != QLatin1String("accept-encoding")) {
+    return 0;
+  }
+
+  qint64 maxAge = -1;
+  foreach (const auto& directive, headers.value(QStringLiteral("cache-control")).toLower().split(',')) {
+    const auto trimmed = directive.trimmed();
+    if (trimmed == QLatin1String("no-store") || trimmed == QLatin1String("no-cache")
+        || trimmed == QLatin1String("private"))
+    {
+      return 0;
+    } else if (trimmed.startsWith(QLatin1String("s-maxage="))) {
+      // the shared cache lifetime takes precedence
+      maxAge = trimmed.mid(9).toLongLong();
+      break;
+    } else if (trimmed.startsWith(QLatin1String("max-age="))) {
+      maxAge = trimmed.mid(8).toLongLong();
+    }
+  }
+  if (maxAge >= 0) {
+    return maxAge > 0 ? now + maxAge * 1000 : 0;
+  }
+
+  const auto expires = headers.value(QStringLiteral("expires"));
+  if (expires.isEmpty()) {
+    // no heuristic freshness, only cache what the server allows explicitly
+    return 0;
+  }
+  auto date = QLocale::c().toDateTime(expires, QStringLiteral("ddd, dd MMM yyyy HH:mm:ss 'GMT'"));
+  date.setTimeSpec(Qt::UTC);
+  const auto expiresMs = date.isValid() ? date.toMSecsSinceEpoch() : 0;
+  return expiresMs > now ? expiresMs : 0;
+}
+
+QJsonObject readEntry(const QString& path)
+{
+  QFile file(path);
+  if (!file.open(QIODevice::ReadOnly)) {
+    return {};
+  }
+  return QJsonDocument::fromJson(file.readAll()).object();
+}
+
+bool writeAtomically(const QString& path, const QByteArray& data)
+{
+  QSaveFile file(path);
+  if (!file.open(QIODevice::WriteOnly)) {
+    return false;
+  }
+  file.write(data);
+  return file.commit();
+}
+
+/**
+ * Serves a cached response, whose entry and body are loaded on the FILE thread.
+ *
+ * When the entry turned out to be gone or expired in the meantime, e.g. because
+ * another process evicted it, the request is loaded from the network instead.
+ */
+class CachedResourceHandler : public CefResourceHandler
+{
+public:
+  using Loader = std::function<bool(QJsonObject* entry, QByteArray* body)>;
+
+  CachedResourceHandler(CefRefPtr<CefRequestContext> requestContext, Loader loader)
+    : m_requestContext(requestContext)
+    , m_loader(loader)
+  {}
+
+  bool ProcessRequest(CefRefPtr<CefRequest> request, CefRefPtr<CefCallback> callback) override
+  {
+    CefRefPtr<CachedResourceHandler> self(this);
+    CefPostTask(TID_FILE, makeTask([self, request, callback] () {
+      const bool loaded = self->m_loader(&self->m_entry, &self->m_body);
+      CefPostTask(TID_IO, makeTask([self, request, callback, loaded] () {
+        if (loaded) {
+          callback->Continue();
+          return;
+        }
+        self->m_fallback = new ProxyResourceHandler(self->m_requestContext, ProxyResourceHandler::Options());
+        if (!self->m_fallback->ProcessRequest(request, callback)) {
+          callback->Cancel();
+        }
+      }));
+    }));
+    return true;
+  }
+
+  void GetResponseHeaders(CefRefPtr<CefResponse> response, int64& response_length,
+                          CefString& redirectUrl) override
+  {
+    if (m_fallback) {
+      m_fallback->GetResponseHeaders(response, response_length, redirectUrl);
+      return;
+    }
+    response->SetStatus(m_entry.value(QStringLiteral("status")).toInt(200));
+    response->SetStatusText(m_entry.value(QStringLiteral("statusText")).toString().toStdString());
+    response->SetMimeType(m_entry.value(QStringLiteral("mimeType")).toString().toStdString());
+    CefResponse::HeaderMap headers;
+    foreach (const auto& header, m_entry.value(QStringLiteral("headers")).toArray()) {
+      const auto pair = header.toArray();
+      headers.insert(std::make_pair(pair.at(0).toString().toStdString(), pair.at(1).toString().toStdString()));
+    }
+    headers.insert(std::make_pair(CACHE_HEADER, "hit"));
+    response->SetHeaderMap(headers);
+    response_length = m_body.size();
+  }
+
+  bool ReadResponse(void* data_out, int bytes_to_read, int& bytes_read,
+                    CefRefPtr<CefCallback> callback) override
+  {
+    if (m_fallback) {
+      return m_fallback->ReadResponse(data_out, bytes_to_read, bytes_read, callback);
+    }
+    const auto available = m_body.size() - m_offset;
+    if (available <= 0) {
+      bytes_read = 0;
+      return false;
+    }
+    bytes_read = std::min(available, bytes_to_read);
+    memcpy(data_out, m_body.constData() + m_offset, bytes_read);
+    m_offset += bytes_read;
+    return true;
+  }
+
+  void Cancel() override
+  {
+    if (m_fallback) {
+      m_fallback->Cancel();
+    }
+  }
+
+private:
+  CefRefPtr<CefRequestContext> m_requestContext;
+  Loader m_loader;
+  // written on the FILE thread before the request continues, read on the IO thread afterwards
+  QJsonObject m_entry;
+  QByteArray m_body;
+  int m_offset = 0;
+  CefRefPtr<CefResourceHandler> m_fallback;
+  IMPLEMENT_REFCOUNTING(CachedResourceHandler);
+};
+}
+
+std::shared_ptr<ResponseCache> ResponseCache::create(CefRefPtr<CefCommandLine> commandLine)
+{
+  if (!commandLine->HasSwitch("shared-cache")) {
+    return nullptr;
+  }
+
+  auto path = QString::fromStdString(commandLine->GetSwitchValue("shared-cache"));
+  if (path.isEmpty()) {
+    path = QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation) + QLatin1String("/phantomjs-cef/shared");
+  }
+  if (!QDir().mkpath(path + QLatin1String("/objects")) || !QDir().mkpath(path + QLatin1String("/entries"))) {
+    std::cerr << "Failed to create shared cache directory " << qPrintable(path) << '\n';
+    return nullptr;
+  }
+
+  qint64 maxObjectSize = 32;
+  if (commandLine->HasSwitch("shared-cache-max-size")) {
+    maxObjectSize = QString::fromStdString(commandLine->GetSwitchValue("shared-cache-max-size")).toLongLong();
+  }
+  qint64 maxSize = 1024;
+  if (commandLine->HasSwitch("shared-cache-size")) {
+    maxSize = QString::fromStdString(commandLine->GetSwitchValue("shared-cache-size")).toLongLong();
+  }
+
+  auto cache = std::make_shared<ResponseCache>(path, maxObjectSize * 1024 * 1024, maxSize * 1024 * 1024);
+  if (commandLine->HasSwitch("shared-cache-rules")
+      && !cache->loadRules(QString::fromStdString(commandLine->GetSwitchValue("shared-cache-rules"))))
+  {
+    return nullptr;
+  }
+  qCDebug(network) << "shared response cache in" << path;
+  CefPostTask(TID_FILE, makeTask([cache] () {
+    cache->loadIndex();
+  }));
+  return cache;
+}
+
+ResponseCache::ResponseCache(const QString& path, qint64 maxObjectSize, qint64 maxSize)
+  : m_dir(path)
+  , m_maxObjectSize(maxObjectSize)
+  , m_maxSize(maxSize)
+{
+}
+
+ResponseCache::~ResponseCache()
+{
+}
+
+qint64 ResponseCache::maxObjectSize() const
+{
+  return m_maxObjectSize;
+}
+
+bool ResponseCache::loadRules(const QString& file)
+{
+  QFile rulesFile(file);
+  if (!rulesFile.open(QIODevice::ReadOnly)) {
+    std::cerr << "Failed to open shared cache rules " << qPrintable(file) << '\n';
+    return false;
+  }
+  QJsonParseError error;
+  const auto rules = QJsonDocument::fromJson(rulesFile.readAll(), &error).array();
+  if (error.error) {
+    std::cerr << "Failed to parse shared cache rules " << qPrintable(file) << ": " << qPrintable(error.errorString()) << '\n';
+    return false;
+  }
+  foreach (const auto& value, rules) {
+    const auto object = value.toObject();
+    Rule rule;
+    rule.match.setPattern(object.value(QStringLiteral("match")).toString());
+    if (!rule.match.isValid()) {
+      std::cerr << "Invalid shared cache rule " << qPrintable(rule.match.pattern()) << ": "
+                << qPrintable(rule.match.errorString()) << '\n';
+      return false;
+    }
+    rule.match.optimize();
+    rule.cache = object.value(QStringLiteral("cache")).toBool(true);
+    rule.maxAge = object.value(QStringLiteral("maxAge")).toInt(-1);
+    m_rules.append(rule);
+  }
+  return true;
+}
+
+const ResponseCache::Rule* ResponseCache::findRule(const QString& url) const
+{
+  for (const auto& rule : m_rules) {
+    if (rule.match.match(url).hasMatch()) {
+      return &rule;
+    }
+  }
+  return nullptr;
+}
+
+QString ResponseCache::entryPath(const QString& url) const
+{
+  const auto key = QCryptographicHash::hash(url.toUtf8(), QCryptographicHash::Sha1).toHex();
+  return m_dir.filePath(QLatin1String("entries/") + QString::fromLatin1(key) + QLatin1String(".json"));
+}
+
+QString ResponseCache::objectPath(const QByteArray& digest) const
+{
+  // fan out into sub folders to keep the directories small
+  return m_dir.filePath(QLatin1String("objects/") + QString::fromLatin1(digest.left(2))
+                        + QLatin1Char('/') + QString::fromLatin1(digest.mid(2)));
+}
+
+CefRefPtr<CefResourceHandler> ResponseCache::lookup(CefRefPtr<CefRequest> request,
+                                                   CefRefPtr<CefRequestContext> requestContext)
+{
+  QString url;
+  if (!isCacheableRequest(request, &url)) {
+    return nullptr;
+  }
+  if (!m_rules.isEmpty()) {
+    const auto rule = findRule(url);
+    if (!rule || !rule->cache) {
+      return nullptr;
+    }
+  }
+
+  qint64 expires = -1;
+  {
+    QMutexLocker lock(&m_indexMutex);
+    expires = m_index.value(url, -1);
+  }
+  if (expires <= QDateTime::currentMSecsSinceEpoch()) {
+    ++m_misses;
+    if (expires < 0) {
+      // another process may have stored it, check on disk for the next request
+      auto self = shared_from_this();
+      CefPostTask(TID_FILE, makeTask([self, url] () {
+        self->indexEntry(self->entryPath(url));
+      }));
+    }
+    return nullptr;
+  }
+
+  auto self = shared_from_this();
+  return new CachedResourceHandler(requestContext, [self, url] (QJsonObject* entry, QByteArray* body) {
+    return self->load(url, entry, body);
+  });
+}
+
+bool ResponseCache::load(const QString& url, QJsonObject* entry, QByteArray* body)
+{
+  const auto path = entryPath(url);
+  *entry = readEntry(path);
+  const auto size = static_cast<qint64>(entry->value(QStringLiteral("size")).toDouble());
+  QFile file(objectPath(entry->value(QStringLiteral("body")).toString().toLatin1()));
+  if (entry->value(QStringLiteral("url")).toString() != url
+      || entry->value(QStringLiteral("expires")).toDouble() <= QDateTime::currentMSecsSinceEpoch()
+      || !file.open(QIODevice::ReadOnly) || file.size() != size)
+  {
+    qCDebug(network) << "cached response of" << url << "is gone";
+    {
+      QMutexLocker lock(&m_indexMutex);
+      m_index.remove(url);
+    }
+    ++m_misses;
+    return false;
+  }
+  *body = file.readAll();
+
+  touch(path);
+  qCDebug(network) << "cache hit" << url << size;
+  ++m_hits;
+  m_bytesServed += size;
+  return true;
+}
+
+void ResponseCache::loadIndex()
+{
+  QDirIterator it(m_dir.filePath(QStringLiteral("entries")), {QStringLiteral("*.json")}, QDir::Files);
+  while (it.hasNext()) {
+    indexEntry(it.next());
+  }
+  qCDebug(network) << "indexed" << m_index.size() << "cache entries";
+}
+
+void ResponseCache::indexEntry(const QString& path)
+{
+  const auto entry = readEntry(path);
+  const auto url = entry.value(QStringLiteral("url")).toString();
+  if (url.isEmpty()) {
+    return;
+  }
+  QMutexLocker lock(&m_indexMutex);
+  m_index[url] = static_cast<qint64>(entry.value(QStringLiteral("expires")).toDouble());
+}
+
+#if CHROME_VERSION_BUILD >= 2526
+bool ResponseCache::startRecording(CefRefPtr<CefRequest> request, CefRefPtr<CefResponse> response)
+{
+  QString url;
+  if (!isCacheableRequest(request, &url) || response->GetStatus() != 200
+      || !response->GetHeader(CACHE_HEADER).empty() || hasCredentials(request))
+  {
+    return false;
+  }
+
+  const Rule* rule = nullptr;
+  if (!m_rules.isEmpty()) {
+    rule = findRule(url);
+    if (!rule || !rule->cache) {
+      return false;
+    }
+  }
+
+  CefResponse::HeaderMap headers;
+  response->GetHeaderMap(headers);
+  const auto hash = headerHash(headers);
+  if (isPrivateResponse(hash)) {
+    return false;
+  }
+  const auto now = QDateTime::currentMSecsSinceEpoch();
+  qint64 expires = 0;
+  if (rule && rule->maxAge >= 0) {
+    // the rule overrides the lifetime the server allows, but never makes private responses shared
+    expires = now + static_cast<qint64>(rule->maxAge) * 1000;
+  } else {
+    expires = expiryFromHeaders(hash, now);
+  }
+  if (expires <= now) {
+    return false;
+  }
+
+  QJsonArray jsonHeaders;
+  for (const auto& header : headers) {
+    const auto name = QString::fromStdString(header.first);
+    // the filter sees the decoded body, and cookies must never be shared
+    if (!name.compare(QLatin1String("content-encoding"), Qt::CaseInsensitive)
+        || !name.compare(QLatin1String("content-length"), Qt::CaseInsensitive)
+        || !name.compare(QLatin1String("transfer-encoding"), Qt::CaseInsensitive)
+        || !name.compare(QLatin1String("set-cookie"), Qt::CaseInsensitive))
+    {
+      continue;
+    }
+    jsonHeaders.append(QJsonArray{name, QString::fromStdString(header.second)});
+  }
+
+  const QJsonObject entry = {
+    {QStringLiteral("url"), url},
+    {QStringLiteral("status"), response->GetStatus()},
+    {QStringLiteral("statusText"), QString::fromStdString(response->GetStatusText())},
+    {QStringLiteral("mimeType"), QString::fromStdString(response->GetMimeType())},
+    {QStringLiteral("headers"), jsonHeaders},
+    {QStringLiteral("expires"), static_cast<double>(expires)}
+  };
+  QMutexLocker lock(&m_pendingMutex);
+  m_pending[request->GetIdentifier()] = entry;
+  return true;
+}
+
+void ResponseCache::finishRecording(CefRefPtr<CefRequest> request, CefRefPtr<BodyRecorder> recorder, bool success)
+{
+  QJsonObject entry;
+  {
+    QMutexLocker lock(&m_pendingMutex);
+    entry = m_pending.take(request->GetIdentifier());
+  }
+  if (entry.isEmpty() || !success || !recorder->isComplete()
+      || recorder->body().size() > m_maxObjectSize)
+  {
+    return;
+  }
+
+  auto self = shared_from_this();
+  const auto body = recorder->body();
+  CefPostTask(TID_FILE, makeTask([self, entry, body] () {
+    self->store(entry, body);
+  }));
+}
+#endif
+
+void ResponseCache::store(const QJsonObject& entry, const QByteArray& body)
+{
+  const auto digest = QCryptographicHash::hash(body, QCryptographicHash::Sha256).toHex();
+  const auto bodyPath = objectPath(digest);
+  // bodies are immutable, another process or URL may have stored it already
+  if (!QFile::exists(bodyPath)) {
+    if (!QDir().mkpath(QFileInfo(bodyPath).absolutePath()) || !writeAtomically(bodyPath, body)) {
+      qCWarning(network) << "failed to store cached body" << bodyPath;
+      return;
+    }
+    m_bytesStored += body.size();
+    if (m_size < 0) {
+      m_size = objectsSize();
+    } else {
+      m_size += body.size();
+    }
+  }
+
+  auto indexEntry = entry;
+  indexEntry[QStringLiteral("body")] = QString::fromLatin1(digest);
+  indexEntry[QStringLiteral("size")] = static_cast<double>(body.size());
+  const auto url = entry.value(QStringLiteral("url")).toString();
+  if (!writeAtomically(entryPath(url), QJsonDocument(indexEntry).toJson(QJsonDocument::Compact))) {
+    qCWarning(network) << "failed to store cache entry for" << url;
+    return;
+  }
+  qCDebug(network) << "stored" << url << body.size();
+  ++m_stores;
+  {
+    QMutexLocker lock(&m_indexMutex);
+    m_index[url] = static_cast<qint64>(entry.value(QStringLiteral("expires")).toDouble());
+  }
+
+  if (m_size > m_maxSize) {
+    evict();
+  }
+}
+
+void ResponseCache::evict()
+{
+  // other processes store and evict as well, so start from what is actually on disk
+  auto size = objectsSize();
+  // leave some room, such that not every store has to evict
+  const auto target = m_maxSize / 10 * 9;
+  const auto infos = QDir(m_dir.filePath(QStringLiteral("entries")))
+    .entryInfoList({QStringLiteral("*.json")}, QDir::Files, QDir::Time | QDir::Reversed);
+
+  // bodies are shared by all entries with the same content, they are only removed with their last entry
+  QVector<QJsonObject> entries;
+  entries.reserve(infos.size());
+  QHash<QString, int> references;
+  for (const auto& info : infos) {
+    entries.append(readEntry(info.filePath()));
+    ++references[entries.last().value(QStringLiteral("body")).toString()];
+  }
+
+  for (int i = 0; i < infos.size() && size > target; ++i) {
+    const auto& entry = entries.at(i);
+    QFile::remove(infos.at(i).filePath());
+    ++m_evictions;
+    {
+      QMutexLocker lock(&m_indexMutex);
+      m_index.remove(entry.value(QStringLiteral("url")).toString());
+    }
+    const auto digest = entry.value(QStringLiteral("body")).toString();
+    if (digest.isEmpty() || --references[digest] > 0) {
+      continue;
+    }
+    const QFileInfo body(objectPath(digest.toLatin1()));
+    const auto bodySize = body.size();
+    if (body.exists() && QFile::remove(body.filePath())) {
+      size -= bodySize;
+    }
+  }
+  qCDebug(network) << "evicted cache entries, store size now" << size;
+  m_size = size;
+}
+
+qint64 ResponseCache::objectsSize() const
+{
+  qint64 size = 0;
+  QDirIterator it(m_dir.filePath(QStringLiteral("objects")), QDir::Files, QDirIterator::Subdirectories);
+  while (it.hasNext()) {
+    it.next();
+    size += it.fileInfo().size();
+  }
+  return size;
+}
+
+QJsonObject ResponseCache::statistics() const
+{
+  return {
+    {QStringLiteral("hits"), static_cast<double>(m_hits)},
+    {QStringLiteral("misses"), static_cast<double>(m_misses)},
+    {QStringLiteral("stores"), static_cast<double>(m_stores)},
+    {QStringLiteral("bytesServed"), static_cast<double>(m_bytesServed)},
+    {QStringLiteral("bytesStored"), static_cast<double>(m_bytesStored)},
+    {QStringLiteral("evictions"), static_cast<double>(m_evictions)}
+  };
+}
@@ -0,0 +1,133 @@
+// Copyright (c) 2015 Klaralvdalens Datakonsult AB (KDAB).
+// All rights reserved. Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#ifndef PHANTOMJS_RESPONSECACHE_H
+#define PHANTOMJS_RESPONSECACHE_H
+
+#include <QDir>
+#include <QHash>
+#include <QJsonObject>
+#include <QMutex>
+#include <QRegularExpression>
+#include <QVector>
+
+#include <atomic>
+#include <memory>
+
+#include "include/cef_command_line.h"
+#include "include/cef_request.h"
+#include "include/cef_request_context.h"
+#include "include/cef_resource_handler.h"
+#include "include/cef_response.h"
+#include "include/cef_version.h"
+
+#if CHROME_VERSION_BUILD >= 2526
+#include "bodyrecorder.h"
+#endif
+
+/**
+ * Response cache shared by all phantomjs processes on a host.
+ *
+ * Response bodies are stored content-addressed, i.e. by their SHA-256 digest,
+ * such that the same jQuery bundle served from different URLs is only stored
+ * once. Per URL entries reference the bodies together with the response
+ * headers and expiry time. Files are written atomically and never modified
+ * afterwards, which makes it safe to use the store from many processes.
+ * A body is only evicted together with the last entry referencing it.
+ *
+ * The URLs and expiry times of all entries are kept in an in-memory index,
+ * which is loaded when the cache is created and extended by the entries
+ * other processes store, such that lookups don't touch the disk. Entries
+ * and bodies of hits are read on the FILE thread, requests whose entry
+ * disappeared in the meantime are loaded from the network instead.
+ *
+ * Enabled with the following command line switches:
+ *
+ *  --shared-cache[=<dir>]         store location, defaults to a folder in the generic cache location
+ *  --shared-cache-rules=<file>    JSON file with the rules of what may be cached, see Rule
+ *  --shared-cache-max-size=<mb>   don't store responses larger than this, default 32MB
+ *  --shared-cache-size=<mb>       evict the least recently used entries beyond this, default 1024MB
+ *
+ * Unless overridden by a rule, only successful GET responses are cached for
+ * the lifetime given by the Cache-Control max-age or Expires headers. Requests
+ * with credentials and responses that are private or set cookies are never
+ * stored, not even when a rule matches.
+ *
+ * The last use of an entry is tracked via the modification time of its file,
+ * which is touched on every hit.
+ *
+ * Lookups happen on the CEF IO thread, all disk access on the FILE thread.
+ */
+class ResponseCache : public std::enable_shared_from_this<ResponseCache>
+{
+public:
+  // returns nullptr when the shared cache is not enabled
+  static std::shared_ptr<ResponseCache> create(CefRefPtr<CefCommandLine> commandLine);
+
+  ResponseCache(const QString& path, qint64 maxObjectSize, qint64 maxSize);
+  ~ResponseCache();
+
+  bool loadRules(const QString& file);
+
+  // returns a handler serving the cached response or nullptr on a cache miss
+  // @p requestContext loads the request when the entry is gone by the time it is read
+  CefRefPtr<CefResourceHandler> lookup(CefRefPtr<CefRequest> request, CefRefPtr<CefRequestContext> requestContext);
+
+#if CHROME_VERSION_BUILD >= 2526
+  // returns true when the response is cacheable and its body should be recorded
+  bool startRecording(CefRefPtr<CefRequest> request, CefRefPtr<CefResponse> response);
+  // store the recorded response once it was received completely
+  void finishRecording(CefRefPtr<CefRequest> request, CefRefPtr<BodyRecorder> recorder, bool success);
+#endif
+
+  // responses larger than this are not stored
+  qint64 maxObjectSize() const;
+
+  // hits, misses and stored bytes of this process
+  QJsonObject statistics() const;
+
+private:
+  struct Rule
+  {
+    QRegularExpression match;
+    bool cache = true;
+    // in seconds, overrides the cache headers when >= 0
+    int maxAge = -1;
+  };
+  const Rule* findRule(const QString& url) const;
+  QString entryPath(const QString& url) const;
+  QString objectPath(const QByteArray& digest) const;
+  // reads the entry and body of a hit on the FILE thread, returns false when they are gone
+  bool load(const QString& url, QJsonObject* entry, QByteArray* body);
+  void loadIndex();
+  void indexEntry(const QString& path);
+  void store(const QJsonObject& entry, const QByteArray& body);
+  // removes the least recently used entries and their bodies until the store is below m_maxSize
+  void evict();
+  qint64 objectsSize() const;
+
+  QDir m_dir;
+  qint64 m_maxObjectSize;
+  qint64 m_maxSize;
+  // estimated size of all bodies in the store, only accessed on the FILE thread, -1 until known
+  qint64 m_size = -1;
+  QVector<Rule> m_rules;
+
+  // expiry time in ms since epoch by URL of the entries in the store
+  QMutex m_indexMutex;
+  QHash<QString, qint64> m_index;
+
+  // entries of the responses that are currently being recorded
+  QMutex m_pendingMutex;
+  QHash<uint64, QJsonObject> m_pending;
+
+  std::atomic<qint64> m_hits{0};
+  std::atomic<qint64> m_misses{0};
+  std::atomic<qint64> m_stores{0};
+  std::atomic<qint64> m_bytesServed{0};
+  std::atomic<qint64> m_bytesStored{0};
+  std::atomic<qint64> m_evictions{0};
+};
+
+#endif // PHANTOMJS_RESPONSECACHE_H
@@ -0,0 +1,41 @@
+#!/bin/bash
+#
+# Shared helpers of the benchmark scripts, which source this file after
+# setting PHANTOMJS to the path of the phantomjs binary.
+#
+# Every benchmark runs a script from examples/benchmark that prints its result
+# as a single line "<TAG> {json}", which run_benchmark extracts.
+
+# runs phantomjs under a virtual X server when there is no display
+RUNNER=()
+if [ -z "$DISPLAY" ] && command -v xvfb-run > /dev/null; then
+  RUNNER=(xvfb-run -a "--server-args=-screen 0, 1024x868x24")
+fi
+
+# prints the path of the benchmark script <name>, either in the source tree or
+# in the installed layout, i.e. next to the phantomjs binary
+benchmark_script() {
+  local script
+  script="$(cd "$(dirname "${BASH_SOURCE[0]}")/.." && pwd)/examples/benchmark/$1"
+  if [ ! -f "$script" ]; then
+    script="$(dirname "$PHANTOMJS")/examples/benchmark/$1"
+  fi
+  echo "$script"
+}
+
+# prints the "<tag> {json}" result lines found on stdin
+benchmark_result() {
+  grep -o "$1 {.*}"
+}
+
+# runs phantomjs with the remaining arguments and prints its "<tag> {json}" result lines
+run_benchmark() {
+  local tag=$1
+  shift
+  "${RUNNER[@]}" "$PHANTOMJS" "$@" 2>&1 | benchmark_result "$tag"
+}
+
+# prints the value of the top level number or string <key> of the json result line <line>
+json_field() {
+  echo "$1" | sed -nE "s/.*\"$2\":(\"([^\"]*)\"|([^,}]*)).*/\\2\\3/p"
+}
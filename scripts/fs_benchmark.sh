@@ -0,0 +1,29 @@
+#!/bin/bash
+#
+# Compares the synchronous fs functions with fs.promises.
+#
+# A large file is copied repeatedly while a 10ms timer runs in the script. The
+# number of timer ticks and the largest delay of a tick show how long the
+# script was blocked by the I/O.
+#
+# usage: fs_benchmark.sh <path to phantomjs> [file size in MB] [copies]
+
+PHANTOMJS=${1:?"usage: $0 <path to phantomjs> [file size in MB] [copies]"}
+MEGABYTES=${2:-256}
+COPIES=${3:-8}
+source "$(dirname "$0")/benchmark_common.sh"
+SCRIPT=$(benchmark_script fs_async.js)
+
+printf "%-8s %12s %10s %8s %12s\n" "mode" "duration ms" "MB/s" "ticks" "max lag ms"
+for mode in sync async; do
+  LINE=$(run_benchmark FS "$SCRIPT" "$mode" "$MEGABYTES" "$COPIES")
+  if [ -z "$LINE" ]; then
+    printf "%-8s %s\n" "$mode" "failed"
+    continue
+  fi
+  DURATION=$(json_field "$LINE" ms)
+  RATE=$(json_field "$LINE" megabytesPerSecond)
+  TICKS=$(json_field "$LINE" ticks)
+  LAG=$(json_field "$LINE" maxLagMs)
+  printf "%-8s %12d %10.1f %8d %12d\n" "$mode" "$DURATION" "$RATE" "$TICKS" "$LAG"
+done
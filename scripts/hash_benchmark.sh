@@ -0,0 +1,29 @@
+#!/bin/bash
+#
+# Measures the throughput of the native hash algorithms.
+#
+# fs.hash streams a file from the page cache through the digest, phantom.hash
+# hashes a string that is already in memory. The latter includes the transfer
+# of the string out of V8.
+#
+# usage: hash_benchmark.sh <path to phantomjs> [file size in MB] [algorithms...]
+
+PHANTOMJS=${1:?"usage: $0 <path to phantomjs> [file size in MB] [algorithms...]"}
+MEGABYTES=${2:-512}
+shift $(( $# < 2 ? $# : 2 ))
+source "$(dirname "$0")/benchmark_common.sh"
+SCRIPT=$(benchmark_script hash.js)
+
+OUTPUT=$(run_benchmark HASH "$SCRIPT" "$MEGABYTES" "$@")
+if [ -z "$OUTPUT" ]; then
+  echo "failed" >&2
+  exit 1
+fi
+
+printf "%-10s %14s %16s\n" "algorithm" "file MB/s" "string MB/s"
+echo "$OUTPUT" | while read -r LINE; do
+  ALGORITHM=$(json_field "$LINE" algorithm)
+  FILE=$(json_field "$LINE" fileMegabytesPerSecond)
+  STRING=$(json_field "$LINE" stringMegabytesPerSecond)
+  printf "%-10s %14.1f %16.1f\n" "$ALGORITHM" "$FILE" "$STRING"
+done
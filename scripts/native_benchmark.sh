@@ -0,0 +1,26 @@
+#!/bin/bash
+#
+# Measures how many calls per second scripts can make into trivial native
+# functions like fs.exists, i.e. the overhead of the V8 bridge including the
+# permission check and the lookup of the native function.
+#
+# usage: native_benchmark.sh <path to phantomjs> [milliseconds per function]
+
+PHANTOMJS=${1:?"usage: $0 <path to phantomjs> [milliseconds per function]"}
+DURATION=${2:-2000}
+source "$(dirname "$0")/benchmark_common.sh"
+SCRIPT=$(benchmark_script native_calls.js)
+
+OUTPUT=$(run_benchmark NATIVE "$SCRIPT" "$DURATION")
+if [ -z "$OUTPUT" ]; then
+  echo "failed" >&2
+  exit 1
+fi
+
+printf "%-16s %12s %16s\n" "function" "calls" "calls/s"
+echo "$OUTPUT" | while read -r LINE; do
+  NAME=$(json_field "$LINE" name)
+  CALLS=$(json_field "$LINE" calls)
+  RATE=$(json_field "$LINE" callsPerSecond)
+  printf "%-16s %12d %16.0f\n" "$NAME" "$CALLS" "$RATE"
+done
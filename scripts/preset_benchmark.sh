@@ -0,0 +1,60 @@
+#!/bin/bash
+#
+# Compares page throughput and memory usage of the switch presets.
+#
+# Every preset loads the same page repeatedly, while the resident set size of
+# phantomjs and all of its sub processes is sampled to report the peak.
+#
+# usage: preset_benchmark.sh <path to phantomjs> <url> [page loads] [presets...]
+
+PHANTOMJS=${1:?"usage: $0 <path to phantomjs> <url> [page loads] [presets...]"}
+URL=${2:?"usage: $0 <path to phantomjs> <url> [page loads] [presets...]"}
+LOADS=${3:-20}
+shift $(( $# < 3 ? $# : 3 ))
+PRESETS=("$@")
+if [ ${#PRESETS[@]} -eq 0 ]; then
+  PRESETS=(none headless-throughput low-memory)
+fi
+source "$(dirname "$0")/benchmark_common.sh"
+SCRIPT=$(benchmark_script throughput.js)
+
+# sum of the RSS in kB of the given process and all of its descendants
+tree_rss() {
+  ps -eo pid=,ppid=,rss= | awk -v root="$1" '
+    { parent[$1] = $2; rss[$1] = $3 }
+    END {
+      for (pid in parent) {
+        for (p = pid; p != "" && p != 0 && p != 1; p = parent[p]) {
+          if (p == root) { total += rss[pid]; break }
+        }
+      }
+      print total + 0
+    }'
+}
+
+printf "%-22s %10s %12s %14s\n" "preset" "pages/s" "duration ms" "peak RSS MB"
+for preset in "${PRESETS[@]}"; do
+  ARGS=()
+  if [ "$preset" != "none" ]; then
+    ARGS=("--preset=$preset")
+  fi
+  OUTPUT=$(mktemp)
+  "${RUNNER[@]}" "$PHANTOMJS" "${ARGS[@]}" --instance-cache "$SCRIPT" "$URL" "$LOADS" > "$OUTPUT" 2>&1 &
+  PID=$!
+  PEAK=0
+  while kill -0 $PID 2> /dev/null; do
+    RSS=$(tree_rss $PID)
+    [ "$RSS" -gt "$PEAK" ] && PEAK=$RSS
+    sleep 0.2
+  done
+  wait $PID
+  LINE=$(benchmark_result THROUGHPUT < "$OUTPUT")
+  rm -f "$OUTPUT"
+  if [ -z "$LINE" ]; then
+    printf "%-22s %s\n" "$preset" "failed"
+    continue
+  fi
+  RATE=$(json_field "$LINE" pagesPerSecond)
+  DURATION=$(json_field "$LINE" ms)
+  printf "%-22s %10.2f %12d %14.1f\n" "$preset" "$RATE" "$DURATION" "$(awk -v kb="$PEAK" 'BEGIN { print kb / 1024 }')"
+done
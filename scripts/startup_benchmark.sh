@@ -0,0 +1,43 @@
+#!/bin/bash
+#
+# Cold start benchmark for phantomjs-cef.
+#
+# Launches phantomjs repeatedly and reports the time until the first statement
+# of the user script got executed and until the first page load finished.
+#
+# usage: startup_benchmark.sh <path to phantomjs> [runs] [url]
+
+PHANTOMJS=${1:?"usage: $0 <path to phantomjs> [runs] [url]"}
+RUNS=${2:-10}
+URL=${3:-about:blank}
+source "$(dirname "$0")/benchmark_common.sh"
+SCRIPT=$(benchmark_script startup.js)
+
+RESULTS=$(mktemp)
+trap 'rm -f "$RESULTS"' EXIT
+
+for i in $(seq 1 "$RUNS"); do
+  LAUNCH=$(date +%s%3N)
+  LINE=$(run_benchmark STARTUP "$SCRIPT" "$LAUNCH" "$URL")
+  if [ -z "$LINE" ]; then
+    echo "run $i failed" >&2
+    continue
+  fi
+  echo "run $i: ${LINE#STARTUP }"
+  echo "$(json_field "$LINE" firstStatement) $(json_field "$LINE" firstPageLoad)" >> "$RESULTS"
+done
+
+awk -v runs="$RUNS" '
+  { first[NR] = $1; load[NR] = $2; sumFirst += $1; sumLoad += $2 }
+  function median(values, n,    i, j, tmp) {
+    for (i = 1; i <= n; ++i)
+      for (j = i + 1; j <= n; ++j)
+        if (values[j] < values[i]) { tmp = values[i]; values[i] = values[j]; values[j] = tmp }
+    return n % 2 ? values[(n + 1) / 2] : (values[n / 2] + values[n / 2 + 1]) / 2
+  }
+  END {
+    if (!NR) { print "no successful runs"; exit 1 }
+    printf "%d/%d successful runs\n", NR, runs
+    printf "time to first statement: mean %.1fms, median %.1fms\n", sumFirst / NR, median(first, NR)
+    printf "time to first page load: mean %.1fms, median %.1fms\n", sumLoad / NR, median(load, NR)
+  }' "$RESULTS"
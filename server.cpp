@@ -0,0 +1,284 @@
+// Copyright (c) 2015 Klaralvdalens Datakonsult AB (KDAB).
+// All rights reserved. Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include "server.h"
+
+#include <QJsonArray>
+#include <QJsonDocument>
+
+#include <cerrno>
+#include <iostream>
+#include <thread>
+
+#if !OS_WIN
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <cstring>
+#endif
+
+#include "include/cef_command_line.h"
+#include "include/cef_request_context.h"
+#include "include/wrapper/cef_helpers.h"
+
+#include "app.h"
+#include "handler.h"
+#include "task.h"
+#include "debug.h"
+
+struct JobServer::Connection
+{
+  // -1 for stdin/stdout, -2 once a socket got closed
+  int fd = -1;
+  bool inputClosed = false;
+  int pendingJobs = 0;
+};
+
+JobServer::JobServer(PhantomJSApp* app, CefRefPtr<PhantomJSHandler> handler)
+  : m_app(app)
+  , m_handler(handler)
+{
+}
+
+JobServer::~JobServer()
+{
+#if !OS_WIN
+  if (!m_socketPath.empty()) {
+    unlink(m_socketPath.c_str());
+  }
+#endif
+}
+
+bool JobServer::start(const std::string& socketPath)
+{
+  CEF_REQUIRE_UI_THREAD();
+
+  if (socketPath.empty()) {
+    std::thread(&JobServer::readJobs, this, std::make_shared<Connection>()).detach();
+    return true;
+  }
+
+#if OS_WIN
+  std::cerr << "Local socket job server is not supported on Windows, use stdin instead.\n";
+  return false;
+#else
+  sockaddr_un address;
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if (socketPath.size() >= sizeof(address.sun_path)) {
+    std::cerr << "Job server socket path is too long: " << socketPath << '\n';
+    return false;
+  }
+  strncpy(address.sun_path, socketPath.c_str(), sizeof(address.sun_path) - 1);
+
+  const int serverFd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (serverFd < 0) {
+    std::cerr << "Failed to create job server socket: " << strerror(errno) << '\n';
+    return false;
+  }
+  unlink(socketPath.c_str());
+  if (bind(serverFd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0
+      || listen(serverFd, SOMAXCONN) < 0)
+  {
+    std::cerr << "Failed to listen on job server socket " << socketPath << ": " << strerror(errno) << '\n';
+    close(serverFd);
+    return false;
+  }
+  m_socketPath = socketPath;
+  std::thread(&JobServer::acceptConnections, this, serverFd).detach();
+  return true;
+#endif
+}
+
+bool JobServer::isJob(int browserId) const
+{
+  return m_jobs.contains(browserId);
+}
+
+void JobServer::jobOutput(int browserId, const QString& event, QJsonObject data)
+{
+  CEF_REQUIRE_UI_THREAD();
+
+  auto it = m_jobs.constFind(browserId);
+  if (it == m_jobs.constEnd()) {
+    return;
+  }
+  data[QStringLiteral("id")] = it->id;
+  data[QStringLiteral("event")] = event;
+  write(it->connection, data);
+}
+
+void JobServer::jobFinished(int browserId, int exitCode)
+{
+  CEF_REQUIRE_UI_THREAD();
+
+  jobOutput(browserId, QStringLiteral("exit"), {{QStringLiteral("status"), exitCode}});
+
+  const auto job = m_jobs.take(browserId);
+  if (job.connection) {
+    --job.connection->pendingJobs;
+    releaseConnection(job.connection);
+  }
+}
+
+void JobServer::acceptConnections(int serverFd)
+{
+#if !OS_WIN
+  while (true) {
+    const int fd = accept(serverFd, nullptr, nullptr);
+    if (fd < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      qCWarning(app) << "job server stopped accepting connections:" << strerror(errno);
+      close(serverFd);
+      return;
+    }
+    auto connection = std::make_shared<Connection>();
+    connection->fd = fd;
+    std::thread(&JobServer::readJobs, this, connection).detach();
+  }
+#else
+  Q_UNUSED(serverFd);
+#endif
+}
+
+void JobServer::readJobs(ConnectionPtr connection)
+{
+  // NOTE: this runs on a dedicated reader thread, every job gets forwarded to the UI thread
+  auto postLine = [this, connection] (const QByteArray& line) {
+    if (line.trimmed().isEmpty()) {
+      return;
+    }
+    CefPostTask(TID_UI, makeTask([this, connection, line] () {
+      startJob(connection, line);
+    }));
+  };
+
+  if (connection->fd == -1) {
+    std::string line;
+    while (std::getline(std::cin, line)) {
+      postLine(QByteArray::fromStdString(line));
+    }
+  }
+#if !OS_WIN
+  else {
+    QByteArray buffer;
+    char chunk[4096];
+    while (true) {
+      const auto bytesRead = read(connection->fd, chunk, sizeof(chunk));
+      if (bytesRead < 0 && errno == EINTR) {
+        continue;
+      } else if (bytesRead <= 0) {
+        break;
+      }
+      buffer.append(chunk, static_cast<int>(bytesRead));
+      int newLine = -1;
+      while ((newLine = buffer.indexOf('\n')) != -1) {
+        postLine(buffer.left(newLine));
+        buffer.remove(0, newLine + 1);
+      }
+    }
+    postLine(buffer);
+  }
+#endif
+
+  CefPostTask(TID_UI, makeTask([this, connection] () {
+    inputClosed(connection);
+  }));
+}
+
+void JobServer::startJob(const ConnectionPtr& connection, const QByteArray& line)
+{
+  CEF_REQUIRE_UI_THREAD();
+
+  QJsonParseError error;
+  const auto job = QJsonDocument::fromJson(line, &error).object();
+  const auto id = job.value(QStringLiteral("id"));
+  const auto script = job.value(QStringLiteral("script")).toString();
+  if (error.error || script.isEmpty()) {
+    write(connection, {
+      {QStringLiteral("id"), id},
+      {QStringLiteral("event"), QStringLiteral("error")},
+      {QStringLiteral("message"), error.error ? error.errorString() : QStringLiteral("Missing script parameter.")}
+    });
+    return;
+  }
+
+  CefCommandLine::ArgumentList arguments;
+  arguments.push_back(script.toStdString());
+  foreach (const auto& arg, job.value(QStringLiteral("args")).toArray()) {
+    arguments.push_back(arg.toString().toStdString());
+  }
+
+  // every job gets its own cookies, cache and storage
+  auto requestContext = CefRequestContext::CreateContext(CefRequestContextSettings(), nullptr);
+  auto browser = m_app->runScript(arguments, requestContext);
+  if (!browser) {
+    write(connection, {
+      {QStringLiteral("id"), id},
+      {QStringLiteral("event"), QStringLiteral("error")},
+      {QStringLiteral("message"), QStringLiteral("Failed to create browser.")}
+    });
+    return;
+  }
+
+  qCDebug(app) << "started job" << id << "in browser" << browser->GetIdentifier();
+
+  ++connection->pendingJobs;
+  m_jobs[browser->GetIdentifier()] = {id, connection};
+  jobOutput(browser->GetIdentifier(), QStringLiteral("started"), {});
+}
+
+void JobServer::inputClosed(const ConnectionPtr& connection)
+{
+  CEF_REQUIRE_UI_THREAD();
+
+  connection->inputClosed = true;
+  releaseConnection(connection);
+}
+
+void JobServer::releaseConnection(const ConnectionPtr& connection)
+{
+  if (!connection->inputClosed || connection->pendingJobs > 0) {
+    return;
+  }
+
+  if (connection->fd == -1) {
+    // stdin got closed and all jobs finished, we are done
+    m_handler->quit();
+  }
+#if !OS_WIN
+  else if (connection->fd >= 0) {
+    close(connection->fd);
+    connection->fd = -2;
+  }
+#endif
+}
+
+void JobServer::write(const ConnectionPtr& connection, const QJsonObject& data)
+{
+  auto line = QJsonDocument(data).toJson(QJsonDocument::Compact);
+  line.append('\n');
+
+  if (connection->fd == -1) {
+    std::cout << line.constData() << std::flush;
+    return;
+  }
+#if !OS_WIN
+  const char* buffer = line.constData();
+  auto remaining = static_cast<size_t>(line.size());
+  while (connection->fd >= 0 && remaining) {
+    const auto written = send(connection->fd, buffer, remaining, MSG_NOSIGNAL);
+    if (written < 0 && errno == EINTR) {
+      continue;
+    } else if (written <= 0) {
+      qCWarning(app) << "failed to write job output:" << strerror(errno);
+      return;
+    }
+    buffer += written;
+    remaining -= static_cast<size_t>(written);
+  }
+#endif
+}
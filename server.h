@@ -0,0 +1,75 @@
+// Copyright (c) 2015 Klaralvdalens Datakonsult AB (KDAB).
+// All rights reserved. Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#ifndef PHANTOMJS_SERVER_H
+#define PHANTOMJS_SERVER_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QJsonObject>
+#include <QJsonValue>
+
+#include <memory>
+#include <string>
+
+#include "include/cef_base.h"
+
+class PhantomJSApp;
+class PhantomJSHandler;
+
+/**
+ * Long-lived job server that runs many scripts in a single CEF browser process.
+ *
+ * Jobs are read as JSON lines, either from stdin or from clients connected to
+ * a local unix socket, e.g.:
+ *
+ *   {"id": 1, "script": "/path/to/script.js", "args": ["foo", "bar"]}
+ *
+ * Every job gets its own phantom main browser with an isolated in-memory
+ * request context. Console output, errors and the exit status are streamed
+ * back as JSON lines to the connection the job was received from, e.g.:
+ *
+ *   {"id": 1, "event": "started"}
+ *   {"id": 1, "event": "console", "message": "...", "source": "...", "line": 1}
+ *   {"id": 1, "event": "exit", "status": 0}
+ *
+ * All methods except for the reader threads run on the CEF UI thread.
+ */
+class JobServer
+{
+public:
+  JobServer(PhantomJSApp* app, CefRefPtr<PhantomJSHandler> handler);
+  ~JobServer();
+
+  // start reading jobs from stdin if @p socketPath is empty, or from the local socket otherwise
+  bool start(const std::string& socketPath);
+
+  bool isJob(int browserId) const;
+  void jobOutput(int browserId, const QString& event, QJsonObject data);
+  void jobFinished(int browserId, int exitCode);
+
+private:
+  struct Connection;
+  using ConnectionPtr = std::shared_ptr<Connection>;
+
+  void acceptConnections(int serverFd);
+  void readJobs(ConnectionPtr connection);
+  void startJob(const ConnectionPtr& connection, const QByteArray& line);
+  void inputClosed(const ConnectionPtr& connection);
+  void releaseConnection(const ConnectionPtr& connection);
+  void write(const ConnectionPtr& connection, const QJsonObject& data);
+
+  struct Job
+  {
+    QJsonValue id;
+    ConnectionPtr connection;
+  };
+  QHash<int, Job> m_jobs;
+
+  PhantomJSApp* m_app;
+  CefRefPtr<PhantomJSHandler> m_handler;
+  std::string m_socketPath;
+};
+
+#endif // PHANTOMJS_SERVER_H
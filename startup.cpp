@@ -0,0 +1,40 @@
+// Copyright (c) 2015 Klaralvdalens Datakonsult AB (KDAB).
+// All rights reserved. Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include "startup.h"
+
+#include <QString>
+
+#include <chrono>
+#include <mutex>
+
+#include "debug.h"
+
+namespace {
+std::mutex timingsMutex;
+QJsonObject timings;
+double firstTimestamp = 0;
+}
+
+double startupTimestamp()
+{
+  using namespace std::chrono;
+  return duration<double, std::milli>(system_clock::now().time_since_epoch()).count();
+}
+
+void recordStartupTiming(const std::string& phase, double timestamp)
+{
+  std::lock_guard<std::mutex> lock(timingsMutex);
+  if (timings.isEmpty()) {
+    firstTimestamp = timestamp;
+  }
+  timings[QString::fromStdString(phase)] = timestamp;
+  qCDebug(startup, "%s: %.3fms", phase.c_str(), timestamp - firstTimestamp);
+}
+
+QJsonObject startupTimings()
+{
+  std::lock_guard<std::mutex> lock(timingsMutex);
+  return timings;
+}
@@ -0,0 +1,22 @@
+// Copyright (c) 2015 Klaralvdalens Datakonsult AB (KDAB).
+// All rights reserved. Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#ifndef PHANTOMJS_STARTUP_H
+#define PHANTOMJS_STARTUP_H
+
+#include <QJsonObject>
+
+#include <string>
+
+// milliseconds since the epoch, comparable across processes and to Date.now() in JavaScript
+double startupTimestamp();
+
+// record the time at which the given startup phase was reached in the current process
+// use QT_LOGGING_RULES="phantomjs.startup.debug=true" to print the phases while they are recorded
+void recordStartupTiming(const std::string& phase, double timestamp = startupTimestamp());
+
+// all phases recorded so far in the current process, mapped to their timestamps
+QJsonObject startupTimings();
+
+#endif // PHANTOMJS_STARTUP_H
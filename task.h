@@ -0,0 +1,39 @@
+// Copyright (c) 2015 Klaralvdalens Datakonsult AB (KDAB).
+// All rights reserved. Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#ifndef PHANTOMJS_TASK_H
+#define PHANTOMJS_TASK_H
+
+#include "include/cef_task.h"
+
+/**
+ * Wraps an arbitrary functor, e.g. a lambda, into a CefTask such that it can
+ * be posted to one of the CEF threads via CefPostTask or a CefTaskRunner.
+ */
+template<typename Handler>
+class FunctionTask : public CefTask
+{
+public:
+  FunctionTask(Handler handler)
+    : m_handler(handler)
+  {}
+
+  void Execute() override
+  {
+    m_handler();
+  }
+
+private:
+  Handler m_handler;
+  // Include the default reference counting implementation.
+  IMPLEMENT_REFCOUNTING(FunctionTask);
+};
+
+template<typename Handler>
+CefRefPtr<FunctionTask<Handler>> makeTask(Handler handler)
+{
+  return new FunctionTask<Handler>(handler);
+}
+
+#endif // PHANTOMJS_TASK_H